@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Block header is padded so that the first allocation in a block is aligned
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static ArenaBlock* create_arena_block(size_t capacity) {
+    void* memory = NULL;
+    // aligned_alloc requires the size to be a multiple of the alignment
+    size_t total = ARENA_HEADER_SIZE + ((capacity + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1));
+#ifdef _WIN32
+    memory = _aligned_malloc(total, ARENA_ALIGNMENT);
+#else
+    if (posix_memalign(&memory, ARENA_ALIGNMENT, total) != 0) memory = NULL;
+#endif
+    if (!memory) {
+        fprintf(stderr, "Memory allocation failed when allocating a new arena block.\n");
+        exit(EXIT_FAILURE);
+    }
+    ArenaBlock* block = (ArenaBlock*)memory;
+    block->next = NULL;
+    block->capacity = total - ARENA_HEADER_SIZE;
+    block->used = 0;
+    return block;
+}
+
+static void free_arena_block(ArenaBlock* block) {
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+/* Create an arena that grows in blocks of (at least) block_size bytes */
+Arena* create_arena(size_t block_size) {
+    Arena* arena = (Arena*)malloc(sizeof(Arena));
+    if (!arena) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for an arena.\n");
+        exit(EXIT_FAILURE);
+    }
+    arena->block_size = block_size;
+    arena->head = create_arena_block(block_size);
+    arena->current = arena->head;
+    return arena;
+}
+
+/* Allocate size bytes aligned to ARENA_ALIGNMENT. The memory is not initialised. */
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena->current;
+    while (block->used + size > block->capacity) {
+        if (block->next == NULL) {
+            // Oversized requests get a block of their own
+            size_t capacity = size > arena->block_size ? size : arena->block_size;
+            block->next = create_arena_block(capacity);
+        }
+        block = block->next;
+        block->used = 0; // blocks after current are stale from a previous step
+    }
+    arena->current = block;
+
+    void* ptr = (char*)block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/* Allocate size bytes set to zero */
+void* arena_calloc(Arena* arena, size_t size) {
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/* Release everything allocated from the arena in O(1). The blocks are kept for reuse. */
+void arena_reset(Arena* arena) {
+    arena->current = arena->head;
+    arena->head->used = 0;
+}
+
+void free_arena(Arena* arena) {
+    if (arena) {
+        ArenaBlock* block = arena->head;
+        while (block) {
+            ArenaBlock* next = block->next;
+            free_arena_block(block);
+            block = next;
+        }
+        free(arena);
+        arena = NULL;
+    }
+}
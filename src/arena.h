@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGNMENT 64 // cache line, also enough for any SIMD load
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+} ArenaBlock;
+
+/* Bump allocator for memory that lives for a single training step.
+   Blocks are kept after a reset so that later steps do not touch malloc at all. */
+typedef struct Arena {
+    ArenaBlock* head;
+    ArenaBlock* current;
+    size_t block_size;
+} Arena;
+
+Arena* create_arena(size_t block_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t size);
+void arena_reset(Arena* arena);
+void free_arena(Arena* arena);
+
+#endif // ARENA_H
@@ -2,56 +2,77 @@
 #include <stdlib.h>
 
 #include "backward.h"
+#include "fusion.h"
 #include "tensor.h"
 
-/* Linear search to find if the given value is in the array. A hashmap would be more efficient but linear search is very simple */
-int has_child_been_visited(Tensor* pointer, Tensor** visited, int visited_length) {
-    for (int i=0; i < visited_length; i++) {
-        // check if pointer to tensor is in the visited array
-        if (pointer == visited[i]) {
-            return 1;
-        }
+// Incremented for every sort, a tensor is visited when its visit_generation matches
+static unsigned int topo_generation = 0;
+
+// Tensor on the DFS stack along with the index of the next parent to visit
+typedef struct TopoFrame {
+    Tensor* tensor;
+    int next_parent;
+} TopoFrame;
+
+/* Grow a buffer of pointers or frames when it is full */
+static void* grow_buffer(void* buffer, int* capacity, size_t element_size) {
+    *capacity *= 2;
+    buffer = realloc(buffer, *capacity * element_size);
+    if (buffer == NULL) {
+        perror("Reallocation failed");
+        exit(EXIT_FAILURE);
     }
-    return 0;
+    return buffer;
 }
 
-void build_topo_recursive(Tensor* self, Tensor*** visited_ptr, Tensor*** topo_ptr, int* num_visited_nodes, int* num_topo_nodes, int* topo_capacity) {
-    // only add child once
-    if (has_child_been_visited(self, *visited_ptr, *num_visited_nodes)) return;
-    
-    (*visited_ptr)[(*num_visited_nodes)++] = self;
-    if (*num_visited_nodes >= *topo_capacity) {
-        // Double the size of the allocated memory when the arrays are full
-        *topo_capacity *= 2;
-        *visited_ptr = (Tensor**)realloc(*visited_ptr, *topo_capacity * sizeof(Tensor*));
-        *topo_ptr = (Tensor**)realloc(*topo_ptr, *topo_capacity * sizeof(Tensor*));
-        if (*visited_ptr == NULL || *topo_ptr == NULL) {
-            perror("Reallocation failed");
-            exit(EXIT_FAILURE);
-        }
-    }
-    // Depth-first search so that the required gradients are available when back propagating through the graph
-    for (int i = 0; i < self->num_parents; i++) {
-        build_topo_recursive(self->parents[i], visited_ptr, topo_ptr, num_visited_nodes, num_topo_nodes, topo_capacity);
+/* Create a topological ordering of the Tensors in the graph. An iterative depth-first
+   search adds each tensor after all of its parents, so the required gradients are
+   available when back propagating through the graph in reverse. Visited tensors are
+   marked with the generation of the sort, which keeps it linear in the graph size and
+   off the C stack for long graphs. */
+Topo* build_topo(Tensor* self) {
+    unsigned int generation = ++topo_generation;
+    if (generation == 0) {
+        // wrapped around, skip the value that new tensors start with
+        generation = ++topo_generation;
     }
-    // Add self to topo here
-    (*topo_ptr)[(*num_topo_nodes)++] = self;
-}
 
-/* Create a topological ordering of the Tensors in the graph. */
-Topo* build_topo(Tensor* self) {
-    int topo_capacity = 10; // initial size
-    Tensor** visited = (Tensor**)calloc(topo_capacity, sizeof(Tensor*));
+    int topo_capacity = 16;
     int topo_length = 0;
-
-    // Dynamically allocated topo array
     Tensor** topo = (Tensor**)malloc(topo_capacity * sizeof(Tensor*));
-    int topo_initial_idx = 0;
-
-    // use &visited and &topo to update the pointer when reallocating memory
-    build_topo_recursive(self, &visited, &topo, &topo_length, &topo_initial_idx, &topo_capacity);
+    int stack_capacity = 16;
+    int stack_length = 0;
+    TopoFrame* stack = (TopoFrame*)malloc(stack_capacity * sizeof(TopoFrame));
+    if (!topo || !stack) {
+        fprintf(stderr, "Memory allocation failed when sorting the graph.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    free(visited);
+    self->visit_generation = generation;
+    stack[stack_length++] = (TopoFrame){self, 0};
+    while (stack_length > 0) {
+        TopoFrame* frame = &stack[stack_length-1];
+        Tensor* t = frame->tensor;
+        if (frame->next_parent < t->num_parents) {
+            Tensor* parent = t->parents[frame->next_parent++];
+            // only add each tensor once
+            if (parent->visit_generation != generation) {
+                parent->visit_generation = generation;
+                if (stack_length == stack_capacity) {
+                    stack = (TopoFrame*)grow_buffer(stack, &stack_capacity, sizeof(TopoFrame));
+                }
+                stack[stack_length++] = (TopoFrame){parent, 0};
+            }
+        } else {
+            // all parents are in the ordering, add the tensor itself
+            if (topo_length == topo_capacity) {
+                topo = (Tensor**)grow_buffer(topo, &topo_capacity, sizeof(Tensor*));
+            }
+            topo[topo_length++] = t;
+            stack_length--;
+        }
+    }
+    free(stack);
 
     // resize the topo to free extra allocated memory
     topo = (Tensor**)realloc(topo, topo_length * sizeof(Tensor*));
@@ -71,16 +92,10 @@ void _compute_gradients(Topo* topo) {
     }
 }
 
-void _zero_gradients(Topo* topo) {
-    for (int i=0; i < topo->length; i++) {
-        if (topo->ordering[i]->requires_grad) {
-            for (int j=0; j < topo->ordering[i]->size; j++) {
-                topo->ordering[i]->grad[j] = 0.0;
-            }
-        }
-    }
-}
-
+/* Back propagate from the scalar t. Grads are added onto the grads the leaves already
+   have, so calling backward on several batches before an update accumulates them. The
+   parameters are reset with zero_grad() before the first batch. Op results start with
+   zeroed grads, so a graph must only be back propagated once, use a Graph to replay it. */
 Topo* backward(Tensor* t) {
     if (t->size != 1) {
         printf("Tensor must be a scaler in order to perform back propagation.\n");
@@ -88,10 +103,13 @@ Topo* backward(Tensor* t) {
         exit(EXIT_FAILURE);
     }
 
+    materialize(t); // ops recorded in lazy mode are fused and run first
     Topo* topo = build_topo(t);
-    // Zeroing gradients in backwards function is not ideal when accumulating gradients over multiple batches.
-    // But it simplifies and speeds up the code as I dont have to recompute the topo
-    _zero_gradients(topo); 
+    // ops recorded in lazy mode get their grads once they are needed
+    for (int i = 0; i < topo->length; i++) {
+        if (topo->ordering[i]->requires_grad) alloc_op_grad(topo->ordering[i]);
+    }
+    alloc_op_grad(t);
     t->grad[0] = 1.0; // Set the starting tensors gradient to 1
     _compute_gradients(topo);
 
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "broadcast.h"
+#include "thread_pool.h"
+
+/* Write the shape a and b broadcast to into shape, which needs room for the larger
+   number of dims, and return its number of dims. Returns -1 if they don't broadcast.
+   shape can be NULL to only check them. */
+int broadcast_shapes(const int* a_shape, int a_dims, const int* b_shape, int b_dims, int* shape) {
+    int num_dims = a_dims > b_dims ? a_dims : b_dims;
+    for (int i = 0; i < num_dims; i++) {
+        // counting from the last dim, a missing dim acts as 1
+        int a_size = i < a_dims ? a_shape[a_dims-1 - i] : 1;
+        int b_size = i < b_dims ? b_shape[b_dims-1 - i] : 1;
+        if (a_size != b_size && a_size != 1 && b_size != 1) return -1;
+        if (shape) shape[num_dims-1 - i] = a_size == 1 ? b_size : a_size;
+    }
+    return num_dims;
+}
+
+/* Set up an iterator over shape for operands whose shapes broadcast to it. Exits if one
+   doesn't, callers check the shapes of ops up front. */
+void init_broadcast_iter(BroadcastIter* it, const int* shape, int num_dims,
+                         const int* const* operand_shapes, const int* operand_dims, int num_operands) {
+    if (num_operands > BROADCAST_MAX_OPERANDS) {
+        fprintf(stderr, "A broadcast op takes at most %d operands.\n", BROADCAST_MAX_OPERANDS);
+        exit(EXIT_FAILURE);
+    }
+    it->num_operands = num_operands;
+    it->num_dims = 0;
+    it->size = 1;
+
+    // Row-major strides of each operand so far, built up from the last dim
+    long long operand_strides[BROADCAST_MAX_OPERANDS];
+    for (int k = 0; k < num_operands; k++) operand_strides[k] = 1;
+
+    // Walk the dims from the last one and store them innermost first, reversed below
+    for (int i = num_dims-1; i >= 0; i--) {
+        int dim_size = shape[i];
+        long long strides[BROADCAST_MAX_OPERANDS];
+        for (int k = 0; k < num_operands; k++) {
+            int j = i - (num_dims - operand_dims[k]);
+            int operand_size = j >= 0 ? operand_shapes[k][j] : 1;
+            if (operand_size != dim_size && operand_size != 1) {
+                fprintf(stderr, "Operand %d does not broadcast to the shape of the result.\n", k);
+                exit(EXIT_FAILURE);
+            }
+            strides[k] = operand_size == 1 ? 0 : operand_strides[k];
+            operand_strides[k] *= operand_size;
+        }
+        it->size *= dim_size;
+        if (dim_size == 1) continue;
+
+        // Merge with the dim inside it when every operand steps through both as one
+        int last = it->num_dims - 1;
+        int mergeable = last >= 0;
+        for (int k = 0; k < num_operands && mergeable; k++) {
+            mergeable = strides[k] == it->strides[k][last] * it->shape[last];
+        }
+        if (mergeable) {
+            it->shape[last] *= dim_size;
+            continue;
+        }
+        for (int k = 0; k < num_operands; k++) it->strides[k][it->num_dims] = strides[k];
+        it->shape[it->num_dims++] = dim_size;
+    }
+
+    // A shape of all ones is a single element
+    if (it->num_dims == 0) {
+        it->shape[0] = 1;
+        for (int k = 0; k < num_operands; k++) it->strides[k][0] = 1;
+        it->num_dims = 1;
+    }
+    for (int d = 0; d < it->num_dims / 2; d++) {
+        int other = it->num_dims-1 - d;
+        long long size = it->shape[d];
+        it->shape[d] = it->shape[other];
+        it->shape[other] = size;
+        for (int k = 0; k < num_operands; k++) {
+            long long stride = it->strides[k][d];
+            it->strides[k][d] = it->strides[k][other];
+            it->strides[k][other] = stride;
+        }
+    }
+}
+
+/* Offset into an operand of the element at a flat index of the broadcast shape */
+long long broadcast_offset(const BroadcastIter* it, int operand, long long index) {
+    long long offset = 0;
+    for (int d = it->num_dims-1; d >= 0; d--) {
+        offset += (index % it->shape[d]) * it->strides[operand][d];
+        index /= it->shape[d];
+    }
+    return offset;
+}
+
+typedef struct BroadcastWalk {
+    const BroadcastIter* it;
+    float** data;
+    long long unit; // elements per parallel_for item
+    BroadcastRunFunc func;
+    void* ctx;
+} BroadcastWalk;
+
+static void broadcast_walk_task(void* ctx, long long start_unit, long long end_unit) {
+    BroadcastWalk* walk = (BroadcastWalk*)ctx;
+    const BroadcastIter* it = walk->it;
+    int inner = it->num_dims-1;
+    long long start = start_unit * walk->unit;
+    long long end = end_unit * walk->unit;
+
+    long long index[BROADCAST_MAX_DIMS];
+    long long rest = start;
+    for (int d = inner; d >= 0; d--) {
+        index[d] = rest % it->shape[d];
+        rest /= it->shape[d];
+    }
+    float* data[BROADCAST_MAX_OPERANDS];
+    long long inner_strides[BROADCAST_MAX_OPERANDS];
+    for (int k = 0; k < it->num_operands; k++) inner_strides[k] = it->strides[k][inner];
+
+    for (long long i = start; i < end;) {
+        for (int k = 0; k < it->num_operands; k++) {
+            long long offset = 0;
+            for (int d = 0; d <= inner; d++) offset += index[d] * it->strides[k][d];
+            data[k] = walk->data[k] + offset;
+        }
+        long long n = it->shape[inner] - index[inner];
+        if (end - i < n) n = end - i;
+        walk->func(walk->ctx, data, inner_strides, n);
+        i += n;
+
+        // carry the finished run into the outer dims
+        index[inner] += n;
+        for (int d = inner; d > 0 && index[d] == it->shape[d]; d--) {
+            index[d] = 0;
+            index[d-1]++;
+        }
+    }
+}
+
+/* Call func on runs of the inner dim that cover every element of the broadcast shape once.
+   Operand 0 is the one written to. When it has no broadcast dims the elements are split
+   across threads freely. When it is broadcast, like a grad reduced over the dims its
+   tensor was broadcast in, only slices of an outer dim that it isn't broadcast in go to
+   separate threads, so no two threads write the same element, otherwise the walk is serial. */
+void broadcast_for_each(const BroadcastIter* it, float** data, int cost, BroadcastRunFunc func, void* ctx) {
+    if (it->size == 0) return;
+    int reduces = 0;
+    for (int d = 0; d < it->num_dims; d++) {
+        if (it->strides[0][d] == 0) reduces = 1;
+    }
+
+    BroadcastWalk walk = {it, data, 1, func, ctx};
+    if (!reduces) {
+        parallel_for(it->size, grain_size_for_cost(cost), broadcast_walk_task, &walk);
+    } else if (it->num_dims > 1 && it->strides[0][0] != 0) {
+        walk.unit = it->size / it->shape[0];
+        parallel_for(it->shape[0], grain_size_for_cost((long long)cost * walk.unit), broadcast_walk_task, &walk);
+    } else {
+        walk.unit = it->size;
+        broadcast_walk_task(&walk, 0, 1);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+// Dims of size 1 are dropped before they are stored, so 64 covers any tensor whose
+// number of elements fits in a long long
+#define BROADCAST_MAX_DIMS 64
+#define BROADCAST_MAX_OPERANDS 3
+
+/* Walks a shape and the operands broadcast to it NumPy style: shapes are aligned at their
+   last dim and an operand of size 1 in a dim, or without the dim, repeats along it. The
+   zero strides of the broadcast dims are worked out once, dims of size 1 are dropped and
+   neighbouring dims that are contiguous for every operand are merged, so a walk runs the
+   longest possible inner loops. Operands are contiguous row-major buffers. */
+typedef struct BroadcastIter {
+    int num_dims;
+    int num_operands;
+    long long size; // elements of the broadcast shape
+    long long shape[BROADCAST_MAX_DIMS]; // merged dims can hold more elements than an int
+    long long strides[BROADCAST_MAX_OPERANDS][BROADCAST_MAX_DIMS]; // 0 along the dims an operand is broadcast in
+} BroadcastIter;
+
+// Points to a function that processes n elements along the innermost dim. data holds the
+// first element of each operand and strides their inner strides, 1 or 0 when broadcast.
+typedef void (*BroadcastRunFunc)(void* ctx, float** data, const long long* strides, long long n);
+
+int broadcast_shapes(const int* a_shape, int a_dims, const int* b_shape, int b_dims, int* shape);
+void init_broadcast_iter(BroadcastIter* it, const int* shape, int num_dims,
+                         const int* const* operand_shapes, const int* operand_dims, int num_operands);
+long long broadcast_offset(const BroadcastIter* it, int operand, long long index);
+void broadcast_for_each(const BroadcastIter* it, float** data, int cost, BroadcastRunFunc func, void* ctx);
+
+#endif // BROADCAST_H
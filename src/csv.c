@@ -0,0 +1,311 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csv.h"
+#include "thread_pool.h"
+
+// A chunk is only split for another thread when each piece gets at least this many bytes
+#define CSV_MIN_PIECE_SIZE (64 << 10)
+
+// Powers of ten that are exact as doubles
+static const double exact_powers_of_10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double power_of_10(int exponent) {
+    return exponent <= 22 ? exact_powers_of_10[exponent] : pow(10, exponent);
+}
+
+/* Parse a decimal float such as -12.5e-3 starting at p. Unlike strtof it ignores the
+   locale and doesn't skip leading spaces. Up to 19 significant digits are kept and
+   scaled by a power of ten in double, so the result is within an ulp of strtof. Sets
+   end to the first character after the number, or to p if there is no number. */
+float parse_csv_float(const char* p, const char** end) {
+    const char* start = p;
+    int negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mantissa < 1000000000000000000ULL) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            exponent++; // digits past what fits only scale the number
+        }
+    }
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) {
+        *end = start;
+        return 0;
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* q = p + 1;
+        int exponent_negative = *q == '-';
+        if (*q == '-' || *q == '+') q++;
+        if (*q >= '0' && *q <= '9') {
+            int value = 0;
+            for (; *q >= '0' && *q <= '9'; q++) {
+                if (value < 10000) value = value * 10 + (*q - '0');
+            }
+            exponent += exponent_negative ? -value : value;
+            p = q;
+        }
+    }
+    *end = p;
+
+    double value = (double)mantissa;
+    if (exponent < 0) {
+        // split scales past the largest double so they don't overflow to inf
+        value = exponent < -300 ? value / 1e300 / power_of_10(exponent < -700 ? 400 : -exponent - 300)
+                                : value / power_of_10(-exponent);
+    } else if (exponent > 0) {
+        value *= power_of_10(exponent > 400 ? 400 : exponent);
+    }
+    return (float)(negative ? -value : value);
+}
+
+static const char* skip_blanks(const char* p) {
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+/* Number of comma separated numbers in the line [p, line_end), -1 if something else is there */
+static int count_csv_fields(const char* p, const char* line_end) {
+    int count = 0;
+    while (1) {
+        const char* end;
+        parse_csv_float(skip_blanks(p), &end);
+        if (end == skip_blanks(p)) return -1;
+        count++;
+        p = skip_blanks(end);
+        if (*p != ',') break;
+        p++;
+    }
+    if (*p == '\r') p++;
+    return p == line_end ? count : -1;
+}
+
+static int is_blank_line(const char* p, const char* line_end) {
+    p = skip_blanks(p);
+    if (p < line_end && *p == '\r') p++;
+    return p == line_end;
+}
+
+/* Lines of a chunk parsed by one thread into its own rows */
+typedef struct CsvPiece {
+    const char* start;
+    const char* end; // just after the last newline of the piece
+    float* x;
+    float* y;
+    int rows;
+    int capacity; // rows x and y have room for
+    int lines; // including blank lines
+    int error_line; // first line of the piece that didn't parse, -1 if they all did
+} CsvPiece;
+
+typedef struct CsvChunk {
+    CsvPiece* pieces;
+    int num_pieces;
+    int columns; // features and the label
+} CsvChunk;
+
+static void grow_piece(CsvPiece* piece, int rows, int columns) {
+    if (rows <= piece->capacity) return;
+    piece->capacity = rows;
+    piece->x = (float*)realloc(piece->x, (size_t)rows * (columns - 1) * sizeof(float));
+    piece->y = (float*)realloc(piece->y, (size_t)rows * sizeof(float));
+    if (!piece->x || !piece->y) {
+        fprintf(stderr, "Memory allocation failed when parsing a CSV file.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Parse one line of exactly columns numbers into x and y, returns 0 if it doesn't fit */
+static int parse_csv_row(const char* p, const char* line_end, int columns, float* x, float* y) {
+    for (int c = 0; c < columns; c++) {
+        p = skip_blanks(p);
+        const char* end;
+        float value = parse_csv_float(p, &end);
+        if (end == p) return 0;
+        if (c < columns - 1) {
+            x[c] = value;
+        } else {
+            *y = value;
+        }
+        p = skip_blanks(end);
+        if (c < columns - 1) {
+            if (*p != ',') return 0;
+            p++;
+        }
+    }
+    if (*p == '\r') p++;
+    return p == line_end;
+}
+
+static void parse_piece_task(void* ctx, long long start, long long end) {
+    CsvChunk* chunk = (CsvChunk*)ctx;
+    int features = chunk->columns - 1;
+    for (int i = start; i < end; i++) {
+        CsvPiece* piece = &chunk->pieces[i];
+        // size the rows for every newline, blank lines only waste a little
+        int newlines = 0;
+        for (const char* p = piece->start; (p = memchr(p, '\n', piece->end - p)) != NULL; p++) newlines++;
+        grow_piece(piece, newlines + 1, chunk->columns);
+
+        piece->rows = 0;
+        piece->lines = 0;
+        piece->error_line = -1;
+        const char* p = piece->start;
+        while (p < piece->end) {
+            const char* line_end = memchr(p, '\n', piece->end - p);
+            if (!line_end) line_end = piece->end;
+            if (!is_blank_line(p, line_end)) {
+                if (!parse_csv_row(p, line_end, chunk->columns, piece->x + (size_t)piece->rows * features,
+                                   piece->y + piece->rows)) {
+                    piece->error_line = piece->lines;
+                    break;
+                }
+                piece->rows++;
+            }
+            piece->lines++;
+            p = line_end + 1;
+        }
+    }
+}
+
+/* Split [start, end) into pieces of about equal size that end on line boundaries */
+static void split_chunk(CsvChunk* chunk, const char* start, const char* end) {
+    long long size = end - start;
+    int pieces = (int)(size / CSV_MIN_PIECE_SIZE);
+    int threads = get_num_threads();
+    if (pieces > threads) pieces = threads;
+    if (pieces < 1) pieces = 1;
+
+    chunk->num_pieces = 0;
+    const char* p = start;
+    for (int i = 0; i < pieces && p < end; i++) {
+        const char* piece_end = i == pieces - 1 ? end : start + size * (i + 1) / pieces;
+        if (piece_end < p) piece_end = p;
+        if (piece_end < end) {
+            const char* newline = memchr(piece_end, '\n', end - piece_end);
+            piece_end = newline ? newline + 1 : end;
+        }
+        chunk->pieces[chunk->num_pieces].start = p;
+        chunk->pieces[chunk->num_pieces].end = piece_end;
+        chunk->num_pieces++;
+        p = piece_end;
+    }
+}
+
+/* Stream a CSV file of numbers with the features of a row followed by its label on each
+   line. A first line that isn't numbers is skipped as a header and blank lines are
+   ignored. The file is read CSV_CHUNK_SIZE bytes at a time, each chunk is cut at line
+   boundaries into one piece per thread and the pieces are parsed in parallel. The rows
+   of each piece are then handed to func in file order, so only a chunk and its parsed
+   rows are ever in memory. */
+void read_csv(const char* file_name, CsvRowsFunc func, void* ctx) {
+    FILE* f = fopen(file_name, "rb");
+    if (f == NULL) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = CSV_CHUNK_SIZE;
+    char* buffer = (char*)malloc(capacity + 1);
+    int threads = get_num_threads();
+    CsvChunk chunk = {(CsvPiece*)calloc(threads, sizeof(CsvPiece)), 0, 0};
+    if (!buffer || !chunk.pieces) {
+        fprintf(stderr, "Memory allocation failed when reading a CSV file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t carry = 0; // bytes of an unfinished line kept from the last chunk
+    long long line_number = 0; // lines before the current chunk
+    int first_line = 1;
+    while (1) {
+        size_t read = fread(buffer + carry, 1, capacity - carry, f);
+        size_t total = carry + read;
+        int eof = read == 0;
+        if (total == 0) break;
+        buffer[total] = '\0'; // the parser can look one past the end of a line
+
+        // parse up to the last complete line, or everything at the end of the file
+        size_t complete = total;
+        if (!eof) {
+            while (complete > 0 && buffer[complete - 1] != '\n') complete--;
+            if (complete == 0) {
+                // a single line longer than the buffer
+                capacity *= 2;
+                buffer = (char*)realloc(buffer, capacity + 1);
+                if (!buffer) {
+                    fprintf(stderr, "Memory allocation failed when reading a CSV file.\n");
+                    exit(EXIT_FAILURE);
+                }
+                carry = total;
+                continue;
+            }
+        }
+        char* start = buffer;
+        char* end = buffer + complete;
+
+        // the first non blank line is either a header or gives the number of columns
+        while (chunk.columns == 0 && start < end) {
+            char* line_end = memchr(start, '\n', end - start);
+            if (!line_end) line_end = end;
+            if (!is_blank_line(start, line_end)) {
+                chunk.columns = count_csv_fields(start, line_end);
+                if (chunk.columns < 0 && first_line) {
+                    chunk.columns = 0;
+                } else if (chunk.columns < 2) {
+                    printf("Line %lld of %s needs at least one feature and a label!\n", line_number + 1, file_name);
+                    exit(EXIT_FAILURE);
+                } else {
+                    break;
+                }
+                first_line = 0;
+            }
+            line_number++;
+            start = line_end + (line_end < end);
+        }
+
+        if (start < end) {
+            split_chunk(&chunk, start, end);
+            parallel_for(chunk.num_pieces, 1, parse_piece_task, &chunk);
+            for (int i = 0; i < chunk.num_pieces; i++) {
+                CsvPiece* piece = &chunk.pieces[i];
+                if (piece->error_line >= 0) {
+                    printf("Line %lld of %s does not have %d numbers!\n",
+                           line_number + piece->error_line + 1, file_name, chunk.columns);
+                    exit(EXIT_FAILURE);
+                }
+                if (piece->rows > 0) func(ctx, piece->x, piece->y, piece->rows, chunk.columns - 1);
+                line_number += piece->lines;
+            }
+        }
+
+        carry = total - complete;
+        memmove(buffer, buffer + complete, carry);
+        if (eof) break;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        free(chunk.pieces[i].x);
+        free(chunk.pieces[i].y);
+    }
+    free(chunk.pieces);
+    free(buffer);
+    fclose(f);
+}
@@ -0,0 +1,14 @@
+#ifndef CSV_H
+#define CSV_H
+
+// Bytes of the file read and parsed at a time
+#define CSV_CHUNK_SIZE (16 << 20)
+
+// Points to a function that takes rows parsed from a CSV file in file order. x holds
+// rows x num_features features and y the label of each row, both only valid during the call.
+typedef void (*CsvRowsFunc)(void* ctx, const float* x, const float* y, int rows, int num_features);
+
+float parse_csv_float(const char* p, const char** end);
+void read_csv(const char* file_name, CsvRowsFunc func, void* ctx);
+
+#endif // CSV_H
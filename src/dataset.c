@@ -1,7 +1,15 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include "csv.h"
 #include "dataset.h"
 #include "utility.h"
 
@@ -68,24 +76,450 @@ Dataset* create_moons(int n_samples_outer_circle, int n_samples_inner_circle, fl
     moons->x = data;
     moons->y = labels;
     moons->length = n_samples_outer_circle + n_samples_inner_circle;
+    moons->num_features = 2;
+    moons->mapping = NULL;
+    moons->mapping_size = 0;
 
     free(linspace_values_outer);
     free(linspace_values_inner);
     return moons;
 }
 
-void free_dataset(Dataset* dataset) {
+/* Tensor of shape [end-start, num_features] that views the samples [start, end)
+   in place, so taking a batch does not copy it. The dataset must outlive the tensor. */
+Tensor* dataset_inputs_view(Dataset* dataset, int start, int end) {
+    int shape[2] = {end - start, dataset->num_features};
+    return create_tensor_from_buffer(dataset->x + (size_t)start * dataset->num_features, shape, 2);
+}
+
+/* Tensor of shape [end-start, 1] that views the labels of the samples [start, end) in place */
+Tensor* dataset_labels_view(Dataset* dataset, int start, int end) {
+    int shape[2] = {end - start, 1};
+    return create_tensor_from_buffer(dataset->y + start, shape, 2);
+}
+
+/* Fill in a header for rows x features float32 samples, sections follow each other */
+static DatasetFileHeader dataset_file_header(uint64_t rows, uint64_t features) {
+    DatasetFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC));
+    header.version = DATASET_FILE_VERSION;
+    header.dtype = DATASET_DTYPE_FLOAT32;
+    header.rows = rows;
+    header.features = features;
+    header.features_offset = sizeof(DatasetFileHeader);
+    uint64_t features_end = header.features_offset + rows * features * sizeof(float);
+    header.labels_offset = (features_end + DATASET_FILE_ALIGNMENT - 1) / DATASET_FILE_ALIGNMENT * DATASET_FILE_ALIGNMENT;
+    return header;
+}
+
+/* Seek to a byte offset of f past 2GB, long is 32 bits on Windows */
+static int seek_file(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/* Write count floats at byte offset of f, exits on failure */
+static void write_section(FILE* f, const char* file_name, uint64_t offset, const float* data, size_t count) {
+    if (seek_file(f, offset) != 0 || fwrite(data, sizeof(float), count, f) != count) {
+        printf("Error writing dataset file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Write the dataset in the binary format described by DatasetFileHeader */
+void save_dataset(const char* file_name, Dataset* dataset) {
+    FILE* f = fopen(file_name, "wb");
+    if (f == NULL) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    DatasetFileHeader header = dataset_file_header(dataset->length, dataset->num_features);
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        printf("Error writing dataset file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    write_section(f, file_name, header.features_offset, dataset->x, (size_t)dataset->length * dataset->num_features);
+    write_section(f, file_name, header.labels_offset, dataset->y, dataset->length);
+    fclose(f);
+}
+
+/* Map a binary dataset file into memory. x and y point straight into the mapped pages,
+   so nothing is read or copied up front and pages are loaded as batches touch them.
+   The mapping is private, writes to the data are never stored to the file. */
+Dataset* load_dataset_mmap(const char* file_name) {
+#ifdef _WIN32
+    printf("Cannot map dataset file %s, load_dataset_mmap() needs a POSIX system!\n", file_name);
+    exit(EXIT_FAILURE);
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetFileHeader)) {
+        printf("%s is not a dataset file!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        printf("Failed to map dataset file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    const DatasetFileHeader* header = (const DatasetFileHeader*)mapping;
+    if (memcmp(header->magic, DATASET_FILE_MAGIC, sizeof(DATASET_FILE_MAGIC)) != 0 ||
+        header->version != DATASET_FILE_VERSION || header->dtype != DATASET_DTYPE_FLOAT32) {
+        printf("%s is not a version %d float32 dataset file!\n", file_name, DATASET_FILE_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    if (header->features_offset % DATASET_FILE_ALIGNMENT != 0 || header->labels_offset % DATASET_FILE_ALIGNMENT != 0 ||
+        header->rows > INT32_MAX || header->features > INT32_MAX ||
+        header->features_offset + header->rows * header->features * sizeof(float) > size ||
+        header->labels_offset + header->rows * sizeof(float) > size) {
+        printf("Dataset file %s is truncated or has a corrupt header!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    Dataset* dataset = (Dataset*)malloc(sizeof(Dataset));
+    if (!dataset) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for Dataset.\n");
+        exit(EXIT_FAILURE);
+    }
+    dataset->x = (float*)((char*)mapping + header->features_offset);
+    dataset->y = (float*)((char*)mapping + header->labels_offset);
+    dataset->length = (int)header->rows;
+    dataset->num_features = (int)header->features;
+    dataset->mapping = mapping;
+    dataset->mapping_size = size;
+    return dataset;
+#endif
+}
+
+// Rows of a CSV file appended to a dataset on the heap
+typedef struct CsvDataset {
+    Dataset* dataset;
+    int capacity; // rows x and y have room for
+} CsvDataset;
+
+static void append_csv_rows(void* ctx, const float* x, const float* y, int rows, int num_features) {
+    CsvDataset* csv = (CsvDataset*)ctx;
+    Dataset* dataset = csv->dataset;
+    dataset->num_features = num_features;
+    if (dataset->length + rows > csv->capacity) {
+        while (dataset->length + rows > csv->capacity) {
+            csv->capacity = csv->capacity ? csv->capacity * 2 : rows;
+        }
+        dataset->x = (float*)realloc(dataset->x, (size_t)csv->capacity * num_features * sizeof(float));
+        dataset->y = (float*)realloc(dataset->y, (size_t)csv->capacity * sizeof(float));
+        if (!dataset->x || !dataset->y) {
+            fprintf(stderr, "Memory allocation failed when loading a CSV file.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(dataset->x + (size_t)dataset->length * num_features, x, (size_t)rows * num_features * sizeof(float));
+    memcpy(dataset->y + dataset->length, y, rows * sizeof(float));
+    dataset->length += rows;
+}
+
+/* Load a CSV file with a row of features followed by a label on every line into a
+   dataset on the heap, see read_csv(). Use convert_csv_to_dataset() for files that
+   don't fit in memory. */
+Dataset* load_csv_dataset(const char* file_name) {
+    Dataset* dataset = (Dataset*)calloc(1, sizeof(Dataset));
+    if (!dataset) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for Dataset.\n");
+        exit(EXIT_FAILURE);
+    }
+    CsvDataset csv = {dataset, 0};
+    read_csv(file_name, append_csv_rows, &csv);
+    if (dataset->length == 0) {
+        printf("%s has no rows!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    return dataset;
+}
+
+// Streams the features and labels of a CSV file are written to while it is converted
+typedef struct CsvConversion {
+    const char* file_name;
+    FILE* features;
+    FILE* labels;
+    uint64_t rows;
+    int num_features;
+} CsvConversion;
+
+static void write_csv_rows(void* ctx, const float* x, const float* y, int rows, int num_features) {
+    CsvConversion* conversion = (CsvConversion*)ctx;
+    conversion->num_features = num_features;
+    size_t count = (size_t)rows * num_features;
+    if (fwrite(x, sizeof(float), count, conversion->features) != count ||
+        fwrite(y, sizeof(float), rows, conversion->labels) != (size_t)rows) {
+        printf("Error writing dataset file %s!\n", conversion->file_name);
+        exit(EXIT_FAILURE);
+    }
+    conversion->rows += rows;
+}
+
+/* Convert a CSV file with a row of features followed by a label on every line into the
+   binary dataset format, see read_csv(). The features are written straight into the
+   file as they are parsed and the labels go through a temporary file until the number
+   of rows is known, so memory use doesn't depend on the size of the CSV. */
+void convert_csv_to_dataset(const char* csv_file_name, const char* file_name) {
+    CsvConversion conversion = {file_name, fopen(file_name, "wb"), tmpfile(), 0, 0};
+    if (conversion.features == NULL || conversion.labels == NULL) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    // the features section starts right after the header, which is written last
+    seek_file(conversion.features, sizeof(DatasetFileHeader));
+    read_csv(csv_file_name, write_csv_rows, &conversion);
+    if (conversion.rows == 0) {
+        printf("%s has no rows!\n", csv_file_name);
+        exit(EXIT_FAILURE);
+    }
 
+    DatasetFileHeader header = dataset_file_header(conversion.rows, conversion.num_features);
+    float labels[4096];
+    size_t count;
+    rewind(conversion.labels);
+    if (seek_file(conversion.features, header.labels_offset) != 0) {
+        printf("Error writing dataset file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    while ((count = fread(labels, sizeof(float), 4096, conversion.labels)) > 0) {
+        if (fwrite(labels, sizeof(float), count, conversion.features) != count) {
+            printf("Error writing dataset file %s!\n", file_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    rewind(conversion.features);
+    if (fwrite(&header, sizeof(header), 1, conversion.features) != 1 || fclose(conversion.features) != 0) {
+        printf("Error writing dataset file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    fclose(conversion.labels);
+}
+
+/* Free a dataset, unmapping it when it was loaded with load_dataset_mmap() */
+void free_dataset(Dataset* dataset) {
     if (dataset) {
-        if (dataset->x) {
+        if (dataset->mapping) {
+#ifndef _WIN32
+            munmap(dataset->mapping, dataset->mapping_size);
+#endif
+        } else {
             free(dataset->x);
-            dataset->x = NULL;
-        }
-        if (dataset->y) {
             free(dataset->y);
-            dataset->y = NULL;
         }
         free(dataset);
-        dataset = NULL; // set pointer to NULL to help prevent float freeing
     }
-}
\ No newline at end of file
+}
+
+// Batch buffers start on 64 byte boundaries, the same as the gemm packing buffers
+#define BATCH_ALIGNMENT 64
+
+static float* alloc_batch_buffer(size_t n) {
+    void* buffer = NULL;
+    size_t size = ((n * sizeof(float) + BATCH_ALIGNMENT - 1) / BATCH_ALIGNMENT) * BATCH_ALIGNMENT;
+#ifdef _WIN32
+    buffer = _aligned_malloc(size, BATCH_ALIGNMENT);
+#else
+    if (posix_memalign(&buffer, BATCH_ALIGNMENT, size) != 0) buffer = NULL;
+#endif
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed when allocating a batch buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    return (float*)buffer;
+}
+
+static void free_batch_buffer(float* buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+/* xorshift32 step of the loader's own generator, rand_r isn't available on Windows */
+static unsigned int next_random(unsigned int* state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* Fisher-Yates shuffle of the sample order */
+static void shuffle_order(DataLoader* loader) {
+    for (int i = loader->dataset->length - 1; i > 0; i--) {
+        int j = next_random(&loader->seed) % (i + 1);
+        int tmp = loader->order[i];
+        loader->order[i] = loader->order[j];
+        loader->order[j] = tmp;
+    }
+}
+
+/* Copy the samples of batch index of the epoch into the buffers of batch */
+static void gather_batch(DataLoader* loader, Batch* batch, int index) {
+    Dataset* dataset = loader->dataset;
+    int features = dataset->num_features;
+    int start = index * loader->batch_size;
+    int size = dataset->length - start < loader->batch_size ? dataset->length - start : loader->batch_size;
+    for (int i = 0; i < size; i++) {
+        int sample = loader->order[start + i];
+        memcpy(batch->inputs->data + (size_t)i * features, dataset->x + (size_t)sample * features, features * sizeof(float));
+        batch->labels->data[i] = dataset->y[sample];
+    }
+    batch->size = size;
+    batch->index = index;
+}
+
+/* Fill the two buffers in turn, waiting while both hold batches the training loop hasn't
+   taken. The order is shuffled again at the start of every epoch. */
+static void* data_loader_loop(void* arg) {
+    DataLoader* loader = (DataLoader*)arg;
+    int fill = 0;
+    int epoch = 0;
+    int index = 0;
+    while (1) {
+        Batch* batch = &loader->batches[fill];
+        pthread_mutex_lock(&loader->lock);
+        while ((batch->ready || loader->held_batch == fill) && !loader->shutting_down) {
+            pthread_cond_wait(&loader->batch_free, &loader->lock);
+        }
+        int stop = loader->shutting_down;
+        pthread_mutex_unlock(&loader->lock);
+        if (stop) break;
+
+        if (index == 0 && loader->shuffle) {
+            shuffle_order(loader);
+        }
+        // the buffer belongs to this thread until it is marked ready
+        gather_batch(loader, batch, index);
+        batch->epoch = epoch;
+
+        pthread_mutex_lock(&loader->lock);
+        batch->ready = 1;
+        pthread_cond_signal(&loader->batch_ready);
+        pthread_mutex_unlock(&loader->lock);
+
+        fill = 1 - fill;
+        if (++index == loader->num_batches) {
+            index = 0;
+            epoch++;
+        }
+    }
+    return NULL;
+}
+
+/* Create a loader that yields batches of batch_size samples of the dataset. With shuffle
+   the samples are visited in a new random order every epoch, seeded from rand(). With
+   drop_last an epoch ends before a last batch smaller than batch_size. The dataset must
+   outlive the loader. */
+DataLoader* create_data_loader(Dataset* dataset, int batch_size, int shuffle, int drop_last) {
+    int num_batches = 0;
+    if (batch_size >= 1) {
+        num_batches = drop_last ? dataset->length / batch_size : (dataset->length + batch_size - 1) / batch_size;
+    }
+    if (num_batches < 1) {
+        printf("A batch size of %d gives no batches of a dataset of %d samples!\n", batch_size, dataset->length);
+        exit(EXIT_FAILURE);
+    }
+
+    DataLoader* loader = (DataLoader*)malloc(sizeof(DataLoader));
+    int* order = (int*)malloc(dataset->length * sizeof(int));
+    if (!loader || !order) {
+        fprintf(stderr, "Memory allocation failed when allocating a data loader.\n");
+        exit(EXIT_FAILURE);
+    }
+    loader->dataset = dataset;
+    loader->batch_size = batch_size;
+    loader->shuffle = shuffle;
+    loader->drop_last = drop_last;
+    loader->num_batches = num_batches;
+    loader->order = order;
+    for (int i = 0; i < dataset->length; i++) order[i] = i;
+    loader->seed = (unsigned int)rand() * 2 + 1; // xorshift needs a non-zero state
+
+    int input_shape[2] = {batch_size, dataset->num_features};
+    int label_shape[2] = {batch_size, 1};
+    for (int i = 0; i < 2; i++) {
+        Batch* batch = &loader->batches[i];
+        batch->inputs = create_tensor_from_buffer(alloc_batch_buffer((size_t)batch_size * dataset->num_features), input_shape, 2);
+        batch->labels = create_tensor_from_buffer(alloc_batch_buffer(batch_size), label_shape, 2);
+        batch->size = 0;
+        batch->epoch = 0;
+        batch->index = 0;
+        batch->ready = 0;
+    }
+    loader->next_batch = 0;
+    loader->held_batch = -1;
+    loader->shutting_down = 0;
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->batch_ready, NULL);
+    pthread_cond_init(&loader->batch_free, NULL);
+    if (pthread_create(&loader->thread, NULL, data_loader_loop, loader) != 0) {
+        fprintf(stderr, "Failed to start the data loader thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    return loader;
+}
+
+/* Resize the rows of a batch tensor, the last batch of an epoch can be smaller */
+static void set_batch_rows(Tensor* t, int rows) {
+    t->shape[0] = rows;
+    t->size = rows * t->shape[1];
+}
+
+/* Hand the previous batch back to the loader thread and return the next one, waiting
+   only if the thread hasn't finished gathering it yet */
+Batch* data_loader_next(DataLoader* loader) {
+    Batch* batch = &loader->batches[loader->next_batch];
+    pthread_mutex_lock(&loader->lock);
+    if (loader->held_batch >= 0) {
+        loader->held_batch = -1;
+        pthread_cond_signal(&loader->batch_free);
+    }
+    while (!batch->ready) {
+        pthread_cond_wait(&loader->batch_ready, &loader->lock);
+    }
+    batch->ready = 0;
+    loader->held_batch = loader->next_batch;
+    pthread_mutex_unlock(&loader->lock);
+
+    set_batch_rows(batch->inputs, batch->size);
+    set_batch_rows(batch->labels, batch->size);
+    loader->next_batch = 1 - loader->next_batch;
+    return batch;
+}
+
+void free_data_loader(DataLoader* loader) {
+    if (loader) {
+        pthread_mutex_lock(&loader->lock);
+        loader->shutting_down = 1;
+        pthread_cond_signal(&loader->batch_free);
+        pthread_mutex_unlock(&loader->lock);
+        pthread_join(loader->thread, NULL);
+
+        for (int i = 0; i < 2; i++) {
+            free_batch_buffer(loader->batches[i].inputs->data);
+            free_batch_buffer(loader->batches[i].labels->data);
+            free_tensor(loader->batches[i].inputs);
+            free_tensor(loader->batches[i].labels);
+        }
+        pthread_mutex_destroy(&loader->lock);
+        pthread_cond_destroy(&loader->batch_ready);
+        pthread_cond_destroy(&loader->batch_free);
+        free(loader->order);
+        free(loader);
+    }
+}
@@ -1,6 +1,10 @@
 #ifndef DATASET_H
 #define DATASET_H
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "tensor.h"
 
 #define PI 3.14159265358979323846
@@ -9,11 +13,76 @@ typedef struct Dataset {
     float* x; // data
     float* y; // labels
     int length;
+    int num_features; // number of values per sample in x
+    // Set when x and y point into a memory mapped dataset file instead of the heap
+    void* mapping;
+    size_t mapping_size;
 } Dataset;
 
+#define DATASET_FILE_MAGIC "MLPDATA"
+#define DATASET_FILE_VERSION 1
+#define DATASET_DTYPE_FLOAT32 1
+// Sections of a dataset file start on multiples of this many bytes
+#define DATASET_FILE_ALIGNMENT 64
+
+/* Header at the start of a binary dataset file. It is followed by the features as a
+   row-major [rows, features] array and then one label per row, each section starting at
+   the given byte offset, a multiple of DATASET_FILE_ALIGNMENT. Values are little endian. */
+typedef struct DatasetFileHeader {
+    char magic[8]; // DATASET_FILE_MAGIC
+    uint32_t version;
+    uint32_t dtype; // of features and labels
+    uint64_t rows;
+    uint64_t features;
+    uint64_t features_offset;
+    uint64_t labels_offset;
+    uint8_t reserved[16]; // pads the header to DATASET_FILE_ALIGNMENT bytes
+} DatasetFileHeader;
+
+// One mini-batch gathered by a DataLoader. The data lives in aligned buffers owned by
+// the loader and is valid until the next call to data_loader_next().
+typedef struct Batch {
+    Tensor* inputs; // [size, num_features]
+    Tensor* labels; // [size, 1]
+    int size; // samples in the batch, less than the batch size for the last one without drop_last
+    int epoch;
+    int index; // position of the batch in its epoch
+    int ready; // filled by the loader thread and not yet released by the training loop
+} Batch;
+
+/* Splits a dataset into mini-batches, optionally in a new random order every epoch. A
+   background thread gathers the next batch into one of two buffers while the training
+   loop uses the other. Batches run on through the epochs until the loader is freed. */
+typedef struct DataLoader {
+    Dataset* dataset;
+    int batch_size;
+    int shuffle;
+    int drop_last;
+    int num_batches; // per epoch
+    int* order; // sample indices of the epoch being gathered
+    unsigned int seed; // xorshift state for the shuffle, the thread doesn't share the state of rand()
+    Batch batches[2];
+    int next_batch; // buffer the training loop reads next
+    int held_batch; // buffer the training loop is using, -1 before the first batch
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t batch_ready;
+    pthread_cond_t batch_free;
+    int shutting_down;
+} DataLoader;
+
 Dataset* create_moons(int n_samples_outer_circle, int n_samples_inner_circle, float noise);
 void export_2d_points_to_txt(char* file_name, float* points, int n_points);
 void export_1d_array_to_txt(char* file_name, float* array, int length);
+Tensor* dataset_inputs_view(Dataset* dataset, int start, int end);
+Tensor* dataset_labels_view(Dataset* dataset, int start, int end);
+void save_dataset(const char* file_name, Dataset* dataset);
+Dataset* load_dataset_mmap(const char* file_name);
+Dataset* load_csv_dataset(const char* file_name);
+void convert_csv_to_dataset(const char* csv_file_name, const char* file_name);
 void free_dataset(Dataset* dataset);
+DataLoader* create_data_loader(Dataset* dataset, int batch_size, int shuffle, int drop_last);
+Batch* data_loader_next(DataLoader* loader);
+void free_data_loader(DataLoader* loader);
 
 #endif // DATASET_H
\ No newline at end of file
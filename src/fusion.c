@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fusion.h"
+#include "arena.h"
+#include "kernels.h"
+#include "reduce.h"
+#include "thread_pool.h"
+
+/* In lazy mode add, mul, the activations and reduce_sum only record their result. Ops
+   that need the values, reading the data with contiguous_data(), taking a view,
+   backward() or capture_graph(), materialize them first. Materializing splits the
+   recorded ops into maximal chains where each result is read by a single op of the
+   same size, and runs every chain as one loop over blocks that stay in cache, so the
+   results inside a chain are never written to memory. Chains that end in a sum add up
+   each block as it is computed. */
+
+// Elements of a block, the same as a reduction block so a fused sum adds the same
+// partial sums as reduce_sum
+#define FUSION_BLOCK_SIZE REDUCE_BLOCK_SIZE
+
+// Rough cost of one element of one op, used to split the blocks across threads
+#define FUSION_COST_PER_OP 8
+
+// lazy_op of the results fused into a later op, they have no values
+#define FUSION_ABSORBED -1
+
+static int lazy_mode = 0;
+
+void set_lazy_mode(int lazy) {
+    lazy_mode = lazy;
+}
+
+int get_lazy_mode(void) {
+    return lazy_mode;
+}
+
+/* Called by the fusable ops once their result is created with create_lazy_op_result().
+   In lazy mode the op is recorded instead of run and 1 is returned so the caller skips
+   its forward, its data is allocated when it runs and its grad when backward needs it.
+   Otherwise the data and grad are allocated now and 0 is returned. */
+int record_lazy_op(Tensor* result, FusedOpKind kind) {
+    if (!lazy_mode) {
+        alloc_op_data(result);
+        alloc_op_grad(result);
+        return 0;
+    }
+    result->lazy_op = kind + 1;
+    for (int i = 0; i < result->num_parents; i++) {
+        // an op that reads the same tensor twice is one consumer
+        int seen = 0;
+        for (int j = 0; j < i; j++) seen = seen || result->parents[j] == result->parents[i];
+        if (!seen) result->parents[i]->lazy_consumers++;
+    }
+    return 1;
+}
+
+typedef struct PendingOps {
+    Tensor** tensors; // parents before the ops that read them
+    int* group; // index in tensors of the last op of the chain each op is fused into
+    int length;
+    int capacity;
+} PendingOps;
+
+static int pending_index(const PendingOps* pending, const Tensor* t) {
+    for (int i = 0; i < pending->length; i++) {
+        if (pending->tensors[i] == t) return i;
+    }
+    return -1;
+}
+
+static void check_not_absorbed(const Tensor* t) {
+    if (t->lazy_op == FUSION_ABSORBED) {
+        fprintf(stderr, "A tensor fused into another op was read after the op ran, materialize it first.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Add t and the recorded ops it is computed from to pending, parents first */
+static void collect_pending(PendingOps* pending, Tensor* t) {
+    check_not_absorbed(t);
+    if (!t->lazy_op || pending_index(pending, t) >= 0) return;
+    for (int i = 0; i < t->num_parents; i++) {
+        collect_pending(pending, t->parents[i]);
+    }
+    if (pending->length == pending->capacity) {
+        pending->capacity = pending->capacity ? pending->capacity * 2 : 16;
+        pending->tensors = (Tensor**)realloc(pending->tensors, pending->capacity * sizeof(Tensor*));
+        if (!pending->tensors) {
+            fprintf(stderr, "Memory allocation failed when collecting lazy ops.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pending->tensors[pending->length++] = t;
+}
+
+/* Number of elements the loop of an op runs over: its parent's for a sum, else its own.
+   Returns -1 if the op can't be fused, like an add broadcast along some dims. */
+static long long fused_loop_size(const Tensor* t) {
+    FusedOpKind kind = (FusedOpKind)(t->lazy_op - 1);
+    if (kind == FUSED_SUM) return t->parents[0]->size;
+    for (int i = 0; i < t->num_parents; i++) {
+        long long size = t->parents[i]->size;
+        if (size != t->size && !(size == 1 && (kind == FUSED_ADD || kind == FUSED_MUL))) return -1;
+    }
+    return t->size;
+}
+
+/* Forward of a fused chain, the inputs and outputs of one run */
+typedef struct FusedRun {
+    const FusedProgram* program;
+    float* inputs[FUSION_MAX_INPUTS]; // contiguous data of the parents
+    int scalar[FUSION_MAX_INPUTS]; // parents of one element broadcast over a longer loop
+    float* out; // data of the fused result, NULL for a sum or to keep the last op in values
+    const float* out_grad;
+    float* input_grads[FUSION_MAX_INPUTS]; // NULL for parents that don't need grads
+    float* scalar_grads; // grads of the scalar parents summed per block, num_blocks x num inputs
+    int num_inputs;
+} FusedRun;
+
+static float* alloc_block_values(const FusedProgram* program) {
+    float* values = (float*)malloc((size_t)program->num_ops * FUSION_BLOCK_SIZE * sizeof(float));
+    if (!values) {
+        fprintf(stderr, "Memory allocation failed when allocating the blocks of a fused op.\n");
+        exit(EXIT_FAILURE);
+    }
+    return values;
+}
+
+/* Values of an operand for the block starting at offset. values holds a row of
+   FUSION_BLOCK_SIZE results for every op of the chain. */
+static float* operand_values(const FusedRun* run, float* values, int operand, long long offset) {
+    if (operand >= 0) return values + operand * FUSION_BLOCK_SIZE;
+    int input = -1 - operand;
+    return run->scalar[input] ? run->inputs[input] : run->inputs[input] + offset;
+}
+
+static int is_scalar_operand(const FusedRun* run, int operand) {
+    return operand < 0 && run->scalar[-1 - operand];
+}
+
+/* Run the ops of the chain on the n elements starting at offset. The last op writes to
+   the result when run->out is set, a sum is left to the caller. */
+static void run_fused_ops(const FusedRun* run, float* values, long long offset, int n) {
+    const FusedProgram* program = run->program;
+    for (int i = 0; i < program->num_ops; i++) {
+        const FusedOp* op = &program->ops[i];
+        if (op->kind == FUSED_SUM) break;
+        int last = i == program->num_ops-1;
+        float* out = last && run->out ? run->out + offset : values + i * FUSION_BLOCK_SIZE;
+        int a_operand = op->operands[0];
+        int b_operand = op->operands[1];
+        if (is_scalar_operand(run, a_operand)) {
+            // add and mul commute, keep the broadcast value second
+            a_operand = op->operands[1];
+            b_operand = op->operands[0];
+        }
+        const float* a = operand_values(run, values, a_operand, offset);
+        switch (op->kind) {
+            case FUSED_ADD:
+            case FUSED_MUL: {
+                const float* b = operand_values(run, values, b_operand, offset);
+                if (is_scalar_operand(run, b_operand)) {
+                    if (op->kind == FUSED_ADD) kernels.add_scalar(a, b[0], out, n);
+                    else kernels.mul_scalar(a, b[0], out, n);
+                } else {
+                    if (op->kind == FUSED_ADD) kernels.add(a, b, out, n);
+                    else kernels.mul(a, b, out, n);
+                }
+                break;
+            }
+            case FUSED_RELU: kernels.relu(a, out, n); break;
+            case FUSED_SIGMOID: kernels.sigmoid(a, out, n); break;
+            case FUSED_TANH: kernels.tanh(a, out, n); break;
+            case FUSED_GELU: kernels.gelu(a, out, n); break;
+            case FUSED_SILU: kernels.silu(a, out, n); break;
+            default: break;
+        }
+    }
+}
+
+static long long num_blocks(const FusedProgram* program) {
+    return (program->size + FUSION_BLOCK_SIZE - 1) / FUSION_BLOCK_SIZE;
+}
+
+static void fused_forward_task(void* ctx, long long start, long long end) {
+    FusedRun* run = (FusedRun*)ctx;
+    float* values = alloc_block_values(run->program);
+    for (long long block = start; block < end; block++) {
+        long long offset = block * FUSION_BLOCK_SIZE;
+        int n = run->program->size - offset < FUSION_BLOCK_SIZE ? run->program->size - offset : FUSION_BLOCK_SIZE;
+        run_fused_ops(run, values, offset, n);
+    }
+    free(values);
+}
+
+/* Sum of one block of the chain, scratch holds the values of its ops */
+static float fused_block_sum(void* ctx, void* scratch, long long start, int n) {
+    FusedRun* run = (FusedRun*)ctx;
+    const FusedProgram* program = run->program;
+    float* values = (float*)scratch;
+    run_fused_ops(run, values, start, n);
+    const FusedOp* sum_op = &program->ops[program->num_ops-1];
+    return kernels.sum(operand_values(run, values, sum_op->operands[0], start), n);
+}
+
+static void init_fused_run(FusedRun* run, Tensor* result) {
+    const FusedProgram* program = result->fused;
+    run->program = program;
+    run->num_inputs = result->num_parents;
+    run->out = NULL;
+    run->out_grad = NULL;
+    run->scalar_grads = NULL;
+    for (int i = 0; i < result->num_parents; i++) {
+        Tensor* input = result->parents[i];
+        run->inputs[i] = contiguous_data(input);
+        run->scalar[i] = input->size == 1 && program->size > 1;
+        run->input_grads[i] = NULL;
+    }
+}
+
+static void release_fused_run(FusedRun* run, Tensor* result) {
+    for (int i = 0; i < result->num_parents; i++) {
+        release_contiguous_data(result->parents[i], run->inputs[i]);
+    }
+}
+
+void forward_fused(Tensor* result) {
+    const FusedProgram* program = result->fused;
+    FusedRun run;
+    init_fused_run(&run, result);
+    if (program->ops[program->num_ops-1].kind == FUSED_SUM) {
+        // split like reduce_sum, so the sum is bitwise the same as the unfused ops
+        size_t values_size = (size_t)program->num_ops * FUSION_BLOCK_SIZE * sizeof(float);
+        result->data[0] = parallel_block_sum(program->size, values_size, fused_block_sum, &run);
+    } else {
+        long long cost = (long long)FUSION_COST_PER_OP * program->num_ops;
+        run.out = result->data;
+        parallel_for(num_blocks(program), grain_size_for_cost(cost * FUSION_BLOCK_SIZE), fused_forward_task, &run);
+    }
+    release_fused_run(&run, result);
+}
+
+/* Add the grad of an op to one of its operands. g is the grad of the op's result. */
+static void add_operand_grad(const FusedRun* run, float* values, float* grads, int op_index, int k,
+                             const float* g, long long block, long long offset, int n) {
+    const FusedOp* op = &run->program->ops[op_index];
+    int operand = op->operands[k];
+    float* target;
+    float* scalar_target = NULL;
+    if (operand >= 0) {
+        target = grads + operand * FUSION_BLOCK_SIZE;
+    } else {
+        int input = -1 - operand;
+        if (!run->input_grads[input]) return;
+        target = run->input_grads[input] + offset;
+        if (run->scalar[input]) scalar_target = &run->scalar_grads[block * run->num_inputs + input];
+    }
+
+    const float* x = operand_values(run, values, operand, offset);
+    const float* y = values + op_index * FUSION_BLOCK_SIZE;
+    switch (op->kind) {
+        case FUSED_ADD:
+            if (scalar_target) *scalar_target += kernels.sum(g, n);
+            else kernels.add(target, g, target, n);
+            break;
+        case FUSED_MUL: {
+            int other_operand = op->operands[1 - k];
+            const float* other = operand_values(run, values, other_operand, offset);
+            if (scalar_target) *scalar_target += kernels.dot(g, other, n);
+            else if (is_scalar_operand(run, other_operand)) kernels.mul_scalar_add(g, other[0], target, n);
+            else kernels.mul_add(g, other, target, n);
+            break;
+        }
+        case FUSED_RELU: kernels.relu_backward(y, g, target, n); break;
+        case FUSED_SIGMOID: kernels.sigmoid_backward(y, g, target, n); break;
+        case FUSED_TANH: kernels.tanh_backward(y, g, target, n); break;
+        case FUSED_GELU: kernels.gelu_backward(x, g, target, n); break;
+        case FUSED_SILU: kernels.silu_backward(x, g, target, n); break;
+        case FUSED_SUM: kernels.add_scalar(target, run->out_grad[0], target, n); break;
+    }
+}
+
+static void fused_backward_task(void* ctx, long long start, long long end) {
+    FusedRun* run = (FusedRun*)ctx;
+    const FusedProgram* program = run->program;
+    int last = program->num_ops-1;
+    float* values = alloc_block_values(program);
+    float* grads = alloc_block_values(program);
+    for (long long block = start; block < end; block++) {
+        long long offset = block * FUSION_BLOCK_SIZE;
+        int n = program->size - offset < FUSION_BLOCK_SIZE ? program->size - offset : FUSION_BLOCK_SIZE;
+        // recompute the block, then take its grads back through the chain
+        run_fused_ops(run, values, offset, n);
+        for (int i = 0; i < last; i++) memset(grads + i * FUSION_BLOCK_SIZE, 0, n * sizeof(float));
+        for (int i = last; i >= 0; i--) {
+            const FusedOp* op = &program->ops[i];
+            const float* g = i == last ? run->out_grad + offset : grads + i * FUSION_BLOCK_SIZE;
+            int unary = op->kind != FUSED_ADD && op->kind != FUSED_MUL;
+            for (int k = 0; k < (unary ? 1 : 2); k++) {
+                add_operand_grad(run, values, grads, i, k, g, block, offset, n);
+            }
+        }
+    }
+    free(values);
+    free(grads);
+}
+
+/* The blocks are recomputed and their grads taken back through the chain while they are
+   in cache. The grads of broadcast single values are summed per block and added up in
+   block order, so they don't depend on the number of threads. */
+void backward_fused(Tensor* result) {
+    const FusedProgram* program = result->fused;
+    FusedRun run;
+    init_fused_run(&run, result);
+    run.out_grad = result->grad;
+
+    long long blocks = num_blocks(program);
+    int has_scalar_grads = 0;
+    for (int i = 0; i < result->num_parents; i++) {
+        Tensor* input = result->parents[i];
+        if (!input->requires_grad || !input->grad) continue;
+        run.input_grads[i] = contiguous_grad(input);
+        has_scalar_grads = has_scalar_grads || run.scalar[i];
+    }
+    if (has_scalar_grads) {
+        run.scalar_grads = (float*)calloc((size_t)blocks * run.num_inputs, sizeof(float));
+        if (!run.scalar_grads) {
+            fprintf(stderr, "Memory allocation failed when allocating the grads of a fused op.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    long long cost = 2LL * FUSION_COST_PER_OP * program->num_ops;
+    parallel_for(blocks, grain_size_for_cost(cost * FUSION_BLOCK_SIZE), fused_backward_task, &run);
+
+    for (int i = 0; i < result->num_parents; i++) {
+        if (!run.input_grads[i]) continue;
+        if (run.scalar[i]) {
+            for (long long block = 0; block < blocks; block++) {
+                run.input_grads[i][0] += run.scalar_grads[block * run.num_inputs + i];
+            }
+        }
+        commit_contiguous_grad(result->parents[i], run.input_grads[i]);
+    }
+    free(run.scalar_grads);
+    release_fused_run(&run, result);
+}
+
+/* Number the tensors the chain reads in the order build_topo() would reach them from the
+   unfused ops, so the grads of a parent are accumulated in the same order as without
+   fusion. externals holds the parents of each op that are outside the chain. */
+static void number_inputs(FusedProgram* program, Tensor* externals[][2], int op_index, int* num_inputs) {
+    FusedOp* op = &program->ops[op_index];
+    int operands = op->kind == FUSED_ADD || op->kind == FUSED_MUL ? 2 : 1;
+    for (int k = 0; k < operands; k++) {
+        Tensor* parent = externals[op_index][k];
+        if (!parent) {
+            number_inputs(program, externals, op->operands[k], num_inputs);
+            continue;
+        }
+        int input = 0;
+        while (input < *num_inputs && program->inputs[input] != parent) input++;
+        if (input == *num_inputs) program->inputs[(*num_inputs)++] = parent;
+        op->operands[k] = -1 - input;
+    }
+}
+
+/* Turn the ops of pending whose chain ends at index root into one fused op computed into
+   the result of the last op */
+static void fuse_chain(PendingOps* pending, int root) {
+    Tensor* result = pending->tensors[root];
+    Arena* arena = get_tensor_arena();
+    FusedProgram* program = arena ? (FusedProgram*)arena_alloc(arena, sizeof(FusedProgram))
+                                  : (FusedProgram*)malloc(sizeof(FusedProgram));
+    if (!program) {
+        fprintf(stderr, "Memory allocation failed when fusing lazy ops.\n");
+        exit(EXIT_FAILURE);
+    }
+    program->from_arena = arena != NULL;
+    program->num_ops = 0;
+    program->num_absorbed = 0;
+    program->size = fused_loop_size(result);
+
+    // the ops of the chain in order, pending is sorted parents first
+    int op_of[FUSION_MAX_OPS];
+    Tensor* externals[FUSION_MAX_OPS][2];
+    for (int i = 0; i <= root; i++) {
+        if (pending->group[i] != root) continue;
+        Tensor* t = pending->tensors[i];
+        FusedOp* op = &program->ops[program->num_ops];
+        op->kind = (FusedOpKind)(t->lazy_op - 1);
+        op->operands[1] = 0;
+        externals[program->num_ops][1] = NULL;
+        for (int k = 0; k < t->num_parents; k++) {
+            Tensor* parent = t->parents[k];
+            int index = pending_index(pending, parent);
+            externals[program->num_ops][k] = parent;
+            if (index >= 0 && pending->group[index] == root) {
+                int j = 0;
+                while (op_of[j] != index) j++;
+                op->operands[k] = j;
+                externals[program->num_ops][k] = NULL;
+            }
+        }
+        op_of[program->num_ops++] = i;
+        if (i != root) {
+            t->lazy_op = FUSION_ABSORBED;
+            program->absorbed[program->num_absorbed++] = t;
+        }
+    }
+    int num_inputs = 0;
+    number_inputs(program, externals, program->num_ops-1, &num_inputs);
+
+    if (!result->from_arena && result->parents) free(result->parents);
+    result->parents = program->inputs;
+    result->num_parents = num_inputs;
+    result->fused = program;
+    result->forward_func = forward_fused;
+    result->backward_func = backward_fused;
+}
+
+/* Compute t if it was recorded in lazy mode, along with the recorded ops it depends on.
+   Results fused into a later op are never computed, so materialize a tensor whose values
+   are needed before materializing the ops that read it. */
+void materialize(Tensor* t) {
+    check_not_absorbed(t);
+    if (!t->lazy_op) return;
+
+    PendingOps pending = {NULL, NULL, 0, 0};
+    collect_pending(&pending, t);
+    pending.group = (int*)malloc(pending.length * sizeof(int));
+    int* group_ops = (int*)calloc(pending.length, sizeof(int));
+    long long* loop_size = (long long*)malloc(pending.length * sizeof(long long));
+    if (!pending.group || !group_ops || !loop_size) {
+        fprintf(stderr, "Memory allocation failed when collecting lazy ops.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Walk from t towards the parents. An op joins the chain of the only op that reads
+    // it when it loops over as many elements, else it starts a chain of its own.
+    for (int i = pending.length-1; i >= 0; i--) {
+        Tensor* op = pending.tensors[i];
+        long long size = fused_loop_size(op);
+        int consumer = -1;
+        if (i < pending.length-1 && op->lazy_consumers == 1) {
+            for (int j = i+1; j < pending.length && consumer < 0; j++) {
+                Tensor* reader = pending.tensors[j];
+                for (int k = 0; k < reader->num_parents; k++) {
+                    if (reader->parents[k] == op) consumer = j;
+                }
+            }
+        }
+        int root = consumer >= 0 ? pending.group[consumer] : -1;
+        int joins = root >= 0 && size >= 0 && size == loop_size[root] && op->lazy_op - 1 != FUSED_SUM &&
+                    group_ops[root] < FUSION_MAX_OPS;
+        pending.group[i] = joins ? root : i;
+        group_ops[pending.group[i]]++;
+        loop_size[i] = size;
+    }
+
+    // Chains run parents first, a single op runs its own forward
+    for (int i = 0; i < pending.length; i++) {
+        if (pending.group[i] != i) continue;
+        Tensor* result = pending.tensors[i];
+        if (group_ops[i] > 1) fuse_chain(&pending, i);
+        result->lazy_op = 0;
+        alloc_op_data(result); // absorbed results never get any
+        result->forward_func(result);
+    }
+
+    free(pending.tensors);
+    free(pending.group);
+    free(group_ops);
+    free(loop_size);
+}
+
+/* Free the results fused into t along with the program. Called by free_tensor(). */
+void free_fused_program(Tensor* t) {
+    FusedProgram* program = t->fused;
+    for (int i = 0; i < program->num_absorbed; i++) {
+        free_tensor(program->absorbed[i]);
+    }
+    if (t->parents == program->inputs) t->parents = NULL;
+    t->fused = NULL;
+    if (!program->from_arena) free(program);
+}
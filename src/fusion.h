@@ -0,0 +1,48 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include "tensor.h"
+
+// Most ops fused into one loop, a chain reads at most one more tensor than it has ops
+#define FUSION_MAX_OPS 16
+#define FUSION_MAX_INPUTS (FUSION_MAX_OPS + 1)
+
+// Ops that are recorded in lazy mode and can be fused
+typedef enum {
+    FUSED_ADD,
+    FUSED_MUL,
+    FUSED_RELU,
+    FUSED_SIGMOID,
+    FUSED_TANH,
+    FUSED_GELU,
+    FUSED_SILU,
+    FUSED_SUM // sum of all elements, only as the last op of a chain
+} FusedOpKind;
+
+/* One op of a fused chain. An operand i >= 0 is the result of op i of the chain and
+   -1 - i is parent i of the fused result. Unary ops only use the first operand. */
+typedef struct FusedOp {
+    FusedOpKind kind;
+    int operands[2];
+} FusedOp;
+
+/* A chain of elementwise ops, possibly ending in a sum, that runs as one loop over blocks
+   of the data. The result of the last op keeps the program and its parents become the
+   tensors the chain reads, so graphs, replays and backward see a single op. */
+typedef struct FusedProgram {
+    int num_ops;
+    long long size; // elements every op works on, parents of one element are broadcast
+    FusedOp ops[FUSION_MAX_OPS];
+    Tensor* inputs[FUSION_MAX_INPUTS]; // the parents of the fused result
+    Tensor* absorbed[FUSION_MAX_OPS]; // results of the other ops, never computed and freed with it
+    int num_absorbed;
+    int from_arena;
+} FusedProgram;
+
+void set_lazy_mode(int lazy);
+int get_lazy_mode(void);
+int record_lazy_op(Tensor* result, FusedOpKind kind);
+void materialize(Tensor* t);
+void free_fused_program(Tensor* t);
+
+#endif // FUSION_H
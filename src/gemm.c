@@ -0,0 +1,294 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gemm.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+// Below this many multiply-adds packing costs more than it saves
+#define GEMM_SMALL_SIZE (32 * 32 * 32)
+
+static float* alloc_pack_buffer(size_t n) {
+    void* buffer = NULL;
+    size_t size = ((n * sizeof(float) + 63) / 64) * 64;
+#ifdef _WIN32
+    buffer = _aligned_malloc(size, 64);
+#else
+    if (posix_memalign(&buffer, 64, size) != 0) buffer = NULL;
+#endif
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed when allocating gemm packing buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    return (float*)buffer;
+}
+
+static void free_pack_buffer(float* buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+/* Each thread keeps its packed A and B panels between calls and only grows them, so
+   gemm allocates once per thread instead of once per call. The pthread key frees a
+   worker's panels when it exits. */
+typedef struct PackBuffers {
+    float* a;
+    size_t a_size;
+    float* b;
+    size_t b_size;
+} PackBuffers;
+
+static pthread_key_t pack_buffers_key;
+static pthread_once_t pack_buffers_once = PTHREAD_ONCE_INIT;
+
+static void free_pack_buffers(void* ptr) {
+    PackBuffers* buffers = (PackBuffers*)ptr;
+    free_pack_buffer(buffers->a);
+    free_pack_buffer(buffers->b);
+    free(buffers);
+}
+
+static void create_pack_buffers_key(void) {
+    if (pthread_key_create(&pack_buffers_key, free_pack_buffers) != 0) {
+        fprintf(stderr, "Failed to create the gemm packing buffer key.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void grow_pack_buffer(float** buffer, size_t* size, size_t n) {
+    if (n <= *size) return;
+    free_pack_buffer(*buffer);
+    *buffer = alloc_pack_buffer(n);
+    *size = n;
+}
+
+// The calling thread's panels, at least a_size and b_size floats
+static PackBuffers* get_pack_buffers(size_t a_size, size_t b_size) {
+    pthread_once(&pack_buffers_once, create_pack_buffers_key);
+    PackBuffers* buffers = (PackBuffers*)pthread_getspecific(pack_buffers_key);
+    if (!buffers) {
+        buffers = (PackBuffers*)calloc(1, sizeof(PackBuffers));
+        if (!buffers || pthread_setspecific(pack_buffers_key, buffers) != 0) {
+            fprintf(stderr, "Memory allocation failed when allocating gemm packing buffers.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    grow_pack_buffer(&buffers->a, &buffers->a_size, a_size);
+    grow_pack_buffer(&buffers->b, &buffers->b_size, b_size);
+    return buffers;
+}
+
+/* Copy an mc x kc block of A into panels of mr rows. Within a panel the mr values of
+   each column are adjacent so the micro-kernel reads A sequentially. Rows past the
+   edge of A are zero padded. */
+static void pack_a(int mc, int kc, const float* A, long long row_stride, long long col_stride, float* packed, int mr) {
+    for (int i = 0; i < mc; i += mr) {
+        int rows = mc - i < mr ? mc - i : mr;
+        for (int k = 0; k < kc; k++) {
+            for (int r = 0; r < rows; r++) {
+                packed[r] = A[(i + r) * row_stride + k * col_stride];
+            }
+            for (int r = rows; r < mr; r++) {
+                packed[r] = 0;
+            }
+            packed += mr;
+        }
+    }
+}
+
+/* Copy a kc x nc block of B into panels of nr columns, nr values per row of the panel */
+static void pack_b(int kc, int nc, const float* B, long long row_stride, long long col_stride, float* packed, int nr) {
+    for (int j = 0; j < nc; j += nr) {
+        int cols = nc - j < nr ? nc - j : nr;
+        for (int k = 0; k < kc; k++) {
+            const float* b_row = B + k * row_stride + j * col_stride;
+            if (col_stride == 1) {
+                for (int c = 0; c < cols; c++) packed[c] = b_row[c];
+            } else {
+                for (int c = 0; c < cols; c++) packed[c] = b_row[c * col_stride];
+            }
+            for (int c = cols; c < nr; c++) {
+                packed[c] = 0;
+            }
+            packed += nr;
+        }
+    }
+}
+
+/* Add the bias to each row of an m x n tile of C and apply the activation in place */
+static void apply_epilogue(float* C, long long c_row_stride, long long m, long long n, const float* bias, ActivationKernel activation) {
+    for (long long r = 0; r < m; r++) {
+        float* c_row = C + r * c_row_stride;
+        if (bias) kernels.add(c_row, bias, c_row, n);
+        if (activation) activation(c_row, c_row, n);
+    }
+}
+
+/* Unpacked i-k-j loop for small problems, the inner loop runs along rows of B and C */
+static void gemm_small(long long M, long long N, long long K,
+                       const float* A, long long a_row_stride, long long a_col_stride,
+                       const float* B, long long b_row_stride, long long b_col_stride,
+                       float* C, long long c_row_stride, int accumulate,
+                       const float* bias, ActivationKernel activation) {
+    for (long long i = 0; i < M; i++) {
+        float* c_row = C + i * c_row_stride;
+        if (!accumulate) {
+            for (long long j = 0; j < N; j++) c_row[j] = 0;
+        }
+        for (long long k = 0; k < K; k++) {
+            float a = A[i * a_row_stride + k * a_col_stride];
+            const float* b_row = B + k * b_row_stride;
+            for (long long j = 0; j < N; j++) {
+                c_row[j] += a * b_row[j * b_col_stride];
+            }
+        }
+        apply_epilogue(c_row, c_row_stride, 1, N, bias, activation);
+    }
+}
+
+/* Split into cache blocks: for each NC wide block of columns and KC deep slice of K,
+   B is packed once, then each MC high block of A is packed and swept by the
+   register-tiled micro-kernel of the selected kernel table. The epilogue runs on each
+   register tile right after its last slice of K, while the tile is still in L1. */
+static void gemm_blocked(long long M, long long N, long long K,
+                         const float* A, long long a_row_stride, long long a_col_stride,
+                         const float* B, long long b_row_stride, long long b_col_stride,
+                         float* C, long long c_row_stride, int accumulate,
+                         const float* bias, ActivationKernel activation) {
+    int mr = kernels.gemm_mr;
+    int nr = kernels.gemm_nr;
+    int mc_max = M < GEMM_MC ? (int)((M + mr - 1) / mr) * mr : GEMM_MC;
+    int nc_max = N < GEMM_NC ? (int)((N + nr - 1) / nr) * nr : GEMM_NC;
+    int kc_max = K < GEMM_KC ? (int)K : GEMM_KC;
+    PackBuffers* buffers = get_pack_buffers((size_t)mc_max * kc_max, (size_t)kc_max * nc_max);
+    float* packed_a = buffers->a;
+    float* packed_b = buffers->b;
+
+    for (long long jc = 0; jc < N; jc += GEMM_NC) {
+        int nc = N - jc < GEMM_NC ? (int)(N - jc) : GEMM_NC;
+        for (long long pc = 0; pc < K; pc += GEMM_KC) {
+            int kc = K - pc < GEMM_KC ? (int)(K - pc) : GEMM_KC;
+            // Only the first slice of K overwrites C
+            int accumulate_block = accumulate || pc > 0;
+            int last_block = pc + kc >= K && (bias || activation);
+            pack_b(kc, nc, B + pc * b_row_stride + jc * b_col_stride, b_row_stride, b_col_stride, packed_b, nr);
+
+            for (long long ic = 0; ic < M; ic += GEMM_MC) {
+                int mc = M - ic < GEMM_MC ? (int)(M - ic) : GEMM_MC;
+                pack_a(mc, kc, A + ic * a_row_stride + pc * a_col_stride, a_row_stride, a_col_stride, packed_a, mr);
+
+                for (int jr = 0; jr < nc; jr += nr) {
+                    int n = nc - jr < nr ? nc - jr : nr;
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        int m = mc - ir < mr ? mc - ir : mr;
+                        float* c_tile = C + (ic + ir) * c_row_stride + jc + jr;
+                        kernels.gemm_micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc,
+                                                  c_tile, c_row_stride, m, n, accumulate_block);
+                        if (last_block) {
+                            apply_epilogue(c_tile, c_row_stride, m, n, bias ? bias + jc + jr : NULL, activation);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef struct GemmTiles {
+    long long M, N, K;
+    const float* A;
+    long long a_row_stride, a_col_stride;
+    const float* B;
+    long long b_row_stride, b_col_stride;
+    float* C;
+    long long c_row_stride;
+    int accumulate;
+    const float* bias;
+    ActivationKernel activation;
+    int m_tiles, n_tiles; // C is split into an m_tiles x n_tiles grid, one task per tile
+    long long tile_m, tile_n;
+} GemmTiles;
+
+static void gemm_tile_task(void* ctx, long long start, long long end) {
+    GemmTiles* g = (GemmTiles*)ctx;
+    for (long long tile = start; tile < end; tile++) {
+        long long m0 = (tile / g->n_tiles) * g->tile_m;
+        long long n0 = (tile % g->n_tiles) * g->tile_n;
+        long long m = g->M - m0 < g->tile_m ? g->M - m0 : g->tile_m;
+        long long n = g->N - n0 < g->tile_n ? g->N - n0 : g->tile_n;
+        if (m <= 0 || n <= 0) continue;
+        gemm_blocked(m, n, g->K,
+                     g->A + m0 * g->a_row_stride, g->a_row_stride, g->a_col_stride,
+                     g->B + n0 * g->b_col_stride, g->b_row_stride, g->b_col_stride,
+                     g->C + m0 * g->c_row_stride + n0, g->c_row_stride, g->accumulate,
+                     g->bias ? g->bias + n0 : NULL, g->activation);
+    }
+}
+
+/* C = activation(A @ B + bias), the bias is added to every row of C and either of the
+   bias and activation can be NULL. With accumulate set the product is added to C first.
+
+   Large problems are split into a grid of independent tiles of C, first along M in
+   whole MC blocks and then along N, with one tile per thread. */
+void gemm_bias_activation(long long M, long long N, long long K,
+                          const float* A, long long a_row_stride, long long a_col_stride,
+                          const float* B, long long b_row_stride, long long b_col_stride,
+                          float* C, long long c_row_stride, int accumulate,
+                          const float* bias, ActivationKernel activation) {
+    if (M <= 0 || N <= 0) return;
+    if (K <= 0) {
+        if (!accumulate) {
+            for (long long i = 0; i < M; i++) {
+                for (long long j = 0; j < N; j++) C[i * c_row_stride + j] = 0;
+            }
+        }
+        apply_epilogue(C, c_row_stride, M, N, bias, activation);
+        return;
+    }
+    if (M * N * K < GEMM_SMALL_SIZE) {
+        gemm_small(M, N, K, A, a_row_stride, a_col_stride, B, b_row_stride, b_col_stride, C, c_row_stride, accumulate,
+                   bias, activation);
+        return;
+    }
+
+    // Enough tiles for every thread while each one still does PARALLEL_MIN_WORK
+    long long work = 2 * M * N * K;
+    long long max_tiles = work / PARALLEL_MIN_WORK;
+    int threads = get_num_threads();
+    int tiles = threads < max_tiles ? threads : (int)max_tiles;
+    if (tiles <= 1) {
+        gemm_blocked(M, N, K, A, a_row_stride, a_col_stride, B, b_row_stride, b_col_stride, C, c_row_stride, accumulate,
+                     bias, activation);
+        return;
+    }
+
+    GemmTiles g = {M, N, K, A, a_row_stride, a_col_stride, B, b_row_stride, b_col_stride,
+                   C, c_row_stride, accumulate, bias, activation, 1, 1, M, N};
+    long long m_blocks = (M + GEMM_MC - 1) / GEMM_MC;
+    g.m_tiles = m_blocks < tiles ? (int)m_blocks : tiles;
+    g.n_tiles = tiles / g.m_tiles;
+    long long max_n_tiles = (N + kernels.gemm_nr - 1) / kernels.gemm_nr;
+    if (g.n_tiles > max_n_tiles) g.n_tiles = max_n_tiles;
+    // round tile sizes up to whole register tiles
+    g.tile_m = (M + g.m_tiles - 1) / g.m_tiles;
+    g.tile_m = ((g.tile_m + kernels.gemm_mr - 1) / kernels.gemm_mr) * kernels.gemm_mr;
+    g.tile_n = (N + g.n_tiles - 1) / g.n_tiles;
+    g.tile_n = ((g.tile_n + kernels.gemm_nr - 1) / kernels.gemm_nr) * kernels.gemm_nr;
+
+    parallel_for(g.m_tiles * g.n_tiles, 1, gemm_tile_task, &g);
+}
+
+/* C = A @ B, or C += A @ B when accumulate is set. A is M x K, B is K x N and C is a
+   row-major M x N matrix. A and B can have any strides, so transposed operands are
+   passed by swapping their row and col strides instead of copying them. */
+void gemm(long long M, long long N, long long K,
+          const float* A, long long a_row_stride, long long a_col_stride,
+          const float* B, long long b_row_stride, long long b_col_stride,
+          float* C, long long c_row_stride, int accumulate) {
+    gemm_bias_activation(M, N, K, A, a_row_stride, a_col_stride, B, b_row_stride, b_col_stride,
+                         C, c_row_stride, accumulate, NULL, NULL);
+}
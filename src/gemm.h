@@ -0,0 +1,28 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+// Register tile computed by the scalar micro-kernel, the SIMD kernels pick their own
+#define GEMM_MR 6
+#define GEMM_NR 16
+
+// Cache blocks: a KC x NR panel of B stays in L1, an MC x KC block of A in L2
+// and a KC x NC block of B in L3. MC and NC must be multiples of the MR and NR
+// of every micro-kernel.
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+// Elementwise kernel applied in place to rows of C after the product, see kernels.h
+typedef void (*ActivationKernel)(const float* x, float* out, long long n);
+
+void gemm(long long M, long long N, long long K,
+          const float* A, long long a_row_stride, long long a_col_stride,
+          const float* B, long long b_row_stride, long long b_col_stride,
+          float* C, long long c_row_stride, int accumulate);
+void gemm_bias_activation(long long M, long long N, long long K,
+                          const float* A, long long a_row_stride, long long a_col_stride,
+                          const float* B, long long b_row_stride, long long b_col_stride,
+                          float* C, long long c_row_stride, int accumulate,
+                          const float* bias, ActivationKernel activation);
+
+#endif // GEMM_H
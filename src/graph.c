@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph.h"
+#include "backward.h"
+#include "fusion.h"
+#include "tensor.h"
+
+/* Record the graph that produced output. The topological order and the op results
+   whose grads are reset on every backward are worked out once here. The tensors of the
+   graph must stay alive while the graph is used, so when they come from an arena it
+   must not be reset before free_graph(). */
+Graph* capture_graph(Tensor* output) {
+    Graph* graph = (Graph*)malloc(sizeof(Graph));
+    if (!graph) {
+        fprintf(stderr, "Memory allocation failed when capturing a graph.\n");
+        exit(EXIT_FAILURE);
+    }
+    materialize(output); // the graph records the fused ops
+    graph->output = output;
+    graph->topo = build_topo(output);
+
+    graph->grad_tensors = (Tensor**)malloc(graph->topo->length * sizeof(Tensor*));
+    if (!graph->grad_tensors) {
+        fprintf(stderr, "Memory allocation failed when capturing a graph.\n");
+        exit(EXIT_FAILURE);
+    }
+    graph->num_grad_tensors = 0;
+    alloc_op_grad(output);
+    for (int i = 0; i < graph->topo->length; i++) {
+        Tensor* t = graph->topo->ordering[i];
+        if (t->requires_grad) alloc_op_grad(t); // deferred for ops recorded in lazy mode
+        // views write into the grads of their base, which is also in the graph
+        if (t->requires_grad && t->grad && t->owns_data && t->num_parents > 0) {
+            graph->grad_tensors[graph->num_grad_tensors++] = t;
+        }
+    }
+    return graph;
+}
+
+/* Recompute every op of the graph in order from the current data of its leaves */
+void graph_forward(Graph* graph) {
+    for (int i = 0; i < graph->topo->length; i++) {
+        Tensor* t = graph->topo->ordering[i];
+        if (t->forward_func) {
+            t->forward_func(t);
+        }
+    }
+}
+
+/* Same as backward() on the output, using the recorded order. The grads of the leaves
+   accumulate across replays, so parameters are reset with zero_grad() between updates. */
+void graph_backward(Graph* graph) {
+    if (graph->output->size != 1) {
+        printf("Tensor must be a scaler in order to perform back propagation.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < graph->num_grad_tensors; i++) {
+        Tensor* t = graph->grad_tensors[i];
+        memset(t->grad, 0, t->size * sizeof(float));
+    }
+    graph->output->grad[0] = 1.0;
+
+    for (int i = graph->topo->length-1; i >= 0; i--) {
+        Tensor* t = graph->topo->ordering[i];
+        if (t->requires_grad && t->backward_func) {
+            t->backward_func(t);
+        }
+    }
+}
+
+/* Free the graph along with its op results, leaves such as inputs and weights are kept */
+void free_graph(Graph* graph) {
+    if (graph) {
+        free(graph->grad_tensors);
+        free_graph_from_topo(graph->topo);
+        free(graph);
+    }
+}
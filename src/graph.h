@@ -0,0 +1,22 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "tensor.h"
+#include "backward.h"
+
+/* A graph recorded from one forward pass and replayed in place on every later step.
+   The captured tensors keep their buffers, so replays don't allocate, sort the graph
+   or check shapes. New values are fed in by writing to the data of the input tensors. */
+typedef struct Graph {
+    Tensor* output;
+    Topo* topo;
+    Tensor** grad_tensors; // op results whose grads are zeroed before backward, leaves accumulate
+    int num_grad_tensors;
+} Graph;
+
+Graph* capture_graph(Tensor* output);
+void graph_forward(Graph* graph);
+void graph_backward(Graph* graph);
+void free_graph(Graph* graph);
+
+#endif // GRAPH_H
@@ -0,0 +1,277 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+#include <cpuid.h>
+#endif
+
+/* Portable kernels. These are the reference the SIMD versions are tested against. */
+
+static void scalar_gemm_micro_kernel(int kc, const float* a_panel, const float* b_panel,
+                                     float* C, long long c_row_stride, int m, int n, int accumulate) {
+    float acc[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (int k = 0; k < kc; k++) {
+        for (int i = 0; i < GEMM_MR; i++) {
+            float a = a_panel[i];
+            for (int j = 0; j < GEMM_NR; j++) {
+                acc[i][j] += a * b_panel[j];
+            }
+        }
+        a_panel += GEMM_MR;
+        b_panel += GEMM_NR;
+    }
+
+    for (int i = 0; i < m; i++) {
+        float* c_row = C + i * c_row_stride;
+        if (accumulate) {
+            for (int j = 0; j < n; j++) c_row[j] += acc[i][j];
+        } else {
+            for (int j = 0; j < n; j++) c_row[j] = acc[i][j];
+        }
+    }
+}
+
+static void scalar_add(const float* a, const float* b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void scalar_add_scalar(const float* a, float b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = a[i] + b;
+}
+
+static void scalar_mul(const float* a, const float* b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void scalar_mul_add(const float* a, const float* b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += a[i] * b[i];
+}
+
+static void scalar_mul_scalar(const float* a, float b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = a[i] * b;
+}
+
+static void scalar_mul_scalar_add(const float* a, float b, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += a[i] * b;
+}
+
+static float scalar_dot(const float* a, const float* b, long long n) {
+    float total = 0;
+    for (long long i = 0; i < n; i++) total += a[i] * b[i];
+    return total;
+}
+
+static void scalar_relu(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = x[i] > 0 ? x[i] : 0;
+}
+
+static void scalar_sigmoid(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = 1 / (1 + expf(-x[i]));
+}
+
+static void scalar_tanh(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = tanhf(x[i]);
+}
+
+static void scalar_gelu(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) {
+        out[i] = 0.5f * x[i] * (1 + tanhf(GELU_C * (x[i] + GELU_A * x[i] * x[i] * x[i])));
+    }
+}
+
+static void scalar_silu(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = x[i] / (1 + expf(-x[i]));
+}
+
+static void scalar_exp(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = expf(x[i]);
+}
+
+static void scalar_log(const float* x, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] = logf(x[i]);
+}
+
+static float scalar_sum(const float* x, long long n) {
+    float total = 0;
+    for (long long i = 0; i < n; i++) total += x[i];
+    return total;
+}
+
+static void scalar_relu_backward(const float* y, const float* grad, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += grad[i] * (y[i] > 0 ? 1 : 0);
+}
+
+static void scalar_sigmoid_backward(const float* y, const float* grad, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += grad[i] * (y[i] * (1 - y[i]));
+}
+
+static void scalar_tanh_backward(const float* y, const float* grad, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += grad[i] * (1 - y[i] * y[i]);
+}
+
+static void scalar_gelu_backward(const float* x, const float* grad, float* out, long long n) {
+    for (long long i = 0; i < n; i++) {
+        float x2 = x[i] * x[i];
+        float t = tanhf(GELU_C * x[i] * (1 + GELU_A * x2));
+        float du = GELU_C * (1 + 3 * GELU_A * x2);
+        out[i] += grad[i] * (0.5f * (1 + t) + 0.5f * x[i] * (1 - t * t) * du);
+    }
+}
+
+static void scalar_silu_backward(const float* x, const float* grad, float* out, long long n) {
+    for (long long i = 0; i < n; i++) {
+        float s = 1 / (1 + expf(-x[i]));
+        out[i] += grad[i] * (s * (1 + x[i] * (1 - s)));
+    }
+}
+
+static float scalar_bce(const float* p, const float* y, long long n) {
+    float total = 0;
+    for (long long i = 0; i < n; i++) {
+        // keep away from 0 and 1 so the logs stay finite
+        float pred = fminf(fmaxf(p[i], 1e-5f), 1 - 1e-5f);
+        total -= y[i] * logf(pred) + (1 - y[i]) * logf(1 - pred);
+    }
+    return total;
+}
+
+/* max(z, 0) - z * y + log(1 + exp(-|z|)) never overflows exp and only takes the log of
+   values in [1, 2], unlike taking the log of sigmoid(z) and 1 - sigmoid(z) */
+static float scalar_bce_with_logits(const float* z, const float* y, long long n) {
+    float total = 0;
+    for (long long i = 0; i < n; i++) {
+        total += (z[i] > 0 ? z[i] : 0) - z[i] * y[i] + log1pf(expf(-fabsf(z[i])));
+    }
+    return total;
+}
+
+static void scalar_bce_with_logits_backward(const float* z, const float* y, float scale, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += scale * (1 / (1 + expf(-z[i])) - y[i]);
+}
+
+static float scalar_logsumexp(const float* x, long long n) {
+    float max = x[0];
+    for (long long i = 1; i < n; i++) max = x[i] > max ? x[i] : max;
+    float total = 0;
+    for (long long i = 0; i < n; i++) total += expf(x[i] - max);
+    return max + logf(total);
+}
+
+static void scalar_softmax_cross_entropy_backward(const float* z, float lse, int label, float scale, float* out, long long n) {
+    for (long long i = 0; i < n; i++) out[i] += scale * expf(z[i] - lse);
+    if (label >= 0 && label < n) out[label] -= scale;
+}
+
+static void scalar_adam(float* param, const float* grad, float* m, float* v, long long n, const AdamStep* step) {
+    for (long long i = 0; i < n; i++) {
+        float g = grad[i] + step->l2 * param[i];
+        m[i] = step->beta1 * m[i] + (1 - step->beta1) * g;
+        v[i] = step->beta2 * v[i] + (1 - step->beta2) * g * g;
+        float denom = sqrtf(v[i]) * step->inv_sqrt_bias_correction2 + step->eps;
+        param[i] = param[i] * step->decay - step->step_size * m[i] / denom;
+    }
+}
+
+const Kernels scalar_kernels = {
+    "scalar",
+    GEMM_MR,
+    GEMM_NR,
+    scalar_gemm_micro_kernel,
+    scalar_add,
+    scalar_add_scalar,
+    scalar_mul,
+    scalar_mul_add,
+    scalar_mul_scalar,
+    scalar_mul_scalar_add,
+    scalar_dot,
+    scalar_relu,
+    scalar_sigmoid,
+    scalar_tanh,
+    scalar_gelu,
+    scalar_silu,
+    scalar_exp,
+    scalar_log,
+    scalar_sum,
+    scalar_relu_backward,
+    scalar_sigmoid_backward,
+    scalar_tanh_backward,
+    scalar_gelu_backward,
+    scalar_silu_backward,
+    scalar_bce,
+    scalar_bce_with_logits,
+    scalar_bce_with_logits_backward,
+    scalar_logsumexp,
+    scalar_softmax_cross_entropy_backward,
+    scalar_adam,
+};
+
+// Usable before the dispatch below has run
+Kernels kernels = scalar_kernels;
+
+#ifdef KERNELS_X86
+/* Read the extended control register to check which vector registers the OS saves */
+static unsigned long long read_xcr0(void) {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+}
+
+static int cpu_supports_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    int fma = (ecx >> 12) & 1;
+    int osxsave = (ecx >> 27) & 1;
+    int avx = (ecx >> 28) & 1;
+    if (!fma || !osxsave || !avx) return 0;
+    if ((read_xcr0() & 0x6) != 0x6) return 0; // XMM and YMM state
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx >> 5) & 1;
+}
+
+static int cpu_supports_avx512(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!cpu_supports_avx2()) return 0;
+    if ((read_xcr0() & 0xE6) != 0xE6) return 0; // opmask and ZMM state as well
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx >> 16) & 1; // AVX-512F
+}
+#endif
+
+/* Switch the kernel table to the given instruction set ("scalar", "avx2" or "avx512").
+   Returns 0 and leaves the table unchanged if the CPU doesn't support it. */
+int select_kernels(const char* isa) {
+    if (strcmp(isa, "scalar") == 0) {
+        kernels = scalar_kernels;
+        return 1;
+    }
+#ifdef KERNELS_X86
+    if (strcmp(isa, "avx2") == 0 && cpu_supports_avx2()) {
+        kernels = avx2_kernels;
+        return 1;
+    }
+    if (strcmp(isa, "avx512") == 0 && cpu_supports_avx512()) {
+        kernels = avx512_kernels;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/* Pick the best kernels once at startup. MLP_ISA can force a narrower instruction set. */
+__attribute__((constructor))
+static void init_kernels(void) {
+    const char* forced_isa = getenv("MLP_ISA");
+    if (forced_isa && select_kernels(forced_isa)) return;
+    if (forced_isa) {
+        fprintf(stderr, "MLP_ISA=%s is not supported on this CPU, detecting the best kernels instead.\n", forced_isa);
+    }
+    if (!select_kernels("avx512") && !select_kernels("avx2")) {
+        select_kernels("scalar");
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/* Constants of one Adam step. The bias corrections of the step are folded into
+   step_size and inv_sqrt_bias_correction2. */
+typedef struct AdamStep {
+    float beta1;
+    float beta2;
+    float eps;
+    float l2; // added to the grad as l2 * param, the coupled weight decay of Adam
+    float decay; // params are scaled by this first, 1 - lr * weight_decay for AdamW
+    float step_size; // lr / (1 - beta1^t)
+    float inv_sqrt_bias_correction2; // 1 / sqrt(1 - beta2^t)
+} AdamStep;
+
+// Constants of the tanh approximation of GELU, 0.5 * x * (1 + tanh(c * (x + a * x^3)))
+#define GELU_C 0.7978845608028654f // sqrt(2 / pi)
+#define GELU_A 0.044715f
+
+/* Table of the hot inner loops used by the tensor ops. It starts out pointing at the
+   portable scalar versions and is switched to the widest instruction set the CPU
+   supports when the process starts, so a single binary runs well on any x86-64 host. */
+typedef struct Kernels {
+    const char* isa;
+    // register tile of the gemm micro-kernel
+    int gemm_mr;
+    int gemm_nr;
+    void (*gemm_micro_kernel)(int kc, const float* a_panel, const float* b_panel,
+                              float* C, long long c_row_stride, int m, int n, int accumulate);
+    void (*add)(const float* a, const float* b, float* out, long long n);
+    void (*add_scalar)(const float* a, float b, float* out, long long n);
+    void (*mul)(const float* a, const float* b, float* out, long long n);
+    void (*mul_add)(const float* a, const float* b, float* out, long long n); // out += a * b
+    void (*mul_scalar)(const float* a, float b, float* out, long long n);
+    void (*mul_scalar_add)(const float* a, float b, float* out, long long n); // out += a * b
+    float (*dot)(const float* a, const float* b, long long n);
+    void (*relu)(const float* x, float* out, long long n);
+    void (*sigmoid)(const float* x, float* out, long long n);
+    void (*tanh)(const float* x, float* out, long long n);
+    void (*gelu)(const float* x, float* out, long long n); // the tanh approximation
+    void (*silu)(const float* x, float* out, long long n); // x * sigmoid(x)
+    void (*exp)(const float* x, float* out, long long n);
+    void (*log)(const float* x, float* out, long long n);
+    float (*sum)(const float* x, long long n);
+    void (*relu_backward)(const float* y, const float* grad, float* out, long long n); // out += grad * (y > 0)
+    void (*sigmoid_backward)(const float* y, const float* grad, float* out, long long n); // out += grad * y * (1 - y)
+    void (*tanh_backward)(const float* y, const float* grad, float* out, long long n); // out += grad * (1 - y^2)
+    // out += grad * gelu'(x) and grad * silu'(x), from the inputs x
+    void (*gelu_backward)(const float* x, const float* grad, float* out, long long n);
+    void (*silu_backward)(const float* x, const float* grad, float* out, long long n);
+    // sum over i of the binary cross entropy of the probabilities p[i] clamped to [1e-5, 1 - 1e-5]
+    float (*bce)(const float* p, const float* y, long long n);
+    // sum over i of the binary cross entropy of sigmoid(z[i]) against y[i], from the logits z
+    float (*bce_with_logits)(const float* z, const float* y, long long n);
+    void (*bce_with_logits_backward)(const float* z, const float* y, float scale, float* out, long long n); // out += scale * (sigmoid(z) - y)
+    float (*logsumexp)(const float* x, long long n); // log(sum(exp(x))) shifted by max(x) so it can't overflow
+    // out += scale * (exp(z - lse) - (i == label)), the softmax cross entropy grads of one row.
+    // label can be outside [0, n) when the row is a slice that doesn't hold it.
+    void (*softmax_cross_entropy_backward)(const float* z, float lse, int label, float scale, float* out, long long n);
+    // updates param, m and v in place from grad in a single pass
+    void (*adam)(float* param, const float* grad, float* m, float* v, long long n, const AdamStep* step);
+} Kernels;
+
+extern Kernels kernels;
+extern const Kernels scalar_kernels;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+extern const Kernels avx2_kernels;
+extern const Kernels avx512_kernels;
+#endif
+
+int select_kernels(const char* isa);
+
+#endif // KERNELS_H
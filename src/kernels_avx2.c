@@ -0,0 +1,460 @@
+#include <math.h>
+
+#include "kernels.h"
+#include "simd_math.h"
+
+#ifdef KERNELS_X86
+
+/* AVX2 + FMA kernels, see simd_math.h for how they are compiled */
+
+#define AVX2_GEMM_MR 6
+#define AVX2_GEMM_NR 16
+
+AVX2 static void avx2_gemm_micro_kernel(int kc, const float* a_panel, const float* b_panel,
+                                        float* C, long long c_row_stride, int m, int n, int accumulate) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (int k = 0; k < kc; k++) {
+        __m256 b0 = _mm256_loadu_ps(b_panel);
+        __m256 b1 = _mm256_loadu_ps(b_panel + 8);
+        __m256 a;
+        a = _mm256_broadcast_ss(a_panel + 0); c00 = _mm256_fmadd_ps(a, b0, c00); c01 = _mm256_fmadd_ps(a, b1, c01);
+        a = _mm256_broadcast_ss(a_panel + 1); c10 = _mm256_fmadd_ps(a, b0, c10); c11 = _mm256_fmadd_ps(a, b1, c11);
+        a = _mm256_broadcast_ss(a_panel + 2); c20 = _mm256_fmadd_ps(a, b0, c20); c21 = _mm256_fmadd_ps(a, b1, c21);
+        a = _mm256_broadcast_ss(a_panel + 3); c30 = _mm256_fmadd_ps(a, b0, c30); c31 = _mm256_fmadd_ps(a, b1, c31);
+        a = _mm256_broadcast_ss(a_panel + 4); c40 = _mm256_fmadd_ps(a, b0, c40); c41 = _mm256_fmadd_ps(a, b1, c41);
+        a = _mm256_broadcast_ss(a_panel + 5); c50 = _mm256_fmadd_ps(a, b0, c50); c51 = _mm256_fmadd_ps(a, b1, c51);
+        a_panel += AVX2_GEMM_MR;
+        b_panel += AVX2_GEMM_NR;
+    }
+
+    __m256 tile[AVX2_GEMM_MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    if (n == AVX2_GEMM_NR) {
+        for (int i = 0; i < m; i++) {
+            float* c_row = C + i * c_row_stride;
+            if (accumulate) {
+                tile[i][0] = _mm256_add_ps(tile[i][0], _mm256_loadu_ps(c_row));
+                tile[i][1] = _mm256_add_ps(tile[i][1], _mm256_loadu_ps(c_row + 8));
+            }
+            _mm256_storeu_ps(c_row, tile[i][0]);
+            _mm256_storeu_ps(c_row + 8, tile[i][1]);
+        }
+    } else {
+        // partial tile at the right edge of C
+        float spill[AVX2_GEMM_NR];
+        for (int i = 0; i < m; i++) {
+            float* c_row = C + i * c_row_stride;
+            _mm256_storeu_ps(spill, tile[i][0]);
+            _mm256_storeu_ps(spill + 8, tile[i][1]);
+            if (accumulate) {
+                for (int j = 0; j < n; j++) c_row[j] += spill[j];
+            } else {
+                for (int j = 0; j < n; j++) c_row[j] = spill[j];
+            }
+        }
+    }
+}
+
+AVX2 static void avx2_add(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+AVX2 static void avx2_add_scalar(const float* a, float b, float* out, long long n) {
+    __m256 vb = _mm256_set1_ps(b);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), vb));
+    }
+    for (; i < n; i++) out[i] = a[i] + b;
+}
+
+AVX2 static void avx2_mul(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+AVX2 static void avx2_mul_add(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(out + i));
+        _mm256_storeu_ps(out + i, acc);
+    }
+    for (; i < n; i++) out[i] += a[i] * b[i];
+}
+
+AVX2 static void avx2_mul_scalar(const float* a, float b, float* out, long long n) {
+    __m256 vb = _mm256_set1_ps(b);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), vb));
+    }
+    for (; i < n; i++) out[i] = a[i] * b;
+}
+
+AVX2 static void avx2_mul_scalar_add(const float* a, float b, float* out, long long n) {
+    __m256 vb = _mm256_set1_ps(b);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), vb, _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) out[i] += a[i] * b;
+}
+
+AVX2 static float avx2_dot(const float* a, const float* b, long long n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    float total = _mm_cvtss_f32(half);
+    for (; i < n; i++) total += a[i] * b[i];
+    return total;
+}
+
+AVX2 static void avx2_relu(const float* x, float* out, long long n) {
+    __m256 zero = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_loadu_ps(x + i), zero));
+    }
+    for (; i < n; i++) out[i] = x[i] > 0 ? x[i] : 0;
+}
+
+/* Defines a kernel out[i] = f(x[i]) from a vector function f. The tail is padded so it
+   goes through the same approximation. */
+#define AVX2_MAP_KERNEL(name, vector_func)                                  \
+    AVX2 static void name(const float* x, float* out, long long n) {        \
+        long long i = 0;                                                    \
+        for (; i + 8 <= n; i += 8) {                                        \
+            _mm256_storeu_ps(out + i, vector_func(_mm256_loadu_ps(x + i))); \
+        }                                                                   \
+        if (i < n) {                                                        \
+            float tail[8] = {0};                                            \
+            for (int j = 0; i + j < n; j++) tail[j] = x[i + j];             \
+            _mm256_storeu_ps(tail, vector_func(_mm256_loadu_ps(tail)));     \
+            for (int j = 0; i + j < n; j++) out[i + j] = tail[j];           \
+        }                                                                   \
+    }
+
+/* Defines a kernel out[i] += grad[i] * f(x[i]) from a vector function f giving the local grad */
+#define AVX2_BACKWARD_KERNEL(name, local_grad_func)                               \
+    AVX2 static void name(const float* x, const float* grad, float* out, long long n) { \
+        long long i = 0;                                                          \
+        for (; i + 8 <= n; i += 8) {                                              \
+            __m256 local_grad = local_grad_func(_mm256_loadu_ps(x + i));          \
+            __m256 acc = _mm256_loadu_ps(out + i);                                \
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(grad + i), local_grad, acc);    \
+            _mm256_storeu_ps(out + i, acc);                                       \
+        }                                                                         \
+        if (i < n) {                                                              \
+            float tail[8] = {0};                                                  \
+            for (int j = 0; i + j < n; j++) tail[j] = x[i + j];                   \
+            _mm256_storeu_ps(tail, local_grad_func(_mm256_loadu_ps(tail)));       \
+            for (int j = 0; i + j < n; j++) out[i + j] += grad[i + j] * tail[j];  \
+        }                                                                         \
+    }
+
+/* gelu(x) = 0.5 * x * (1 + tanh(u)) = x * sigmoid(2u) with u = c * (x + a * x^3) */
+AVX2 static inline __m256 avx2_gelu_vector(__m256 x) {
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 two_u = _mm256_mul_ps(x, _mm256_fmadd_ps(x2, _mm256_set1_ps(2 * GELU_C * GELU_A), _mm256_set1_ps(2 * GELU_C)));
+    return _mm256_mul_ps(x, avx2_sigmoid_vector(two_u));
+}
+
+/* d/dx x * s = s + x * s * (1 - s) * 2u' with s = sigmoid(2u) */
+AVX2 static inline __m256 avx2_gelu_grad_vector(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 two_u = _mm256_mul_ps(x, _mm256_fmadd_ps(x2, _mm256_set1_ps(2 * GELU_C * GELU_A), _mm256_set1_ps(2 * GELU_C)));
+    __m256 two_du = _mm256_fmadd_ps(x2, _mm256_set1_ps(6 * GELU_C * GELU_A), _mm256_set1_ps(2 * GELU_C));
+    __m256 s = avx2_sigmoid_vector(two_u);
+    __m256 ds = _mm256_mul_ps(_mm256_mul_ps(s, _mm256_sub_ps(one, s)), two_du);
+    return _mm256_fmadd_ps(x, ds, s);
+}
+
+AVX2 static inline __m256 avx2_silu_vector(__m256 x) {
+    return _mm256_mul_ps(x, avx2_sigmoid_vector(x));
+}
+
+/* d/dx x * s = s * (1 + x * (1 - s)) with s = sigmoid(x) */
+AVX2 static inline __m256 avx2_silu_grad_vector(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 s = avx2_sigmoid_vector(x);
+    return _mm256_mul_ps(s, _mm256_fmadd_ps(x, _mm256_sub_ps(one, s), one));
+}
+
+/* 1 - y^2, the grad of tanh from its output */
+AVX2 static inline __m256 avx2_tanh_grad_vector(__m256 y) {
+    return _mm256_fnmadd_ps(y, y, _mm256_set1_ps(1.0f));
+}
+
+AVX2_MAP_KERNEL(avx2_sigmoid, avx2_sigmoid_vector)
+AVX2_MAP_KERNEL(avx2_tanh, avx2_tanh_vector)
+AVX2_MAP_KERNEL(avx2_gelu, avx2_gelu_vector)
+AVX2_MAP_KERNEL(avx2_silu, avx2_silu_vector)
+AVX2_MAP_KERNEL(avx2_exp, avx2_exp_vector)
+AVX2_MAP_KERNEL(avx2_log, avx2_log_vector)
+
+AVX2 static float avx2_sum(const float* x, long long n) {
+    // independent accumulators hide the latency of the adds
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(x + i));
+        acc1 = _mm256_add_ps(acc1, _mm256_loadu_ps(x + i + 8));
+        acc2 = _mm256_add_ps(acc2, _mm256_loadu_ps(x + i + 16));
+        acc3 = _mm256_add_ps(acc3, _mm256_loadu_ps(x + i + 24));
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(x + i));
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    float total = _mm_cvtss_f32(half);
+    for (; i < n; i++) total += x[i];
+    return total;
+}
+
+AVX2 static void avx2_relu_backward(const float* y, const float* grad, float* out, long long n) {
+    __m256 zero = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 positive = _mm256_cmp_ps(_mm256_loadu_ps(y + i), zero, _CMP_GT_OQ);
+        __m256 g = _mm256_and_ps(_mm256_loadu_ps(grad + i), positive);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), g));
+    }
+    for (; i < n; i++) out[i] += grad[i] * (y[i] > 0 ? 1 : 0);
+}
+
+AVX2 static void avx2_sigmoid_backward(const float* y, const float* grad, float* out, long long n) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 local_grad = _mm256_mul_ps(vy, _mm256_sub_ps(one, vy));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(grad + i), local_grad, _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) out[i] += grad[i] * (y[i] * (1 - y[i]));
+}
+
+AVX2_BACKWARD_KERNEL(avx2_tanh_backward, avx2_tanh_grad_vector)
+AVX2_BACKWARD_KERNEL(avx2_gelu_backward, avx2_gelu_grad_vector)
+AVX2_BACKWARD_KERNEL(avx2_silu_backward, avx2_silu_grad_vector)
+
+/* Binary cross entropy of one vector of clamped probabilities, see scalar_bce */
+AVX2 static inline __m256 avx2_bce_vector(__m256 p, __m256 y) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    p = _mm256_min_ps(_mm256_max_ps(p, _mm256_set1_ps(1e-5f)), _mm256_set1_ps(1 - 1e-5f));
+    __m256 loss = _mm256_mul_ps(y, avx2_log_vector(p));
+    loss = _mm256_fmadd_ps(_mm256_sub_ps(one, y), avx2_log_vector(_mm256_sub_ps(one, p)), loss);
+    return _mm256_sub_ps(_mm256_setzero_ps(), loss);
+}
+
+AVX2 static float avx2_bce(const float* p, const float* y, long long n) {
+    __m256 acc = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, avx2_bce_vector(_mm256_loadu_ps(p + i), _mm256_loadu_ps(y + i)));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float total = 0;
+    for (int j = 0; j < 8; j++) total += lanes[j];
+    if (i < n) {
+        float tail_p[8] = {0}, tail_y[8] = {0};
+        for (int j = 0; i + j < n; j++) {
+            tail_p[j] = p[i + j];
+            tail_y[j] = y[i + j];
+        }
+        _mm256_storeu_ps(lanes, avx2_bce_vector(_mm256_loadu_ps(tail_p), _mm256_loadu_ps(tail_y)));
+        for (int j = 0; i + j < n; j++) total += lanes[j];
+    }
+    return total;
+}
+
+/* Binary cross entropy of one vector of logits, see scalar_bce_with_logits */
+AVX2 static inline __m256 avx2_bce_with_logits_vector(__m256 z, __m256 y) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 abs_z = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), z);
+    __m256 e = avx2_exp_vector(_mm256_sub_ps(_mm256_setzero_ps(), abs_z));
+    // log1p(e) as log(1 + e) plus the part of e lost when rounding 1 + e
+    __m256 u = _mm256_add_ps(one, e);
+    __m256 log_term = _mm256_add_ps(avx2_log_vector(u), _mm256_div_ps(_mm256_sub_ps(e, _mm256_sub_ps(u, one)), u));
+    return _mm256_add_ps(_mm256_fnmadd_ps(z, y, _mm256_max_ps(z, _mm256_setzero_ps())), log_term);
+}
+
+AVX2 static float avx2_bce_with_logits(const float* z, const float* y, long long n) {
+    __m256 acc = _mm256_setzero_ps();
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, avx2_bce_with_logits_vector(_mm256_loadu_ps(z + i), _mm256_loadu_ps(y + i)));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float total = 0;
+    for (int j = 0; j < 8; j++) total += lanes[j];
+    if (i < n) {
+        // pad the tail and only add the lanes that hold elements
+        float tail_z[8] = {0}, tail_y[8] = {0};
+        for (int j = 0; i + j < n; j++) {
+            tail_z[j] = z[i + j];
+            tail_y[j] = y[i + j];
+        }
+        _mm256_storeu_ps(lanes, avx2_bce_with_logits_vector(_mm256_loadu_ps(tail_z), _mm256_loadu_ps(tail_y)));
+        for (int j = 0; i + j < n; j++) total += lanes[j];
+    }
+    return total;
+}
+
+AVX2 static void avx2_bce_with_logits_backward(const float* z, const float* y, float scale, float* out, long long n) {
+    __m256 vscale = _mm256_set1_ps(scale);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 diff = _mm256_sub_ps(avx2_sigmoid_vector(_mm256_loadu_ps(z + i)), _mm256_loadu_ps(y + i));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(vscale, diff, _mm256_loadu_ps(out + i)));
+    }
+    if (i < n) {
+        float tail[8] = {0};
+        for (int j = 0; i + j < n; j++) tail[j] = z[i + j];
+        _mm256_storeu_ps(tail, avx2_sigmoid_vector(_mm256_loadu_ps(tail)));
+        for (int j = 0; i + j < n; j++) out[i + j] += scale * (tail[j] - y[i + j]);
+    }
+}
+
+AVX2 static float avx2_logsumexp(const float* x, long long n) {
+    // first pass for the max, second for the sum of the shifted exps
+    __m256 vmax = _mm256_set1_ps(x[0]);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vmax);
+    float max = lanes[0];
+    for (int j = 1; j < 8; j++) max = lanes[j] > max ? lanes[j] : max;
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+
+    __m256 shift = _mm256_set1_ps(max);
+    __m256 acc = _mm256_setzero_ps();
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, avx2_exp_vector(_mm256_sub_ps(_mm256_loadu_ps(x + i), shift)));
+    }
+    _mm256_storeu_ps(lanes, acc);
+    float total = 0;
+    for (int j = 0; j < 8; j++) total += lanes[j];
+    if (i < n) {
+        // pad the tail with the max and only add the lanes that hold elements
+        float tail[8];
+        for (int j = 0; j < 8; j++) tail[j] = i + j < n ? x[i + j] : max;
+        _mm256_storeu_ps(lanes, avx2_exp_vector(_mm256_sub_ps(_mm256_loadu_ps(tail), shift)));
+        for (int j = 0; i + j < n; j++) total += lanes[j];
+    }
+    return max + logf(total);
+}
+
+AVX2 static void avx2_softmax_cross_entropy_backward(const float* z, float lse, int label, float scale, float* out, long long n) {
+    __m256 shift = _mm256_set1_ps(lse);
+    __m256 vscale = _mm256_set1_ps(scale);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 p = avx2_exp_vector(_mm256_sub_ps(_mm256_loadu_ps(z + i), shift));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(vscale, p, _mm256_loadu_ps(out + i)));
+    }
+    if (i < n) {
+        float tail[8] = {0};
+        for (int j = 0; i + j < n; j++) tail[j] = z[i + j];
+        _mm256_storeu_ps(tail, avx2_exp_vector(_mm256_sub_ps(_mm256_loadu_ps(tail), shift)));
+        for (int j = 0; i + j < n; j++) out[i + j] += scale * tail[j];
+    }
+    if (label >= 0 && label < n) out[label] -= scale;
+}
+
+AVX2 static void avx2_adam(float* param, const float* grad, float* m, float* v, long long n, const AdamStep* step) {
+    __m256 beta1 = _mm256_set1_ps(step->beta1);
+    __m256 beta2 = _mm256_set1_ps(step->beta2);
+    __m256 one_minus_beta1 = _mm256_set1_ps(1 - step->beta1);
+    __m256 one_minus_beta2 = _mm256_set1_ps(1 - step->beta2);
+    __m256 eps = _mm256_set1_ps(step->eps);
+    __m256 l2 = _mm256_set1_ps(step->l2);
+    __m256 decay = _mm256_set1_ps(step->decay);
+    __m256 step_size = _mm256_set1_ps(step->step_size);
+    __m256 inv_sqrt_bc2 = _mm256_set1_ps(step->inv_sqrt_bias_correction2);
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 p = _mm256_loadu_ps(param + i);
+        __m256 g = _mm256_fmadd_ps(l2, p, _mm256_loadu_ps(grad + i));
+        __m256 vm = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(m + i), _mm256_mul_ps(one_minus_beta1, g));
+        __m256 vv = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(v + i), _mm256_mul_ps(one_minus_beta2, _mm256_mul_ps(g, g)));
+        __m256 denom = _mm256_fmadd_ps(_mm256_sqrt_ps(vv), inv_sqrt_bc2, eps);
+        p = _mm256_fnmadd_ps(step_size, _mm256_div_ps(vm, denom), _mm256_mul_ps(p, decay));
+        _mm256_storeu_ps(m + i, vm);
+        _mm256_storeu_ps(v + i, vv);
+        _mm256_storeu_ps(param + i, p);
+    }
+    for (; i < n; i++) {
+        float g = grad[i] + step->l2 * param[i];
+        m[i] = step->beta1 * m[i] + (1 - step->beta1) * g;
+        v[i] = step->beta2 * v[i] + (1 - step->beta2) * g * g;
+        float denom = sqrtf(v[i]) * step->inv_sqrt_bias_correction2 + step->eps;
+        param[i] = param[i] * step->decay - step->step_size * m[i] / denom;
+    }
+}
+
+const Kernels avx2_kernels = {
+    "avx2",
+    AVX2_GEMM_MR,
+    AVX2_GEMM_NR,
+    avx2_gemm_micro_kernel,
+    avx2_add,
+    avx2_add_scalar,
+    avx2_mul,
+    avx2_mul_add,
+    avx2_mul_scalar,
+    avx2_mul_scalar_add,
+    avx2_dot,
+    avx2_relu,
+    avx2_sigmoid,
+    avx2_tanh,
+    avx2_gelu,
+    avx2_silu,
+    avx2_exp,
+    avx2_log,
+    avx2_sum,
+    avx2_relu_backward,
+    avx2_sigmoid_backward,
+    avx2_tanh_backward,
+    avx2_gelu_backward,
+    avx2_silu_backward,
+    avx2_bce,
+    avx2_bce_with_logits,
+    avx2_bce_with_logits_backward,
+    avx2_logsumexp,
+    avx2_softmax_cross_entropy_backward,
+    avx2_adam,
+};
+
+#endif // KERNELS_X86
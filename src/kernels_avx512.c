@@ -0,0 +1,411 @@
+#include <float.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "simd_math.h"
+
+#ifdef KERNELS_X86
+
+/* AVX-512F kernels. Tails are handled with masked loads and stores instead of scalar loops. */
+
+#define AVX512_GEMM_MR 6
+#define AVX512_GEMM_NR 32
+
+/* Mask selecting the first n (< 16) lanes */
+#define TAIL_MASK(n) ((__mmask16)((1u << (n)) - 1))
+
+AVX512 static void avx512_gemm_micro_kernel(int kc, const float* a_panel, const float* b_panel,
+                                            float* C, long long c_row_stride, int m, int n, int accumulate) {
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+
+    for (int k = 0; k < kc; k++) {
+        __m512 b0 = _mm512_loadu_ps(b_panel);
+        __m512 b1 = _mm512_loadu_ps(b_panel + 16);
+        __m512 a;
+        a = _mm512_set1_ps(a_panel[0]); c00 = _mm512_fmadd_ps(a, b0, c00); c01 = _mm512_fmadd_ps(a, b1, c01);
+        a = _mm512_set1_ps(a_panel[1]); c10 = _mm512_fmadd_ps(a, b0, c10); c11 = _mm512_fmadd_ps(a, b1, c11);
+        a = _mm512_set1_ps(a_panel[2]); c20 = _mm512_fmadd_ps(a, b0, c20); c21 = _mm512_fmadd_ps(a, b1, c21);
+        a = _mm512_set1_ps(a_panel[3]); c30 = _mm512_fmadd_ps(a, b0, c30); c31 = _mm512_fmadd_ps(a, b1, c31);
+        a = _mm512_set1_ps(a_panel[4]); c40 = _mm512_fmadd_ps(a, b0, c40); c41 = _mm512_fmadd_ps(a, b1, c41);
+        a = _mm512_set1_ps(a_panel[5]); c50 = _mm512_fmadd_ps(a, b0, c50); c51 = _mm512_fmadd_ps(a, b1, c51);
+        a_panel += AVX512_GEMM_MR;
+        b_panel += AVX512_GEMM_NR;
+    }
+
+    __m512 tile[AVX512_GEMM_MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    // lanes of the two column halves that are inside C
+    __mmask16 mask0 = n >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n);
+    __mmask16 mask1 = n >= 32 ? (__mmask16)0xFFFF : (n > 16 ? TAIL_MASK(n - 16) : 0);
+    for (int i = 0; i < m; i++) {
+        float* c_row = C + i * c_row_stride;
+        if (accumulate) {
+            tile[i][0] = _mm512_add_ps(tile[i][0], _mm512_maskz_loadu_ps(mask0, c_row));
+            tile[i][1] = _mm512_add_ps(tile[i][1], _mm512_maskz_loadu_ps(mask1, c_row + 16));
+        }
+        _mm512_mask_storeu_ps(c_row, mask0, tile[i][0]);
+        _mm512_mask_storeu_ps(c_row + 16, mask1, tile[i][1]);
+    }
+}
+
+AVX512 static void avx512_add(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __m512 sum = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        _mm512_mask_storeu_ps(out + i, mask, sum);
+    }
+}
+
+AVX512 static void avx512_add_scalar(const float* a, float b, float* out, long long n) {
+    __m512 vb = _mm512_set1_ps(b);
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i), vb));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_add_ps(_mm512_maskz_loadu_ps(mask, a + i), vb));
+    }
+}
+
+AVX512 static void avx512_mul(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __m512 product = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        _mm512_mask_storeu_ps(out + i, mask, product);
+    }
+}
+
+AVX512 static void avx512_mul_add(const float* a, const float* b, float* out, long long n) {
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), _mm512_loadu_ps(out + i));
+        _mm512_storeu_ps(out + i, acc);
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __m512 acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i),
+                                     _mm512_maskz_loadu_ps(mask, out + i));
+        _mm512_mask_storeu_ps(out + i, mask, acc);
+    }
+}
+
+AVX512 static void avx512_mul_scalar(const float* a, float b, float* out, long long n) {
+    __m512 vb = _mm512_set1_ps(b);
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), vb));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, a + i), vb));
+    }
+}
+
+AVX512 static void avx512_mul_scalar_add(const float* a, float b, float* out, long long n) {
+    __m512 vb = _mm512_set1_ps(b);
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_loadu_ps(a + i), vb, _mm512_loadu_ps(out + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __m512 acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), vb, _mm512_maskz_loadu_ps(mask, out + i));
+        _mm512_mask_storeu_ps(out + i, mask, acc);
+    }
+}
+
+AVX512 static float avx512_dot(const float* a, const float* b, long long n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    long long i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    __m512 acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static void avx512_relu(const float* x, float* out, long long n) {
+    __m512 zero = _mm512_setzero_ps();
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_max_ps(_mm512_loadu_ps(x + i), zero));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_max_ps(_mm512_maskz_loadu_ps(mask, x + i), zero));
+    }
+}
+
+/* Defines a kernel out[i] = f(x[i]) from a vector function f */
+#define AVX512_MAP_KERNEL(name, vector_func)                                                       \
+    AVX512 static void name(const float* x, float* out, long long n) {                             \
+        for (long long i = 0; i < n; i += 16) {                                                    \
+            __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);                   \
+            _mm512_mask_storeu_ps(out + i, mask, vector_func(_mm512_maskz_loadu_ps(mask, x + i))); \
+        }                                                                                          \
+    }
+
+/* Defines a kernel out[i] += grad[i] * f(x[i]) from a vector function f giving the local grad */
+#define AVX512_BACKWARD_KERNEL(name, local_grad_func)                                      \
+    AVX512 static void name(const float* x, const float* grad, float* out, long long n) {  \
+        for (long long i = 0; i < n; i += 16) {                                            \
+            __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);           \
+            __m512 local_grad = local_grad_func(_mm512_maskz_loadu_ps(mask, x + i));       \
+            __m512 acc = _mm512_maskz_loadu_ps(mask, out + i);                             \
+            acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, grad + i), local_grad, acc); \
+            _mm512_mask_storeu_ps(out + i, mask, acc);                                     \
+        }                                                                                  \
+    }
+
+/* Same as avx2_gelu_vector */
+AVX512 static inline __m512 avx512_gelu_vector(__m512 x) {
+    __m512 x2 = _mm512_mul_ps(x, x);
+    __m512 two_u = _mm512_mul_ps(x, _mm512_fmadd_ps(x2, _mm512_set1_ps(2 * GELU_C * GELU_A), _mm512_set1_ps(2 * GELU_C)));
+    return _mm512_mul_ps(x, avx512_sigmoid_vector(two_u));
+}
+
+AVX512 static inline __m512 avx512_gelu_grad_vector(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 x2 = _mm512_mul_ps(x, x);
+    __m512 two_u = _mm512_mul_ps(x, _mm512_fmadd_ps(x2, _mm512_set1_ps(2 * GELU_C * GELU_A), _mm512_set1_ps(2 * GELU_C)));
+    __m512 two_du = _mm512_fmadd_ps(x2, _mm512_set1_ps(6 * GELU_C * GELU_A), _mm512_set1_ps(2 * GELU_C));
+    __m512 s = avx512_sigmoid_vector(two_u);
+    __m512 ds = _mm512_mul_ps(_mm512_mul_ps(s, _mm512_sub_ps(one, s)), two_du);
+    return _mm512_fmadd_ps(x, ds, s);
+}
+
+AVX512 static inline __m512 avx512_silu_vector(__m512 x) {
+    return _mm512_mul_ps(x, avx512_sigmoid_vector(x));
+}
+
+AVX512 static inline __m512 avx512_silu_grad_vector(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 s = avx512_sigmoid_vector(x);
+    return _mm512_mul_ps(s, _mm512_fmadd_ps(x, _mm512_sub_ps(one, s), one));
+}
+
+AVX512 static inline __m512 avx512_tanh_grad_vector(__m512 y) {
+    return _mm512_fnmadd_ps(y, y, _mm512_set1_ps(1.0f));
+}
+
+AVX512_MAP_KERNEL(avx512_sigmoid, avx512_sigmoid_vector)
+AVX512_MAP_KERNEL(avx512_tanh, avx512_tanh_vector)
+AVX512_MAP_KERNEL(avx512_gelu, avx512_gelu_vector)
+AVX512_MAP_KERNEL(avx512_silu, avx512_silu_vector)
+AVX512_MAP_KERNEL(avx512_exp, avx512_exp_vector)
+AVX512_MAP_KERNEL(avx512_log, avx512_log_vector)
+
+AVX512 static float avx512_sum(const float* x, long long n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    long long i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_add_ps(acc0, _mm512_loadu_ps(x + i));
+        acc1 = _mm512_add_ps(acc1, _mm512_loadu_ps(x + i + 16));
+        acc2 = _mm512_add_ps(acc2, _mm512_loadu_ps(x + i + 32));
+        acc3 = _mm512_add_ps(acc3, _mm512_loadu_ps(x + i + 48));
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_ps(acc0, _mm512_loadu_ps(x + i));
+    }
+    if (i < n) {
+        acc1 = _mm512_add_ps(acc1, _mm512_maskz_loadu_ps(TAIL_MASK(n - i), x + i));
+    }
+    __m512 acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static void avx512_relu_backward(const float* y, const float* grad, float* out, long long n) {
+    __m512 zero = _mm512_setzero_ps();
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 positive = _mm512_cmp_ps_mask(_mm512_loadu_ps(y + i), zero, _CMP_GT_OQ);
+        __m512 acc = _mm512_mask_add_ps(_mm512_loadu_ps(out + i), positive, _mm512_loadu_ps(out + i), _mm512_loadu_ps(grad + i));
+        _mm512_storeu_ps(out + i, acc);
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __mmask16 positive = _mm512_mask_cmp_ps_mask(mask, _mm512_maskz_loadu_ps(mask, y + i), zero, _CMP_GT_OQ);
+        __m512 current = _mm512_maskz_loadu_ps(mask, out + i);
+        __m512 acc = _mm512_mask_add_ps(current, positive, current, _mm512_maskz_loadu_ps(mask, grad + i));
+        _mm512_mask_storeu_ps(out + i, mask, acc);
+    }
+}
+
+AVX512 static void avx512_sigmoid_backward(const float* y, const float* grad, float* out, long long n) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    long long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vy = _mm512_loadu_ps(y + i);
+        __m512 local_grad = _mm512_mul_ps(vy, _mm512_sub_ps(one, vy));
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_loadu_ps(grad + i), local_grad, _mm512_loadu_ps(out + i)));
+    }
+    if (i < n) {
+        __mmask16 mask = TAIL_MASK(n - i);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        __m512 local_grad = _mm512_mul_ps(vy, _mm512_sub_ps(one, vy));
+        __m512 acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, grad + i), local_grad, _mm512_maskz_loadu_ps(mask, out + i));
+        _mm512_mask_storeu_ps(out + i, mask, acc);
+    }
+}
+
+AVX512_BACKWARD_KERNEL(avx512_tanh_backward, avx512_tanh_grad_vector)
+AVX512_BACKWARD_KERNEL(avx512_gelu_backward, avx512_gelu_grad_vector)
+AVX512_BACKWARD_KERNEL(avx512_silu_backward, avx512_silu_grad_vector)
+
+AVX512 static float avx512_bce(const float* p, const float* y, long long n) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 acc = _mm512_setzero_ps();
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 vp = _mm512_maskz_loadu_ps(mask, p + i);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        vp = _mm512_min_ps(_mm512_max_ps(vp, _mm512_set1_ps(1e-5f)), _mm512_set1_ps(1 - 1e-5f));
+        __m512 loss = _mm512_mul_ps(vy, avx512_log_vector(vp));
+        loss = _mm512_fmadd_ps(_mm512_sub_ps(one, vy), avx512_log_vector(_mm512_sub_ps(one, vp)), loss);
+        acc = _mm512_mask_sub_ps(acc, mask, acc, loss);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static float avx512_bce_with_logits(const float* z, const float* y, long long n) {
+    __m512 zero = _mm512_setzero_ps();
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 acc = zero;
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 vz = _mm512_maskz_loadu_ps(mask, z + i);
+        __m512 abs_z = _mm512_abs_ps(vz);
+        __m512 e = avx512_exp_vector(_mm512_sub_ps(zero, abs_z));
+        // log1p(e) as log(1 + e) plus the part of e lost when rounding 1 + e
+        __m512 u = _mm512_add_ps(one, e);
+        __m512 log_term = _mm512_add_ps(avx512_log_vector(u), _mm512_div_ps(_mm512_sub_ps(e, _mm512_sub_ps(u, one)), u));
+        __m512 loss = _mm512_add_ps(_mm512_fnmadd_ps(vz, _mm512_maskz_loadu_ps(mask, y + i), _mm512_max_ps(vz, zero)), log_term);
+        // lanes past the end would add log(2)
+        acc = _mm512_mask_add_ps(acc, mask, acc, loss);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static void avx512_bce_with_logits_backward(const float* z, const float* y, float scale, float* out, long long n) {
+    __m512 vscale = _mm512_set1_ps(scale);
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 diff = _mm512_sub_ps(avx512_sigmoid_vector(_mm512_maskz_loadu_ps(mask, z + i)), _mm512_maskz_loadu_ps(mask, y + i));
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_fmadd_ps(vscale, diff, _mm512_maskz_loadu_ps(mask, out + i)));
+    }
+}
+
+AVX512 static float avx512_logsumexp(const float* x, long long n) {
+    // first pass for the max, second for the sum of the shifted exps
+    __m512 vmax = _mm512_set1_ps(-FLT_MAX);
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        vmax = _mm512_mask_max_ps(vmax, mask, vmax, _mm512_maskz_loadu_ps(mask, x + i));
+    }
+    float max = _mm512_reduce_max_ps(vmax);
+
+    __m512 shift = _mm512_set1_ps(max);
+    __m512 acc = _mm512_setzero_ps();
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 e = avx512_exp_vector(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), shift));
+        acc = _mm512_mask_add_ps(acc, mask, acc, e);
+    }
+    return max + logf(_mm512_reduce_add_ps(acc));
+}
+
+AVX512 static void avx512_softmax_cross_entropy_backward(const float* z, float lse, int label, float scale, float* out, long long n) {
+    __m512 shift = _mm512_set1_ps(lse);
+    __m512 vscale = _mm512_set1_ps(scale);
+    for (long long i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 p = avx512_exp_vector(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, z + i), shift));
+        _mm512_mask_storeu_ps(out + i, mask, _mm512_fmadd_ps(vscale, p, _mm512_maskz_loadu_ps(mask, out + i)));
+    }
+    if (label >= 0 && label < n) out[label] -= scale;
+}
+
+AVX512 static void avx512_adam(float* param, const float* grad, float* m, float* v, long long n, const AdamStep* step) {
+    __m512 beta1 = _mm512_set1_ps(step->beta1);
+    __m512 beta2 = _mm512_set1_ps(step->beta2);
+    __m512 one_minus_beta1 = _mm512_set1_ps(1 - step->beta1);
+    __m512 one_minus_beta2 = _mm512_set1_ps(1 - step->beta2);
+    __m512 eps = _mm512_set1_ps(step->eps);
+    __m512 l2 = _mm512_set1_ps(step->l2);
+    __m512 decay = _mm512_set1_ps(step->decay);
+    __m512 step_size = _mm512_set1_ps(step->step_size);
+    __m512 inv_sqrt_bc2 = _mm512_set1_ps(step->inv_sqrt_bias_correction2);
+    for (long long i = 0; i < n; i += 16) {
+        // full vectors and the tail share the masked path, the mask is all ones until the end
+        __mmask16 mask = n - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(n - i);
+        __m512 p = _mm512_maskz_loadu_ps(mask, param + i);
+        __m512 g = _mm512_fmadd_ps(l2, p, _mm512_maskz_loadu_ps(mask, grad + i));
+        __m512 vm = _mm512_fmadd_ps(beta1, _mm512_maskz_loadu_ps(mask, m + i), _mm512_mul_ps(one_minus_beta1, g));
+        __m512 vv = _mm512_fmadd_ps(beta2, _mm512_maskz_loadu_ps(mask, v + i), _mm512_mul_ps(one_minus_beta2, _mm512_mul_ps(g, g)));
+        __m512 denom = _mm512_fmadd_ps(_mm512_sqrt_ps(vv), inv_sqrt_bc2, eps);
+        p = _mm512_fnmadd_ps(step_size, _mm512_div_ps(vm, denom), _mm512_mul_ps(p, decay));
+        _mm512_mask_storeu_ps(m + i, mask, vm);
+        _mm512_mask_storeu_ps(v + i, mask, vv);
+        _mm512_mask_storeu_ps(param + i, mask, p);
+    }
+}
+
+const Kernels avx512_kernels = {
+    "avx512",
+    AVX512_GEMM_MR,
+    AVX512_GEMM_NR,
+    avx512_gemm_micro_kernel,
+    avx512_add,
+    avx512_add_scalar,
+    avx512_mul,
+    avx512_mul_add,
+    avx512_mul_scalar,
+    avx512_mul_scalar_add,
+    avx512_dot,
+    avx512_relu,
+    avx512_sigmoid,
+    avx512_tanh,
+    avx512_gelu,
+    avx512_silu,
+    avx512_exp,
+    avx512_log,
+    avx512_sum,
+    avx512_relu_backward,
+    avx512_sigmoid_backward,
+    avx512_tanh_backward,
+    avx512_gelu_backward,
+    avx512_silu_backward,
+    avx512_bce,
+    avx512_bce_with_logits,
+    avx512_bce_with_logits_backward,
+    avx512_logsumexp,
+    avx512_softmax_cross_entropy_backward,
+    avx512_adam,
+};
+
+#endif // KERNELS_X86
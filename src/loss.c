@@ -3,17 +3,41 @@
 #include <stdlib.h>
 
 #include "tensor.h"
-#include "optimizer.h"
+#include "backward.h"
+#include "kernels.h"
+#include "reduce.h"
+#include "thread_pool.h"
+
+// Roughly the flops per class of a row of softmax cross entropy, mostly the exp
+#define COST_SOFTMAX 20
 
 void backward_binary_cross_entropy(Tensor* result) {
     Tensor* y_pred = result->parents[0];
     Tensor* y_true = result->parents[1];
 
-    for (int i = 0; i < y_pred->size; i++) {
-        y_pred->grad[i] += (y_pred->data[i] - y_true->data[i]) / 
-            ((1 - y_pred->data[i]) * y_pred->data[i]) / 
+    float* pred_data = contiguous_data(y_pred);
+    float* true_data = contiguous_data(y_true);
+    float* pred_grad = contiguous_grad(y_pred);
+    for (long long i = 0; i < y_pred->size; i++) {
+        pred_grad[i] += (pred_data[i] - true_data[i]) / 
+            ((1 - pred_data[i]) * pred_data[i]) / 
             y_true->size;
     }
+    release_contiguous_data(y_pred, pred_data);
+    release_contiguous_data(y_true, true_data);
+    commit_contiguous_grad(y_pred, pred_grad);
+}
+
+void forward_binary_cross_entropy(Tensor* result) {
+    Tensor* y_pred = result->parents[0];
+    Tensor* y_true = result->parents[1];
+
+    // predictions are clamped to [1e-5, 1 - 1e-5] to avoid log(0)
+    float* pred_data = contiguous_data(y_pred);
+    float* true_data = contiguous_data(y_true);
+    result->data[0] = kernels.bce(pred_data, true_data, y_pred->size) / y_pred->size;
+    release_contiguous_data(y_pred, pred_data);
+    release_contiguous_data(y_true, true_data);
 }
 
 /* Binary cross entropy loss with mean reduction */
@@ -25,29 +49,228 @@ Tensor* binary_cross_entropy(Tensor* y_pred, Tensor* y_true) {
         exit(EXIT_FAILURE);
     }
 
-    float loss[1] = {0.0};
+    int shape[1] = {1};
+    Tensor* parents[2] = {y_pred, y_true};
+    Tensor* loss_tensor = create_op_result(shape, 1, parents, 2, backward_binary_cross_entropy);
+    loss_tensor->forward_func = forward_binary_cross_entropy;
+    forward_binary_cross_entropy(loss_tensor);
+    return loss_tensor;
+}
+
+void backward_binary_cross_entropy_with_logits(Tensor* result) {
+    Tensor* logits = result->parents[0];
+    Tensor* y_true = result->parents[1];
+
+    // d/dz of the mean loss is (sigmoid(z) - y) / n
+    float* logit_data = contiguous_data(logits);
+    float* true_data = contiguous_data(y_true);
+    float* logit_grad = contiguous_grad(logits);
+    kernels.bce_with_logits_backward(logit_data, true_data, result->grad[0] / logits->size, logit_grad, logits->size);
+    release_contiguous_data(logits, logit_data);
+    release_contiguous_data(y_true, true_data);
+    commit_contiguous_grad(logits, logit_grad);
+}
+
+void forward_binary_cross_entropy_with_logits(Tensor* result) {
+    Tensor* logits = result->parents[0];
+    Tensor* y_true = result->parents[1];
+
+    float* logit_data = contiguous_data(logits);
+    float* true_data = contiguous_data(y_true);
+    result->data[0] = kernels.bce_with_logits(logit_data, true_data, logits->size) / logits->size;
+    release_contiguous_data(logits, logit_data);
+    release_contiguous_data(y_true, true_data);
+}
+
+/* Binary cross entropy of sigmoid(logits) with mean reduction, computed from the logits
+   in a single pass without forming the sigmoid. It stays finite for any logits and the
+   backward is sigmoid(logits) - y_true, so use it with an mlp without an output sigmoid. */
+Tensor* binary_cross_entropy_with_logits(Tensor* logits, Tensor* y_true) {
+    if (logits->size != y_true->size) {
+        printf("Prediction and Truth tensors must have the same size!\n");
+        free_graph_from_tensor(logits);
+        free_tensor(y_true);
+        exit(EXIT_FAILURE);
+    }
+
+    int shape[1] = {1};
+    Tensor* parents[2] = {logits, y_true};
+    Tensor* loss_tensor = create_op_result(shape, 1, parents, 2, backward_binary_cross_entropy_with_logits);
+    loss_tensor->forward_func = forward_binary_cross_entropy_with_logits;
+    forward_binary_cross_entropy_with_logits(loss_tensor);
+    return loss_tensor;
+}
+
+/* Rows of logits split into chunks of classes, one task per chunk. Rows are only split
+   when there are fewer rows than threads, which matters for large numbers of classes. */
+typedef struct SoftmaxChunks {
+    const float* logits;
+    const float* labels;
+    float* grad;
+    float* lse; // log-sum-exp of each chunk, then of each row
+    float scale;
+    long long rows;
+    int classes;
+    int chunks;
+    int chunk_size;
+} SoftmaxChunks;
+
+static SoftmaxChunks softmax_chunks(Tensor* logits, const float* logit_data) {
+    SoftmaxChunks s;
+    s.logits = logit_data;
+    s.labels = NULL;
+    s.grad = NULL;
+    s.lse = NULL;
+    s.scale = 0;
+    s.classes = logits->shape[logits->num_dims-1];
+    s.rows = logits->size / s.classes;
+    s.chunks = 1;
+    int threads = get_num_threads();
+    if (s.rows < threads) {
+        int max_chunks = s.classes / grain_size_for_cost(COST_SOFTMAX);
+        s.chunks = (int)((threads + s.rows - 1) / s.rows);
+        if (s.chunks > max_chunks) s.chunks = max_chunks > 1 ? max_chunks : 1;
+    }
+    s.chunk_size = (s.classes + s.chunks - 1) / s.chunks;
+    s.chunks = (s.classes + s.chunk_size - 1) / s.chunk_size;
+    return s;
+}
+
+static void logsumexp_task(void* ctx, long long start, long long end) {
+    SoftmaxChunks* s = (SoftmaxChunks*)ctx;
+    for (long long i = start; i < end; i++) {
+        long long row = i / s->chunks;
+        int first = (i % s->chunks) * s->chunk_size;
+        int n = s->classes - first < s->chunk_size ? s->classes - first : s->chunk_size;
+        s->lse[i] = kernels.logsumexp(s->logits + row * s->classes + first, n);
+    }
+}
 
-    for (int i = 0; i < y_pred->size; i++) {
-        // Ensure that y_pred is bounded between a very small value and 1.
-        // a very small value to avoid log(0) which is undefined
-        float pred = y_pred->data[i];
-        if (pred < 1e-5) {
-            pred = 1e-5;
+/* Fill lse with the log-sum-exp of each row, combining the chunks of split rows */
+static void softmax_row_lse(SoftmaxChunks* s, float* lse) {
+    int grain = grain_size_for_cost((long long)s->chunk_size * COST_SOFTMAX);
+    s->lse = lse;
+    if (s->chunks > 1) {
+        s->lse = (float*)malloc((size_t)s->rows * s->chunks * sizeof(float));
+        if (!s->lse) {
+            fprintf(stderr, "Memory allocation failed when computing softmax cross entropy.\n");
+            exit(EXIT_FAILURE);
         }
-        if (pred > 1 - 1e-5) {
-            pred = 1 - 1e-5;
+    }
+    parallel_for(s->rows * s->chunks, grain, logsumexp_task, s);
+    if (s->chunks == 1) return;
+    for (long long row = 0; row < s->rows; row++) {
+        float* chunk_lse = s->lse + row * s->chunks;
+        float max = chunk_lse[0];
+        for (int c = 1; c < s->chunks; c++) max = chunk_lse[c] > max ? chunk_lse[c] : max;
+        float total = 0;
+        for (int c = 0; c < s->chunks; c++) total += expf(chunk_lse[c] - max);
+        lse[row] = max + logf(total);
+    }
+    free(s->lse);
+    s->lse = lse;
+}
+
+/* Log-sum-exp of every row of the logits, kept as a graph node so the backward of the
+   loss reuses it instead of passing over the logits again */
+void forward_row_logsumexp(Tensor* result) {
+    Tensor* logits = result->parents[0];
+    float* logit_data = contiguous_data(logits);
+    SoftmaxChunks s = softmax_chunks(logits, logit_data);
+    softmax_row_lse(&s, result->data);
+    release_contiguous_data(logits, logit_data);
+}
+
+static void softmax_backward_task(void* ctx, long long start, long long end) {
+    SoftmaxChunks* s = (SoftmaxChunks*)ctx;
+    for (long long i = start; i < end; i++) {
+        long long row = i / s->chunks;
+        int first = (i % s->chunks) * s->chunk_size;
+        int n = s->classes - first < s->chunk_size ? s->classes - first : s->chunk_size;
+        long long offset = row * s->classes + first;
+        kernels.softmax_cross_entropy_backward(s->logits + offset, s->lse[row], (int)s->labels[row] - first,
+                                               s->scale, s->grad + offset, n);
+    }
+}
+
+/* Only the one fused pass per row, the row log-sum-exps come from the forward */
+void backward_softmax_cross_entropy(Tensor* result) {
+    Tensor* logits = result->parents[0];
+    Tensor* labels = result->parents[1];
+    Tensor* lse = result->parents[2];
+
+    float* logit_data = contiguous_data(logits);
+    float* label_data = contiguous_data(labels);
+    float* logit_grad = contiguous_grad(logits);
+    SoftmaxChunks s = softmax_chunks(logits, logit_data);
+    s.labels = label_data;
+    s.lse = lse->data;
+
+    // d/dz of the mean loss is (softmax(z) - one_hot(label)) / rows
+    s.grad = logit_grad;
+    s.scale = result->grad[0] / s.rows;
+    int grain = grain_size_for_cost((long long)s.chunk_size * COST_SOFTMAX);
+    parallel_for(s.rows * s.chunks, grain, softmax_backward_task, &s);
+
+    release_contiguous_data(logits, logit_data);
+    release_contiguous_data(labels, label_data);
+    commit_contiguous_grad(logits, logit_grad);
+}
+
+void forward_softmax_cross_entropy(Tensor* result) {
+    Tensor* logits = result->parents[0];
+    Tensor* labels = result->parents[1];
+    Tensor* lse = result->parents[2];
+    int classes = logits->shape[logits->num_dims-1];
+
+    float* logit_data = contiguous_data(logits);
+    float* label_data = contiguous_data(labels);
+    float* row_loss = (float*)malloc((size_t)labels->size * sizeof(float));
+    if (!row_loss) {
+        fprintf(stderr, "Memory allocation failed when computing softmax cross entropy.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // -log(softmax(z)[label]) = lse - z[label]
+    for (long long row = 0; row < labels->size; row++) {
+        float label = label_data[row];
+        if (label < 0 || label >= classes || label != (int)label) {
+            printf("Label %f of row %lld is not a class index below %d!\n", label, row, classes);
+            exit(EXIT_FAILURE);
         }
+        row_loss[row] = lse->data[row] - logit_data[row * classes + (int)label];
+    }
+    // the same pairwise sum as reduce_sum
+    result->data[0] = parallel_sum(row_loss, labels->size) / labels->size;
+
+    free(row_loss);
+    release_contiguous_data(logits, logit_data);
+    release_contiguous_data(labels, label_data);
+}
 
-        // Compute the BCE loss for the current sample
-        loss[0] += -((y_true->data[i] * log(pred)) + ((1 - y_true->data[i]) * log(1 - pred)));
+/* Softmax cross entropy with mean reduction over the rows of logits. The last dim of
+   logits holds the classes and labels holds one class index per row, stored as a float,
+   so no one-hot targets are needed. The softmax is never formed: each row takes one
+   log-sum-exp kernel pass forward, kept for the backward, and one more pass backward for
+   softmax(z) - one_hot. */
+Tensor* softmax_cross_entropy(Tensor* logits, Tensor* labels) {
+    int classes = logits->shape[logits->num_dims-1];
+    if (classes < 1 || logits->size != labels->size * classes) {
+        printf("Logits must have a row of classes for every label!\n");
+        free_graph_from_tensor(logits);
+        free_tensor(labels);
+        exit(EXIT_FAILURE);
     }
-    loss[0] /= y_pred->size;
+
+    // no backward, the loss backward writes the grads of the logits itself
+    Tensor* lse = create_op_result(logits->shape, logits->num_dims-1, &logits, 1, NULL);
+    lse->forward_func = forward_row_logsumexp;
+    forward_row_logsumexp(lse);
+
     int shape[1] = {1};
-    Tensor* loss_tensor = create_tensor(loss, shape, 1, y_pred->requires_grad);
-    loss_tensor->parents = (Tensor**)malloc(2 * sizeof(Tensor*));
-    loss_tensor->parents[0] = y_pred;
-    loss_tensor->parents[1] = y_true;
-    loss_tensor->num_parents = 2;
-    loss_tensor->backward_func = backward_binary_cross_entropy;
+    Tensor* parents[3] = {logits, labels, lse};
+    Tensor* loss_tensor = create_op_result(shape, 1, parents, 3, backward_softmax_cross_entropy);
+    loss_tensor->forward_func = forward_softmax_cross_entropy;
+    forward_softmax_cross_entropy(loss_tensor);
     return loss_tensor;
-}
\ No newline at end of file
+}
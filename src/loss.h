@@ -4,6 +4,14 @@
 #include "tensor.h"
 
 Tensor* binary_cross_entropy(Tensor* y_pred, Tensor* y_true);
+void forward_binary_cross_entropy(Tensor* result);
 void backward_binary_cross_entropy(Tensor* result);
+Tensor* binary_cross_entropy_with_logits(Tensor* logits, Tensor* y_true);
+void forward_binary_cross_entropy_with_logits(Tensor* result);
+void backward_binary_cross_entropy_with_logits(Tensor* result);
+Tensor* softmax_cross_entropy(Tensor* logits, Tensor* labels);
+void forward_row_logsumexp(Tensor* result);
+void forward_softmax_cross_entropy(Tensor* result);
+void backward_softmax_cross_entropy(Tensor* result);
 
 #endif // LOSS_H
\ No newline at end of file
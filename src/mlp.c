@@ -1,71 +1,175 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "utility.h"
 #include "./tensor.h"
 #include "mlp.h"
 #include "tensor_ops.h"
+#include "gemm.h"
+#include "kernels.h"
+
+// Parameter tensors in a flat buffer start on 64 byte boundaries
+#define PARAM_ALIGNMENT 16
+
+static DenseLayer* new_dense_layer(Tensor* weights, Tensor* biases, int in_features, int out_features, Activation activation_type) {
+    DenseLayer* new_layer = (DenseLayer*)malloc(sizeof(DenseLayer));
+    if (!new_layer) {
+        fprintf(stderr, "Memory allocation failed when allocating a dense layer.\n");
+        exit(EXIT_FAILURE);
+    }
+    new_layer->weights = weights;
+    new_layer->biases = biases;
+    new_layer->activation_func = get_activation_func(activation_type);
+    new_layer->activation = activation_type;
+    new_layer->in_features = in_features;
+    new_layer->out_features = out_features;
+    return new_layer;
+}
 
 /* Create a dense layer with optional activation function.
-   Supported activation functions: relu, sigmoid, NULL */
+   Supported activation functions: relu, sigmoid, tanh, gelu, silu, NULL */
 DenseLayer* create_dense_layer(int in_features, int out_features, char activation[]) {
-    DenseLayer* new_layer = (DenseLayer*)malloc(sizeof(DenseLayer));
-    ActivationFuncPointer activation_func = get_activation_func_from_str(activation);
-    
     // init weights, randomly sample values between -1 and 1 with uniform probability
     float *weight_data = uniform_random_array(in_features * out_features, -1, 1);
     int weight_shape[] = {in_features, out_features};
     Tensor* weights = create_tensor(weight_data, weight_shape, 2, 1);
+    free(weight_data);
 
-    float bias_data[out_features];
     // Initialize all bias values to zero
-    memset(bias_data, 0, out_features * sizeof(float));
+    float* bias_data = (float*)calloc(out_features, sizeof(float));
+    if (!bias_data) {
+        fprintf(stderr, "Memory allocation failed when allocating layer biases.\n");
+        exit(EXIT_FAILURE);
+    }
     int bias_shape[] = {out_features};
     Tensor* biases = create_tensor(bias_data, bias_shape, 1, 1);
+    free(bias_data);
 
-    new_layer->weights = weights;
-    new_layer->biases = biases;
-    new_layer->activation_func = activation_func;
-    new_layer->in_features = in_features;
-    new_layer->out_features = out_features;
-    
-    return new_layer;
+    return new_dense_layer(weights, biases, in_features, out_features, get_activation_from_str(activation));
 }
 
-Tensor* forward_dense(Tensor* input, DenseLayer* layer) {
-    Tensor *matmul_output = matmul(input, layer->weights);
-    Tensor *bias_output = add(matmul_output, layer->biases);
-    if (layer->activation_func) {
-        Tensor *output = layer->activation_func(bias_output);
-        return output;
-    }
-    else {
-        return bias_output;
+/* Number of floats a tensor of the given size takes up in a flat parameter buffer */
+static long long padded_param_size(long long size) {
+    return (size + PARAM_ALIGNMENT - 1) / PARAM_ALIGNMENT * PARAM_ALIGNMENT;
+}
+
+/* Floats a dense layer takes up in a flat parameter buffer */
+long long dense_layer_param_size(int in_features, int out_features) {
+    return padded_param_size((long long)in_features * out_features) + padded_param_size(out_features);
+}
+
+/* Create a dense layer whose weights and then biases are stored at the start of data and
+   their grads at the start of grad. The layer doesn't own either buffer, which must hold
+   dense_layer_param_size() floats. Initialised the same way as create_dense_layer(). */
+DenseLayer* create_dense_layer_in_buffers(int in_features, int out_features, char activation[], float* data, float* grad) {
+    int weight_shape[] = {in_features, out_features};
+    int bias_shape[] = {out_features};
+    long long bias_offset = padded_param_size((long long)in_features * out_features);
+    Tensor* weights = create_tensor_from_buffers(data, grad, weight_shape, 2);
+    Tensor* biases = create_tensor_from_buffers(data + bias_offset, grad + bias_offset, bias_shape, 1);
+
+    for (long long i = 0; i < weights->size; i++) {
+        weights->data[i] = generate_uniform_random_float(-1, 1);
     }
+    memset(biases->data, 0, biases->size * sizeof(float));
+
+    return new_dense_layer(weights, biases, in_features, out_features, get_activation_from_str(activation));
 }
 
-LayerList* create_mlp(int in_features, int* layer_sizes, int n_layers) {
-    LayerList* mlp = (LayerList*)malloc(n_layers * sizeof(LayerList));
+/* Matmul, bias and activation run as one fused op with a single result tensor */
+Tensor* forward_dense(Tensor* input, DenseLayer* layer) {
+    return dense(input, layer->weights, layer->biases, layer->activation);
+}
+
+static LayerList* alloc_layer_list(int n_layers) {
+    LayerList* mlp = (LayerList*)malloc(sizeof(LayerList));
     DenseLayer** layers = (DenseLayer**)malloc(n_layers * sizeof(DenseLayer*));
+    if (!mlp || !layers) {
+        fprintf(stderr, "Memory allocation failed when allocating an mlp.\n");
+        exit(EXIT_FAILURE);
+    }
     mlp->layers = layers;
     mlp->num_layers = n_layers;
-    
-    if (n_layers == 1) {
-        mlp->layers[0] = create_dense_layer(in_features, layer_sizes[0], NULL);
-        return mlp;
+    mlp->param_data = NULL;
+    mlp->param_grad = NULL;
+    mlp->param_size = 0;
+    mlp->mapping = NULL;
+    mlp->mapping_size = 0;
+    return mlp;
+}
+
+/* Activation of layer i of an mlp: hidden layers use relu and the output layer
+   output_activation */
+static char* mlp_layer_activation(int i, int n_layers, char output_activation[]) {
+    return i == n_layers-1 ? output_activation : "relu";
+}
+
+/* Create an mlp of relu layers. output_activation is applied to the last layer, "sigmoid"
+   for binary_cross_entropy() or NULL to output the logits for
+   binary_cross_entropy_with_logits(), or for softmax_cross_entropy() with one output
+   per class. */
+LayerList* create_mlp(int in_features, int* layer_sizes, int n_layers, char output_activation[]) {
+    LayerList* mlp = alloc_layer_list(n_layers);
+    for (int i = 0; i < n_layers; i++) {
+        int layer_in = i == 0 ? in_features : layer_sizes[i-1];
+        mlp->layers[i] = create_dense_layer(layer_in, layer_sizes[i], mlp_layer_activation(i, n_layers, output_activation));
     }
+    return mlp;
+}
 
-    // input layer
-    mlp->layers[0] = create_dense_layer(in_features, layer_sizes[0], "relu");
+static float* alloc_param_buffer(size_t n) {
+    void* buffer = NULL;
+    size_t size = n * sizeof(float);
+#ifdef _WIN32
+    buffer = _aligned_malloc(size, PARAM_ALIGNMENT * sizeof(float));
+#else
+    if (posix_memalign(&buffer, PARAM_ALIGNMENT * sizeof(float), size) != 0) buffer = NULL;
+#endif
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed when allocating the parameter buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 0, size);
+    return (float*)buffer;
+}
 
-    // hidden layers
-    for (int i=0; i < n_layers-2; i++) {
-        mlp->layers[i+1] = create_dense_layer(layer_sizes[i], layer_sizes[i+1], "relu");
+static void free_param_buffer(float* buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+/* Same as create_mlp() but every weight and bias is a slice of one aligned buffer,
+   param_data, and every grad a slice of a second one, param_grad. Optimizers can
+   sweep all parameters at once and the grads are zeroed with a single memset. */
+LayerList* create_mlp_flat(int in_features, int* layer_sizes, int n_layers, char output_activation[]) {
+    LayerList* mlp = alloc_layer_list(n_layers);
+    for (int i = 0; i < n_layers; i++) {
+        int layer_in = i == 0 ? in_features : layer_sizes[i-1];
+        mlp->param_size += dense_layer_param_size(layer_in, layer_sizes[i]);
+    }
+    mlp->param_data = alloc_param_buffer(mlp->param_size);
+    mlp->param_grad = alloc_param_buffer(mlp->param_size);
+
+    long long offset = 0;
+    for (int i = 0; i < n_layers; i++) {
+        int layer_in = i == 0 ? in_features : layer_sizes[i-1];
+        mlp->layers[i] = create_dense_layer_in_buffers(layer_in, layer_sizes[i], mlp_layer_activation(i, n_layers, output_activation),
+                                                      mlp->param_data + offset, mlp->param_grad + offset);
+        offset += dense_layer_param_size(layer_in, layer_sizes[i]);
     }
-    // output layer
-    mlp->layers[n_layers-1] = create_dense_layer(layer_sizes[n_layers-2], layer_sizes[n_layers-1], "sigmoid");
-    
     return mlp;
 }
 
@@ -77,11 +181,492 @@ Tensor* forward_layers(Tensor* input, LayerList* layers) {
     return x;
 }
 
+/* Run the layers without building an autograd graph, for scoring and evaluation.
+   Activations go back and forth between two buffers sized for the widest layer, so no
+   grads, parents or intermediate tensors are allocated. The input is read as rows of
+   its last dim. Returns a tensor without grads that the caller frees. */
+Tensor* forward_layers_inference(Tensor* input, LayerList* layers) {
+    int in_features = input->shape[input->num_dims-1];
+    if (layers->num_layers == 0 || in_features != layers->layers[0]->in_features) {
+        printf("Input with %d features does not match the first layer!\n", in_features);
+        exit(EXIT_FAILURE);
+    }
+    long long rows = input->size / in_features;
+    int max_features = 0;
+    for (int i = 0; i < layers->num_layers; i++) {
+        if (layers->layers[i]->out_features > max_features) {
+            max_features = layers->layers[i]->out_features;
+        }
+    }
+
+    float* buffers[2];
+    for (int i = 0; i < 2; i++) {
+        buffers[i] = (float*)malloc((size_t)rows * max_features * sizeof(float));
+        if (!buffers[i]) {
+            fprintf(stderr, "Memory allocation failed when allocating inference buffers.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    float* input_data = contiguous_data(input);
+    const float* x = input_data;
+    float* out = NULL;
+    for (int i = 0; i < layers->num_layers; i++) {
+        DenseLayer* layer = layers->layers[i];
+        Tensor* w = layer->weights;
+        out = buffers[i % 2];
+        ActivationKernel activation = get_activation_kernel(layer->activation);
+
+        float* bias_data = contiguous_data(layer->biases);
+        gemm_bias_activation(rows, layer->out_features, layer->in_features, x, layer->in_features, 1,
+                             w->data, w->strides[0], w->strides[1], out, layer->out_features, 0,
+                             bias_data, activation);
+        release_contiguous_data(layer->biases, bias_data);
+        x = out;
+    }
+    release_contiguous_data(input, input_data);
+
+    // The last output becomes the result, the other buffer is done with
+    int out_features = layers->layers[layers->num_layers-1]->out_features;
+    free(out == buffers[0] ? buffers[1] : buffers[0]);
+    float* result_data = (float*)realloc(out, (size_t)rows * out_features * sizeof(float));
+    if (result_data) out = result_data;
+
+    int* shape = (int*)malloc(input->num_dims * sizeof(int));
+    if (!shape) {
+        fprintf(stderr, "Memory allocation failed when allocating inference buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < input->num_dims; i++) {
+        shape[i] = input->shape[i];
+    }
+    shape[input->num_dims-1] = out_features;
+    Tensor* result = create_tensor_from_buffer(out, shape, input->num_dims);
+    result->owns_data = 1; // hand the buffer over so free_tensor releases it
+    free(shape);
+    return result;
+}
+
+/* Collect the weights and biases of every layer. The list refers to the tensors of the
+   layers, so free it before them with free_param_list(). */
+ParamList* mlp_parameters(LayerList* layers) {
+    ParamList* params = (ParamList*)malloc(sizeof(ParamList));
+    if (params) params->params = (Tensor**)malloc(2 * layers->num_layers * sizeof(Tensor*));
+    if (!params || !params->params) {
+        fprintf(stderr, "Memory allocation failed when collecting the mlp parameters.\n");
+        exit(EXIT_FAILURE);
+    }
+    params->num_params = 0;
+    for (int i = 0; i < layers->num_layers; i++) {
+        params->params[params->num_params++] = layers->layers[i]->weights;
+        params->params[params->num_params++] = layers->layers[i]->biases;
+    }
+    params->flat_data = layers->param_data;
+    params->flat_grad = layers->param_grad;
+    params->flat_size = layers->param_size;
+    return params;
+}
+
+void free_param_list(ParamList* params) {
+    if (params) {
+        free(params->params);
+        free(params);
+    }
+}
+
+/* Floats the parameters of the layers take up in the layout of a flat parameter buffer */
+static long long mlp_param_size(LayerList* layers) {
+    long long size = 0;
+    for (int i = 0; i < layers->num_layers; i++) {
+        size += dense_layer_param_size(layers->layers[i]->in_features, layers->layers[i]->out_features);
+    }
+    return size;
+}
+
+/* Copy the weights and biases of the layers into params, laid out like a flat parameter
+   buffer. For a flat mlp that is a single memcpy. */
+static void copy_mlp_params(LayerList* layers, float* params) {
+    if (layers->param_data) {
+        memcpy(params, layers->param_data, (size_t)layers->param_size * sizeof(float));
+        return;
+    }
+    memset(params, 0, (size_t)mlp_param_size(layers) * sizeof(float));
+    for (int i = 0; i < layers->num_layers; i++) {
+        Tensor* tensors[2] = {layers->layers[i]->weights, layers->layers[i]->biases};
+        for (int j = 0; j < 2; j++) {
+            float* data = contiguous_data(tensors[j]);
+            memcpy(params, data, (size_t)tensors[j]->size * sizeof(float));
+            release_contiguous_data(tensors[j], data);
+            params += padded_param_size(tensors[j]->size);
+        }
+    }
+}
+
+/* Write a checkpoint of the layers to f. params holds their weights and biases in the
+   layout of copy_mlp_params(), the layers themselves only give the sizes and activations. */
+static void write_mlp_checkpoint(FILE* f, const char* file_name, LayerList* layers, const float* params) {
+    MlpCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MLP_CHECKPOINT_MAGIC, sizeof(MLP_CHECKPOINT_MAGIC));
+    header.version = MLP_CHECKPOINT_VERSION;
+    header.num_layers = layers->num_layers;
+    uint64_t table_end = sizeof(header) + (uint64_t)layers->num_layers * sizeof(MlpCheckpointLayer);
+    header.params_offset = (table_end + MLP_CHECKPOINT_ALIGNMENT - 1) / MLP_CHECKPOINT_ALIGNMENT * MLP_CHECKPOINT_ALIGNMENT;
+    size_t param_size = mlp_param_size(layers);
+    header.params_size = param_size * sizeof(float);
+
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t offset = header.params_offset;
+    for (int i = 0; i < layers->num_layers && ok; i++) {
+        DenseLayer* layer = layers->layers[i];
+        MlpCheckpointLayer record;
+        memset(&record, 0, sizeof(record));
+        record.in_features = layer->in_features;
+        record.out_features = layer->out_features;
+        record.activation = layer->activation;
+        record.weights_offset = offset;
+        record.biases_offset = offset + padded_param_size((long long)layer->in_features * layer->out_features) * sizeof(float);
+        offset += dense_layer_param_size(layer->in_features, layer->out_features) * sizeof(float);
+        ok = fwrite(&record, sizeof(record), 1, f) == 1;
+    }
+    static const char zeros[MLP_CHECKPOINT_ALIGNMENT];
+    size_t table_padding = header.params_offset - table_end;
+    if (!ok || fwrite(zeros, 1, table_padding, f) != table_padding ||
+        fwrite(params, sizeof(float), param_size, f) != param_size) {
+        printf("Error writing checkpoint file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Write the sizes, activations, weights and biases of the layers in the format described
+   by MlpCheckpointHeader. Grads and optimizer state are not saved. */
+void save_mlp(const char* file_name, LayerList* layers) {
+    FILE* f = fopen(file_name, "wb");
+    if (f == NULL) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    float* params = layers->param_data;
+    if (!params) {
+        params = alloc_param_buffer(mlp_param_size(layers));
+        copy_mlp_params(layers, params);
+    }
+    write_mlp_checkpoint(f, file_name, layers, params);
+    if (params != layers->param_data) free_param_buffer(params);
+    if (fclose(f) != 0) {
+        printf("Error writing checkpoint file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Map a checkpoint file read-only and shared. Without mmap the file is read into a
+   buffer instead, which only works for a copy of the weights. */
+static void* map_checkpoint(const char* file_name, size_t* size) {
+#ifdef _WIN32
+    FILE* f = fopen(file_name, "rb");
+    if (f == NULL) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    long long file_size = -1;
+    if (_fseeki64(f, 0, SEEK_END) == 0) file_size = _ftelli64(f);
+    if (file_size < (long long)sizeof(MlpCheckpointHeader) || _fseeki64(f, 0, SEEK_SET) != 0) {
+        printf("%s is not a checkpoint file!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    *size = (size_t)file_size;
+    void* mapping = malloc(*size);
+    if (!mapping) {
+        fprintf(stderr, "Memory allocation failed when reading checkpoint file %s.\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    if (fread(mapping, 1, *size, f) != *size) {
+        printf("Error reading checkpoint file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    return mapping;
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MlpCheckpointHeader)) {
+        printf("%s is not a checkpoint file!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    *size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        printf("Failed to map checkpoint file %s!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+    return mapping;
+#endif
+}
+
+static void unmap_checkpoint(void* mapping, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/* Load a checkpoint written by save_mlp(). With map_weights the file is mapped read-only
+   and shared, and the weights and biases point straight into it: nothing is read or
+   copied up front, and processes that load the same file share its pages in the page
+   cache. Such a model has no grads and is only for inference, writing to its weights
+   crashes. Mapping needs a POSIX system. Otherwise the parameters are copied into flat
+   buffers as in create_mlp_flat() and the model can be trained further. */
+LayerList* load_mlp(const char* file_name, int map_weights) {
+#ifdef _WIN32
+    if (map_weights) {
+        printf("Cannot map checkpoint file %s, map_weights needs a POSIX system!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+#endif
+    size_t size;
+    void* mapping = map_checkpoint(file_name, &size);
+
+    const MlpCheckpointHeader* header = (const MlpCheckpointHeader*)mapping;
+    if (memcmp(header->magic, MLP_CHECKPOINT_MAGIC, sizeof(MLP_CHECKPOINT_MAGIC)) != 0 ||
+        header->version != MLP_CHECKPOINT_VERSION) {
+        printf("%s is not a version %d checkpoint file!\n", file_name, MLP_CHECKPOINT_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    const MlpCheckpointLayer* records = (const MlpCheckpointLayer*)(header + 1);
+    int valid = header->num_layers > 0 && header->num_layers <= INT32_MAX / 2 &&
+                sizeof(*header) + (uint64_t)header->num_layers * sizeof(*records) <= header->params_offset &&
+                header->params_offset % MLP_CHECKPOINT_ALIGNMENT == 0 &&
+                header->params_size % MLP_CHECKPOINT_ALIGNMENT == 0 &&
+                header->params_size / sizeof(float) <= INT32_MAX &&
+                header->params_offset <= size && header->params_size <= size - header->params_offset;
+    uint64_t params_end = header->params_offset + header->params_size;
+    for (uint32_t i = 0; i < header->num_layers && valid; i++) {
+        const MlpCheckpointLayer* record = &records[i];
+        uint64_t weights_size = (uint64_t)record->in_features * record->out_features * sizeof(float);
+        valid = record->in_features > 0 && record->out_features > 0 &&
+                record->in_features <= INT32_MAX && record->out_features <= INT32_MAX &&
+                weights_size / sizeof(float) <= INT32_MAX &&
+                record->activation <= ACTIVATION_SILU &&
+                (i == 0 || record->in_features == records[i-1].out_features) &&
+                record->weights_offset % MLP_CHECKPOINT_ALIGNMENT == 0 &&
+                record->biases_offset % MLP_CHECKPOINT_ALIGNMENT == 0 &&
+                record->weights_offset >= header->params_offset && record->biases_offset >= header->params_offset &&
+                // compared against the space left so huge offsets can't wrap around
+                record->weights_offset <= params_end && weights_size <= params_end - record->weights_offset &&
+                record->biases_offset <= params_end &&
+                record->out_features * sizeof(float) <= params_end - record->biases_offset;
+    }
+    if (!valid) {
+        printf("Checkpoint file %s is truncated or has a corrupt header!\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    LayerList* mlp = alloc_layer_list(header->num_layers);
+    char* params = (char*)mapping + header->params_offset;
+    char* grads = NULL;
+    if (map_weights) {
+        mlp->mapping = mapping;
+        mlp->mapping_size = size;
+    } else {
+        mlp->param_size = (long long)(header->params_size / sizeof(float));
+        mlp->param_data = alloc_param_buffer(mlp->param_size);
+        mlp->param_grad = alloc_param_buffer(mlp->param_size);
+        memcpy(mlp->param_data, params, header->params_size);
+        params = (char*)mlp->param_data;
+        grads = (char*)mlp->param_grad;
+    }
+
+    for (int i = 0; i < mlp->num_layers; i++) {
+        const MlpCheckpointLayer* record = &records[i];
+        int in_features = record->in_features;
+        int out_features = record->out_features;
+        int weight_shape[] = {in_features, out_features};
+        int bias_shape[] = {out_features};
+        uint64_t weights_offset = record->weights_offset - header->params_offset;
+        uint64_t biases_offset = record->biases_offset - header->params_offset;
+        Tensor* weights = create_tensor_from_buffers((float*)(params + weights_offset),
+                                                     grads ? (float*)(grads + weights_offset) : NULL, weight_shape, 2);
+        Tensor* biases = create_tensor_from_buffers((float*)(params + biases_offset),
+                                                    grads ? (float*)(grads + biases_offset) : NULL, bias_shape, 1);
+        mlp->layers[i] = new_dense_layer(weights, biases, in_features, out_features, (Activation)record->activation);
+    }
+
+    if (!map_weights) unmap_checkpoint(mapping, size);
+    return mlp;
+}
+
+/* Flush a written file to disk */
+static int sync_file(FILE* f) {
+#ifdef _WIN32
+    return _commit(_fileno(f));
+#else
+    return fsync(fileno(f));
+#endif
+}
+
+/* Atomically rename from over to, replacing it. Windows needs MoveFileEx for that. */
+static int replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+    return rename(from, to);
+#endif
+}
+
+/* fsync the directory of a file so a rename into it is on disk too. Not needed on
+   Windows, where MoveFileEx writes the rename through. */
+static void sync_parent_directory(const char* file_name) {
+#ifdef _WIN32
+    (void)file_name;
+#else
+    const char* slash = strrchr(file_name, '/');
+    char* dir = strdup(slash ? file_name : ".");
+    if (!dir) return;
+    if (slash) dir[slash == file_name ? 1 : slash - file_name] = '\0';
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+#endif
+}
+
+/* Write a snapshot to the temporary file and atomically replace the checkpoint with it */
+static void write_snapshot(CheckpointWriter* writer, const float* params) {
+    FILE* f = fopen(writer->temp_file_name, "wb");
+    if (f == NULL) {
+        printf("Error opening file %s!\n", writer->temp_file_name);
+        exit(EXIT_FAILURE);
+    }
+    write_mlp_checkpoint(f, writer->temp_file_name, writer->layers, params);
+    if (fflush(f) != 0 || sync_file(f) != 0 || fclose(f) != 0 ||
+        replace_file(writer->temp_file_name, writer->file_name) != 0) {
+        printf("Error writing checkpoint file %s!\n", writer->file_name);
+        exit(EXIT_FAILURE);
+    }
+    sync_parent_directory(writer->file_name);
+}
+
+static void* checkpoint_writer_loop(void* arg) {
+    CheckpointWriter* writer = (CheckpointWriter*)arg;
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (writer->pending < 0 && !writer->shutting_down) {
+            pthread_cond_wait(&writer->snapshot_ready, &writer->lock);
+        }
+        // pending snapshots are still written when shutting down
+        if (writer->pending < 0) break;
+        writer->writing = writer->pending;
+        writer->pending = -1;
+        pthread_mutex_unlock(&writer->lock);
+
+        write_snapshot(writer, writer->snapshots[writer->writing]);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->written_step = writer->snapshot_steps[writer->writing];
+        writer->writing = -1;
+        pthread_cond_broadcast(&writer->snapshot_written);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* Create a writer that saves checkpoints of the layers to file_name on a background
+   thread. The layers must outlive the writer. */
+CheckpointWriter* create_checkpoint_writer(LayerList* layers, const char* file_name) {
+    CheckpointWriter* writer = (CheckpointWriter*)malloc(sizeof(CheckpointWriter));
+    size_t name_length = strlen(file_name);
+    if (writer) {
+        writer->file_name = strdup(file_name);
+        writer->temp_file_name = (char*)malloc(name_length + sizeof(".tmp"));
+    }
+    if (!writer || !writer->file_name || !writer->temp_file_name) {
+        fprintf(stderr, "Memory allocation failed when allocating a checkpoint writer.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(writer->temp_file_name, file_name, name_length);
+    memcpy(writer->temp_file_name + name_length, ".tmp", sizeof(".tmp"));
+    writer->layers = layers;
+    long long param_size = mlp_param_size(layers);
+    for (int i = 0; i < 2; i++) {
+        writer->snapshots[i] = alloc_param_buffer(param_size);
+        writer->snapshot_steps[i] = -1;
+    }
+    writer->pending = -1;
+    writer->writing = -1;
+    writer->written_step = -1;
+    writer->shutting_down = 0;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->snapshot_ready, NULL);
+    pthread_cond_init(&writer->snapshot_written, NULL);
+    if (pthread_create(&writer->thread, NULL, checkpoint_writer_loop, writer) != 0) {
+        fprintf(stderr, "Failed to start the checkpoint writer thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    return writer;
+}
+
+/* Snapshot the parameters at a step boundary, between optimizer updates, and return
+   while the thread writes them. For a flat mlp this costs one memcpy of param_data. */
+void checkpoint_mlp(CheckpointWriter* writer, int step) {
+    pthread_mutex_lock(&writer->lock);
+    // the buffer the thread isn't writing, taking it back if it was still pending
+    int snapshot = writer->writing == 0 ? 1 : 0;
+    if (writer->pending == snapshot) writer->pending = -1;
+    pthread_mutex_unlock(&writer->lock);
+
+    copy_mlp_params(writer->layers, writer->snapshots[snapshot]);
+    writer->snapshot_steps[snapshot] = step;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->pending = snapshot;
+    pthread_cond_signal(&writer->snapshot_ready);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/* Block until every snapshot taken so far is on disk */
+void wait_for_checkpoints(CheckpointWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending >= 0 || writer->writing >= 0) {
+        pthread_cond_wait(&writer->snapshot_written, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/* Write any pending snapshot, then stop the thread and free the writer */
+void free_checkpoint_writer(CheckpointWriter* writer) {
+    if (writer) {
+        pthread_mutex_lock(&writer->lock);
+        writer->shutting_down = 1;
+        pthread_cond_signal(&writer->snapshot_ready);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->snapshot_ready);
+        pthread_cond_destroy(&writer->snapshot_written);
+        for (int i = 0; i < 2; i++) {
+            free_param_buffer(writer->snapshots[i]);
+        }
+        free(writer->file_name);
+        free(writer->temp_file_name);
+        free(writer);
+    }
+}
+
 void free_dense(DenseLayer* layer) {
     if (layer) {
         free_tensor(layer->weights);
         free_tensor(layer->biases);
-        free(layer->activation_func);
         free(layer);
         layer = NULL;
     }
@@ -93,6 +678,10 @@ void free_layer_list(LayerList* layers) {
             free_dense(layers->layers[i]);
         }
 
+        free(layers->layers);
+        if (layers->param_data) free_param_buffer(layers->param_data);
+        if (layers->param_grad) free_param_buffer(layers->param_grad);
+        if (layers->mapping) unmap_checkpoint(layers->mapping, layers->mapping_size);
         free(layers);
         layers = NULL;
     }
@@ -1,7 +1,12 @@
 #ifndef MLP_H
 #define MLP_H
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "./tensor.h"
+#include "./tensor_ops.h"
 
 // Type of a pointer to an activation function
 typedef Tensor* (*ActivationFuncPointer)(Tensor*);
@@ -10,6 +15,7 @@ typedef struct {
     Tensor *weights;
     Tensor *biases;
     ActivationFuncPointer activation_func;
+    Activation activation;
     int in_features;
     int out_features;
 } DenseLayer;
@@ -17,14 +23,95 @@ typedef struct {
 typedef struct {
     DenseLayer** layers;
     int num_layers;
+    // Set by create_mlp_flat(), the buffers that all weights and biases and their grads
+    // are slices of. param_size includes the padding that aligns each tensor.
+    float* param_data;
+    float* param_grad;
+    long long param_size;
+    // Set by load_mlp() when the weights point into a mapped checkpoint file
+    void* mapping;
+    size_t mapping_size;
 } LayerList;
 
+// The tensors an optimizer updates. When they are slices of one flat buffer, flat_data
+// and flat_grad point at it so the whole buffer can be swept at once, else they are NULL.
+typedef struct {
+    Tensor** params;
+    int num_params;
+    float* flat_data;
+    float* flat_grad;
+    long long flat_size;
+} ParamList;
+
+#define MLP_CHECKPOINT_MAGIC "MLPCKPT"
+#define MLP_CHECKPOINT_VERSION 1
+// Weight and bias blobs of a checkpoint start on multiples of this many bytes
+#define MLP_CHECKPOINT_ALIGNMENT 64
+
+/* Header at the start of a model checkpoint. It is followed by num_layers
+   MlpCheckpointLayer records and then the float32 weights and biases of every layer,
+   params_size bytes starting at params_offset laid out like the param_data of
+   create_mlp_flat(). Values are little endian. */
+typedef struct MlpCheckpointHeader {
+    char magic[8]; // MLP_CHECKPOINT_MAGIC
+    uint32_t version;
+    uint32_t num_layers;
+    uint64_t params_offset;
+    uint64_t params_size;
+    uint8_t reserved[32]; // pads the header to MLP_CHECKPOINT_ALIGNMENT bytes
+} MlpCheckpointHeader;
+
+/* One layer of a checkpoint. The weights are a row-major [in_features, out_features]
+   array and the offsets are in bytes from the start of the file, multiples of
+   MLP_CHECKPOINT_ALIGNMENT. */
+typedef struct MlpCheckpointLayer {
+    uint32_t in_features;
+    uint32_t out_features;
+    uint32_t activation; // an Activation
+    uint32_t reserved;
+    uint64_t weights_offset;
+    uint64_t biases_offset;
+} MlpCheckpointLayer;
+
+/* Saves checkpoints of an mlp without stalling training. checkpoint_mlp() copies the
+   parameters into whichever of two snapshot buffers is not being written and returns, a
+   background thread then writes the snapshot to a temporary file, fsyncs it and renames
+   it over the checkpoint, so the file always holds a complete checkpoint. A snapshot that
+   is still waiting when the next one is taken is replaced by it. */
+typedef struct CheckpointWriter {
+    LayerList* layers; // only the sizes and activations are read by the thread
+    char* file_name;
+    char* temp_file_name;
+    float* snapshots[2];
+    int snapshot_steps[2];
+    int pending; // snapshot waiting to be written, -1 if none
+    int writing; // snapshot the thread is writing, -1 if none
+    int written_step; // step of the last checkpoint on disk, -1 before the first
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t snapshot_ready;
+    pthread_cond_t snapshot_written;
+    int shutting_down;
+} CheckpointWriter;
+
 DenseLayer* create_dense_layer(int in_features, int out_features, char activation[]);
+DenseLayer* create_dense_layer_in_buffers(int in_features, int out_features, char activation[], float* data, float* grad);
+long long dense_layer_param_size(int in_features, int out_features);
 Tensor* forward_dense(Tensor* input, DenseLayer* layer);
-LayerList* create_mlp(int in_features, int* layer_sizes, int n_layers);
+LayerList* create_mlp(int in_features, int* layer_sizes, int n_layers, char output_activation[]);
+LayerList* create_mlp_flat(int in_features, int* layer_sizes, int n_layers, char output_activation[]);
 Tensor* forward_layers(Tensor* input, LayerList* layers);
+Tensor* forward_layers_inference(Tensor* input, LayerList* layers);
+ParamList* mlp_parameters(LayerList* layers);
+void save_mlp(const char* file_name, LayerList* layers);
+LayerList* load_mlp(const char* file_name, int map_weights);
+CheckpointWriter* create_checkpoint_writer(LayerList* layers, const char* file_name);
+void checkpoint_mlp(CheckpointWriter* writer, int step);
+void wait_for_checkpoints(CheckpointWriter* writer);
+void free_checkpoint_writer(CheckpointWriter* writer);
 void free_dense(DenseLayer* layer);
 void free_layer_list(LayerList* layers);
+void free_param_list(ParamList* params);
 
 
 #endif // MLP_H
\ No newline at end of file
@@ -1,16 +1,44 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "optimizer.h"
 #include "tensor.h"
+#include "kernels.h"
+#include "thread_pool.h"
 
-void sgd_update(Topo* topo, float lr) {
-    // -1 from length to not change loss
-    for (int i=0; i < topo->length-1; i++) {
-        for (int j=0; j < topo->ordering[i]->size; j++) {
-            if (topo->ordering[i]->requires_grad) {
-                topo->ordering[i]->data[j] -= topo->ordering[i]->grad[j] * lr;
-            }
+// Roughly the flops per element of an Adam step, sqrt and division included
+#define ADAM_COST 20
+
+/* Reset the grads of the parameters before accumulating a new batch. Only the
+   parameters are touched, flat parameters are cleared with one memset of the buffer. */
+void zero_grad(ParamList* params) {
+    if (params->flat_grad) {
+        memset(params->flat_grad, 0, params->flat_size * sizeof(float));
+        return;
+    }
+    for (int i = 0; i < params->num_params; i++) {
+        Tensor* param = params->params[i];
+        memset(param->grad, 0, param->size * sizeof(float));
+    }
+}
+
+/* Step each parameter against its grad. Flat parameters are updated in one sweep over
+   the whole buffer, the padding between tensors has zero grads so it stays unchanged. */
+void sgd_update(ParamList* params, float lr) {
+    if (params->flat_data) {
+        float* data = params->flat_data;
+        const float* grad = params->flat_grad;
+        for (long long j = 0; j < params->flat_size; j++) {
+            data[j] -= grad[j] * lr;
+        }
+        return;
+    }
+    for (int i = 0; i < params->num_params; i++) {
+        Tensor* param = params->params[i];
+        for (long long j = 0; j < param->size; j++) {
+            param->data[j] -= param->grad[j] * lr;
         }
     }
 }
@@ -24,4 +52,108 @@ SGD* init_sgd(float lr) {
     optim->lr = lr;
     optim->update = sgd_update;
     return optim;
-}
\ No newline at end of file
+}
+
+// Range of one parameter buffer and its moments handed to the threads
+typedef struct AdamTask {
+    float* param;
+    const float* grad;
+    float* m;
+    float* v;
+    const AdamStep* step;
+} AdamTask;
+
+static void adam_task(void* ctx, long long start, long long end) {
+    AdamTask* task = (AdamTask*)ctx;
+    kernels.adam(task->param + start, task->grad + start, task->m + start, task->v + start, end - start, task->step);
+}
+
+static void adam_sweep(float* param, const float* grad, float* m, float* v, long long n, const AdamStep* step) {
+    AdamTask task = {param, grad, m, v, step};
+    parallel_for(n, grain_size_for_cost(ADAM_COST), adam_task, &task);
+}
+
+/* One Adam step over every parameter. Each element is read and written once by a fused
+   kernel, and large models are split across threads. The moments are allocated on the
+   first step to match the parameters. */
+void adam_update(Adam* optim, ParamList* params, float lr) {
+    long long size = params->flat_data ? params->flat_size : 0;
+    if (!params->flat_data) {
+        for (int i = 0; i < params->num_params; i++) {
+            size += params->params[i]->size;
+        }
+    }
+    if (!optim->m) {
+        optim->m = (float*)calloc(size, sizeof(float));
+        optim->v = (float*)calloc(size, sizeof(float));
+        if (!optim->m || !optim->v) {
+            printf("Memory allocation failed when allocating memory for the Adam moments.\n");
+            exit(EXIT_FAILURE);
+        }
+        optim->size = size;
+    } else if (optim->size != size) {
+        printf("Adam was created for %lld parameters but got %lld!\n", optim->size, size);
+        exit(EXIT_FAILURE);
+    }
+
+    optim->lr = lr;
+    optim->step++;
+    AdamStep step;
+    step.beta1 = optim->beta1;
+    step.beta2 = optim->beta2;
+    step.eps = optim->eps;
+    step.l2 = optim->decoupled_weight_decay ? 0 : optim->weight_decay;
+    step.decay = optim->decoupled_weight_decay ? 1 - lr * optim->weight_decay : 1;
+    step.step_size = lr / (1 - powf(optim->beta1, optim->step));
+    step.inv_sqrt_bias_correction2 = 1 / sqrtf(1 - powf(optim->beta2, optim->step));
+
+    if (params->flat_data) {
+        adam_sweep(params->flat_data, params->flat_grad, optim->m, optim->v, size, &step);
+        return;
+    }
+    long long offset = 0;
+    for (int i = 0; i < params->num_params; i++) {
+        Tensor* param = params->params[i];
+        adam_sweep(param->data, param->grad, optim->m + offset, optim->v + offset, param->size, &step);
+        offset += param->size;
+    }
+}
+
+static Adam* create_adam(float lr, float beta1, float beta2, float eps, float weight_decay, int decoupled) {
+    Adam* optim = (Adam*)malloc(sizeof(Adam));
+    if (!optim) {
+        printf("Memory allocation failed when allocating memory for Adam optimizer.\n");
+        exit(EXIT_FAILURE);
+    }
+    optim->lr = lr;
+    optim->beta1 = beta1;
+    optim->beta2 = beta2;
+    optim->eps = eps;
+    optim->weight_decay = weight_decay;
+    optim->decoupled_weight_decay = decoupled;
+    optim->step = 0;
+    optim->m = NULL;
+    optim->v = NULL;
+    optim->size = 0;
+    optim->update = adam_update;
+    return optim;
+}
+
+/* Adam, weight_decay is added to the grads as an L2 penalty. Usual values are
+   beta1 = 0.9, beta2 = 0.999 and eps = 1e-8. */
+Adam* init_adam(float lr, float beta1, float beta2, float eps, float weight_decay) {
+    return create_adam(lr, beta1, beta2, eps, weight_decay, 0);
+}
+
+/* AdamW, the params are decayed by lr * weight_decay separately from the Adam step */
+Adam* init_adamw(float lr, float beta1, float beta2, float eps, float weight_decay) {
+    return create_adam(lr, beta1, beta2, eps, weight_decay, 1);
+}
+
+void free_adam(Adam* optim) {
+    if (optim) {
+        free(optim->m);
+        free(optim->v);
+        free(optim);
+    }
+}
@@ -2,15 +2,34 @@
 #define OPTIMIZER_H
 
 #include "tensor.h"
-#include "backward.h"
+#include "mlp.h"
 
 typedef struct SGD {
     float lr;
-    // points to a function that takes a pointer to a Tensor struct as its argument.
-    void (*update)(struct Topo* topo, float lr); 
+    // points to a function that updates the given parameters with their grads
+    void (*update)(ParamList* params, float lr); 
 } SGD;
 
+typedef struct Adam {
+    float lr;
+    float beta1;
+    float beta2;
+    float eps;
+    float weight_decay;
+    int decoupled_weight_decay; // AdamW decays the params directly instead of adding to the grad
+    int step;
+    // first and second moments of every parameter, laid out like the flat parameter buffer
+    // or the parameters one after another
+    float* m;
+    float* v;
+    long long size;
+    void (*update)(struct Adam* optim, ParamList* params, float lr);
+} Adam;
 
+void zero_grad(ParamList* params);
 SGD* init_sgd(float lr);
+Adam* init_adam(float lr, float beta1, float beta2, float eps, float weight_decay);
+Adam* init_adamw(float lr, float beta1, float beta2, float eps, float weight_decay);
+void free_adam(Adam* optim);
 
 #endif // OPTIMIZER_H
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reduce.h"
+#include "kernels.h"
+#include "thread_pool.h"
+
+// -1 until read from the environment
+static int deterministic_reductions = -1;
+
+/* In deterministic mode parallel sums split their input into the same blocks and add
+   them up in the same order whatever the number of threads, so results are bitwise
+   reproducible across thread counts on the same kernels. Otherwise each thread reduces
+   one range, which saves writing a partial sum per block. MLP_DETERMINISTIC=1 turns it
+   on at startup. */
+void set_deterministic_reductions(int deterministic) {
+    deterministic_reductions = deterministic ? 1 : 0;
+}
+
+int get_deterministic_reductions(void) {
+    if (deterministic_reductions < 0) {
+        const char* env = getenv("MLP_DETERMINISTIC");
+        deterministic_reductions = env && strcmp(env, "0") != 0 && env[0] != '\0';
+    }
+    return deterministic_reductions;
+}
+
+/* Sum the partial sums [start, end) by halving the range, the same tree pairwise_blocks
+   builds over the blocks they came from */
+static float sum_partials(const float* partials, long long start, long long end) {
+    if (end - start == 1) return partials[start];
+    long long mid = start + (end - start) / 2;
+    return sum_partials(partials, start, mid) + sum_partials(partials, mid, end);
+}
+
+/* Sum the values [start, start + n) of a sequence given by func block by block, halving
+   the range at a block boundary until it fits in one block */
+static float pairwise_blocks(BlockSumFunc func, void* ctx, void* scratch, long long start, long long n) {
+    if (n <= REDUCE_BLOCK_SIZE) return func(ctx, scratch, start, (int)n);
+    long long blocks = (n + REDUCE_BLOCK_SIZE - 1) / REDUCE_BLOCK_SIZE;
+    long long half = (blocks / 2) * REDUCE_BLOCK_SIZE;
+    return pairwise_blocks(func, ctx, scratch, start, half) + pairwise_blocks(func, ctx, scratch, start + half, n - half);
+}
+
+static float sum_block(void* ctx, void* scratch, long long start, int n) {
+    (void)scratch;
+    return kernels.sum((const float*)ctx + start, n);
+}
+
+static void* alloc_scratch(size_t size) {
+    if (size == 0) return NULL;
+    void* scratch = malloc(size);
+    if (!scratch) {
+        fprintf(stderr, "Memory allocation failed when allocating the scratch of a block sum.\n");
+        exit(EXIT_FAILURE);
+    }
+    return scratch;
+}
+
+/* Sum of x with pairwise summation over blocks of REDUCE_BLOCK_SIZE: the rounding
+   error grows with the log of the number of blocks instead of with n, and each block
+   is summed by several independent SIMD accumulators. */
+float pairwise_sum(const float* x, long long n) {
+    if (n <= REDUCE_BLOCK_SIZE) return kernels.sum(x, n);
+    return pairwise_blocks(sum_block, (void*)x, NULL, 0, n);
+}
+
+typedef struct SumTask {
+    BlockSumFunc func;
+    void* ctx;
+    size_t scratch_size;
+    long long n;
+    long long piece_size; // a multiple of REDUCE_BLOCK_SIZE
+    float* partials;
+} SumTask;
+
+static void sum_pieces_task(void* ctx, long long start, long long end) {
+    SumTask* task = (SumTask*)ctx;
+    void* scratch = alloc_scratch(task->scratch_size);
+    for (long long i = start; i < end; i++) {
+        long long offset = i * task->piece_size;
+        long long size = task->n - offset < task->piece_size ? task->n - offset : task->piece_size;
+        task->partials[i] = pairwise_blocks(task->func, task->ctx, scratch, offset, size);
+    }
+    free(scratch);
+}
+
+/* Pairwise sum of the n values of a sequence given block by block by func, split across
+   threads. The values are cut into pieces that are summed in parallel, then the partial
+   sums are added pairwise. Each piece gets its own scratch_size byte scratch buffer for
+   func. The pieces only depend on n and the number of threads, not on the work func
+   does per value, so values computed on the fly add up in the same tree as
+   parallel_sum() of the stored values. In deterministic mode every piece is one block,
+   so the result is the same as summing the values with one thread for any number of
+   threads. */
+float parallel_block_sum(long long n, size_t scratch_size, BlockSumFunc func, void* ctx) {
+    long long blocks = (n + REDUCE_BLOCK_SIZE - 1) / REDUCE_BLOCK_SIZE;
+    int grain = grain_size_for_cost(REDUCE_BLOCK_SIZE);
+    int threads = get_num_threads();
+    if (blocks <= grain || (threads == 1 && !get_deterministic_reductions())) {
+        void* scratch = alloc_scratch(scratch_size);
+        float total = pairwise_blocks(func, ctx, scratch, 0, n);
+        free(scratch);
+        return total;
+    }
+
+    long long pieces = blocks;
+    if (!get_deterministic_reductions()) {
+        // one piece per thread, each at least grain blocks
+        pieces = blocks / grain < threads ? blocks / grain : threads;
+    }
+    long long piece_blocks = (blocks + pieces - 1) / pieces;
+    pieces = (blocks + piece_blocks - 1) / piece_blocks;
+
+    float stack_partials[64];
+    float* partials = pieces <= 64 ? stack_partials : (float*)malloc(pieces * sizeof(float));
+    if (!partials) {
+        fprintf(stderr, "Memory allocation failed when allocating the partial sums.\n");
+        exit(EXIT_FAILURE);
+    }
+    SumTask task = {func, ctx, scratch_size, n, piece_blocks * REDUCE_BLOCK_SIZE, partials};
+    parallel_for(pieces, pieces == blocks ? grain : 1, sum_pieces_task, &task);
+    float total = sum_partials(partials, 0, pieces);
+
+    if (partials != stack_partials) free(partials);
+    return total;
+}
+
+/* pairwise_sum split across threads, see parallel_block_sum */
+float parallel_sum(const float* x, long long n) {
+    return parallel_block_sum(n, 0, sum_block, (void*)x);
+}
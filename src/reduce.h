@@ -0,0 +1,20 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stddef.h>
+
+// Elements summed by one leaf of the pairwise tree, with the SIMD accumulators of
+// kernels.sum. The tree above the leaves only adds the partial sums.
+#define REDUCE_BLOCK_SIZE 2048
+
+// Points to a function that returns the sum of the n (<= REDUCE_BLOCK_SIZE) values of a
+// sequence starting at index start. scratch is a buffer it can reuse for every block.
+typedef float (*BlockSumFunc)(void* ctx, void* scratch, long long start, int n);
+
+void set_deterministic_reductions(int deterministic);
+int get_deterministic_reductions(void);
+float pairwise_sum(const float* x, long long n);
+float parallel_sum(const float* x, long long n);
+float parallel_block_sum(long long n, size_t scratch_size, BlockSumFunc func, void* ctx);
+
+#endif // REDUCE_H
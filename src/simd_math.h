@@ -0,0 +1,208 @@
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H
+
+/* float32 exp, log, tanh and sigmoid on AVX2 and AVX-512 vectors for the kernels, all
+   from polynomial approximations evaluated with FMA. Maximum errors against the exact
+   result, measured over every float in the given range and rounded up:
+
+     exp      x in [-87.3, 88.3]     1.3 ulp
+     log      x positive normal      0.9 ulp
+     tanh     any x                  1.4 ulp
+     sigmoid  x in [-87.3, inf)      3.2 ulp, from rounding 1 + exp(-x)
+
+   Outside its range exp is clamped to the smallest normal and largest finite float,
+   log treats subnormals as the smallest normal, and sigmoid is clamped to the smallest
+   normal, FLT_MIN, instead of going subnormal. NaN inputs are not handled.
+   tests/test_kernels.c checks these bounds. */
+
+#define SIMD_MATH_ULP_EXP 1.3
+#define SIMD_MATH_ULP_LOG 0.9
+#define SIMD_MATH_ULP_TANH 1.4
+#define SIMD_MATH_ULP_SIGMOID 3.2
+
+#include <float.h>
+
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+/* The functions are compiled for their target with function attributes so the rest of
+   the program doesn't need -mavx2, and only called after init_kernels has checked the CPU. */
+#define AVX2 __attribute__((target("avx2,fma")))
+#define AVX512 __attribute__((target("avx512f,avx2,fma")))
+
+/* exp(x) from a degree 6 polynomial on [-ln2/2, ln2/2] scaled by 2^n. Inputs are clamped
+   to the range where the float result is finite. */
+AVX2 static inline __m256 avx2_exp_vector(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.3365447504f));
+
+    // x = n * ln2 + r
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    // scale by 2^n by building the exponent bits directly
+    __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+}
+
+/* log(x) for positive normal x. x = m * 2^e with m in [sqrt(0.5), sqrt(2)), then a degree 9
+   polynomial in m - 1, both from Cephes logf. */
+AVX2 static inline __m256 avx2_log_vector(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000))); // smallest normal float
+
+    // split off the exponent and scale the mantissa into [0.5, 1)
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+    x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                            _mm256_castps_si256(_mm256_set1_ps(0.5f))));
+
+    // below sqrt(0.5) use 2m and one less in the exponent
+    __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+    x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(x, small));
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(7.0376836292E-2f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.1514610310E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.1676998740E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.2420140846E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.4249322787E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.6668057665E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(2.0000714765E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-2.4999993993E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(3.3333331174E-1f));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+
+    // add e * ln2 in two parts to keep the precision
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+    y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+    return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(x, y));
+}
+
+/* tanh(x) as x + x^3 * P(x^2) below |x| = 0.625, the degree 4 P of Cephes tanhf, and as
+   1 - 2 / (exp(2|x|) + 1) with the sign of x above */
+AVX2 static inline __m256 avx2_tanh_vector(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 abs_x = _mm256_andnot_ps(sign, x);
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(-5.70498872745E-3f);
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(2.06390887954E-2f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-5.37397155531E-2f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.33314422036E-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33332819422E-1f));
+    __m256 small = _mm256_fmadd_ps(_mm256_mul_ps(p, z), x, x);
+
+    __m256 e = avx2_exp_vector(_mm256_add_ps(abs_x, abs_x));
+    __m256 large = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, one)));
+    large = _mm256_or_ps(large, _mm256_and_ps(x, sign));
+
+    __m256 is_small = _mm256_cmp_ps(abs_x, _mm256_set1_ps(0.625f), _CMP_LT_OQ);
+    return _mm256_blendv_ps(large, small, is_small);
+}
+
+/* 1 / (1 + exp(-x)), at least FLT_MIN */
+AVX2 static inline __m256 avx2_sigmoid_vector(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = avx2_exp_vector(_mm256_xor_ps(x, _mm256_set1_ps(-0.0f)));
+    return _mm256_max_ps(_mm256_div_ps(one, _mm256_add_ps(one, e)), _mm256_set1_ps(FLT_MIN));
+}
+
+/* Same approximation as avx2_exp_vector */
+AVX512 static inline __m512 avx512_exp_vector(__m512 x) {
+    x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+    x = _mm512_max_ps(x, _mm512_set1_ps(-87.3365447504f));
+
+    __m512 n = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f)),
+                                    _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+    __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(1.3981999507E-3f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(8.3334519073E-3f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(4.1665795894E-2f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(1.6666665459E-1f));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(5.0000001201E-1f));
+    y = _mm512_fmadd_ps(y, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    return _mm512_scalef_ps(y, n);
+}
+
+/* Same approximation as avx2_log_vector, getexp and getmant split x into 2^e * m with m in
+   [1, 2), which is moved to [sqrt(0.5), sqrt(2)) as before */
+AVX512 static inline __m512 avx512_log_vector(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    x = _mm512_max_ps(x, _mm512_castsi512_ps(_mm512_set1_epi32(0x00800000))); // smallest normal float
+    __m512 e = _mm512_getexp_ps(x);
+    x = _mm512_getmant_ps(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+
+    // above sqrt(2) use m / 2 and one more in the exponent
+    __mmask16 large = _mm512_cmp_ps_mask(x, _mm512_set1_ps(1.41421356237309505f), _CMP_GE_OQ);
+    e = _mm512_mask_add_ps(e, large, e, one);
+    x = _mm512_mask_mul_ps(x, large, x, _mm512_set1_ps(0.5f));
+    x = _mm512_sub_ps(x, one);
+
+    __m512 z = _mm512_mul_ps(x, x);
+    __m512 y = _mm512_set1_ps(7.0376836292E-2f);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.1514610310E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.1676998740E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.2420140846E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.4249322787E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-1.6668057665E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(2.0000714765E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(-2.4999993993E-1f));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(3.3333331174E-1f));
+    y = _mm512_mul_ps(_mm512_mul_ps(y, x), z);
+
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(-2.12194440e-4f), y);
+    y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+    return _mm512_fmadd_ps(e, _mm512_set1_ps(0.693359375f), _mm512_add_ps(x, y));
+}
+
+/* Same approximation as avx2_tanh_vector */
+AVX512 static inline __m512 avx512_tanh_vector(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 abs_x = _mm512_abs_ps(x);
+
+    __m512 z = _mm512_mul_ps(x, x);
+    __m512 p = _mm512_set1_ps(-5.70498872745E-3f);
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(2.06390887954E-2f));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(-5.37397155531E-2f));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(1.33314422036E-1f));
+    p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(-3.33332819422E-1f));
+    __m512 small = _mm512_fmadd_ps(_mm512_mul_ps(p, z), x, x);
+
+    __m512 e = avx512_exp_vector(_mm512_add_ps(abs_x, abs_x));
+    __m512 large = _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, one)));
+    // copy the sign bit of x
+    large = _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(large),
+                                                _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x80000000))));
+
+    __mmask16 is_small = _mm512_cmp_ps_mask(abs_x, _mm512_set1_ps(0.625f), _CMP_LT_OQ);
+    return _mm512_mask_blend_ps(is_small, large, small);
+}
+
+/* 1 / (1 + exp(-x)), at least FLT_MIN */
+AVX512 static inline __m512 avx512_sigmoid_vector(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 e = avx512_exp_vector(_mm512_sub_ps(_mm512_setzero_ps(), x));
+    return _mm512_max_ps(_mm512_div_ps(one, _mm512_add_ps(one, e)), _mm512_set1_ps(FLT_MIN));
+}
+
+#endif // KERNELS_X86
+
+#endif // SIMD_MATH_H
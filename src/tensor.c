@@ -2,6 +2,16 @@
 #include <stdlib.h>
 
 #include "tensor.h"
+#include "fusion.h"
+
+/* Fill in row-major strides for a contiguous tensor */
+static void set_contiguous_strides(Tensor* t) {
+    long long stride = 1;
+    for (int i = t->num_dims-1; i >= 0; i--) {
+        t->strides[i] = stride;
+        stride *= t->shape[i];
+    }
+}
 
 /* Create a new tensor from data */
 Tensor* create_tensor(float* data, int* shape, int num_dims, int requires_grad) {
@@ -10,6 +20,12 @@ Tensor* create_tensor(float* data, int* shape, int num_dims, int requires_grad)
         fprintf(stderr, "Memory allocation failed when allocating memory for a new tensor.\n");
         exit(EXIT_FAILURE);
     }
+    t->from_arena = 0;
+    t->owns_data = 1;
+    t->data = NULL;
+    t->grad = NULL;
+    t->strides = NULL;
+    t->parents = NULL;
     t->num_dims = num_dims;
 
     t->shape = (int*)malloc(num_dims * sizeof(int));
@@ -18,20 +34,29 @@ Tensor* create_tensor(float* data, int* shape, int num_dims, int requires_grad)
         free_tensor(t);
         exit(EXIT_FAILURE);
     }
-    int size = 1;
+    long long size = 1;
     for (int i = 0; i < num_dims; i++) {
         t->shape[i] = shape[i];
         size *= shape[i];
     }
     t->size = size;
 
+    t->strides = (long long*)malloc(num_dims * sizeof(long long));
+    if (!t->strides) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for a new tensors strides array.\n");
+        free_tensor(t);
+        exit(EXIT_FAILURE);
+    }
+    set_contiguous_strides(t);
+    t->offset = 0;
+
     t->data = (float*)malloc(size * sizeof(float));
     if (!t->data) {
         fprintf(stderr, "Memory allocation failed when allocating memory for a new tensor data array.\n");
         free_tensor(t);
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < size; i++) {
+    for (long long i = 0; i < size; i++) {
         t->data[i] = data[i]; // copy data
     }
 
@@ -41,34 +66,352 @@ Tensor* create_tensor(float* data, int* shape, int num_dims, int requires_grad)
         free_tensor(t);
         exit(EXIT_FAILURE);
     }
+    t->forward_func = NULL;
+    t->visit_generation = 0;
+    t->backward_func = NULL;
+    t->num_parents = 0;
+    t->requires_grad = requires_grad;
+    t->lazy_op = 0;
+    t->lazy_consumers = 0;
+    t->fused = NULL;
+    return t;
+}
+
+/* Wrap an existing contiguous buffer in a tensor without copying it. The tensor does not
+   own the buffer, so the buffer must outlive it, and it has no grads. Used for inputs. */
+Tensor* create_tensor_from_buffer(float* data, int* shape, int num_dims) {
+    return create_tensor_from_buffers(data, NULL, shape, num_dims);
+}
+
+/* Wrap existing data and grad buffers of the same size in a tensor that owns neither.
+   The tensor requires grad when a grad buffer is given. Used for slices of a flat
+   parameter buffer. */
+Tensor* create_tensor_from_buffers(float* data, float* grad, int* shape, int num_dims) {
+    Tensor* t = (Tensor*)malloc(sizeof(Tensor));
+    if (!t) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for a new tensor.\n");
+        exit(EXIT_FAILURE);
+    }
+    t->shape = (int*)malloc((num_dims > 0 ? num_dims : 1) * sizeof(int));
+    t->strides = (long long*)malloc((num_dims > 0 ? num_dims : 1) * sizeof(long long));
+    if (!t->shape || !t->strides) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for a new tensors shape array.\n");
+        exit(EXIT_FAILURE);
+    }
+    t->num_dims = num_dims;
+    t->size = 1;
+    for (int i = 0; i < num_dims; i++) {
+        t->shape[i] = shape[i];
+        t->size *= shape[i];
+    }
+    set_contiguous_strides(t);
+    t->offset = 0;
+    t->data = data;
+    t->grad = grad;
+    t->forward_func = NULL;
+    t->visit_generation = 0;
     t->backward_func = NULL;
     t->parents = NULL;
     t->num_parents = 0;
+    t->requires_grad = grad != NULL;
+    t->owns_data = 0;
+    t->from_arena = 0;
+    t->lazy_op = 0;
+    t->lazy_consumers = 0;
+    t->fused = NULL;
+    return t;
+}
+
+// Arena that op results are allocated from, NULL to allocate them on the heap
+static Arena* tensor_arena = NULL;
+
+/* Allocate all following op results from the given arena. Pass NULL to go back to the heap. */
+void set_tensor_arena(Arena* arena) {
+    tensor_arena = arena;
+}
+
+Arena* get_tensor_arena(void) {
+    return tensor_arena;
+}
+
+/* Allocate the struct, shape, strides and parents of an op output from the arena or heap */
+static Tensor* alloc_tensor_header(int num_dims, Tensor** parents, int num_parents) {
+    Tensor* t;
+    if (tensor_arena) {
+        t = (Tensor*)arena_alloc(tensor_arena, sizeof(Tensor));
+        t->shape = (int*)arena_alloc(tensor_arena, num_dims * sizeof(int));
+        t->strides = (long long*)arena_alloc(tensor_arena, num_dims * sizeof(long long));
+        t->parents = (Tensor**)arena_alloc(tensor_arena, num_parents * sizeof(Tensor*));
+        t->from_arena = 1;
+    } else {
+        t = (Tensor*)malloc(sizeof(Tensor));
+        if (!t) {
+            fprintf(stderr, "Memory allocation failed when allocating memory for an op result.\n");
+            exit(EXIT_FAILURE);
+        }
+        // reductions can produce 0 dims
+        t->shape = (int*)malloc((num_dims > 0 ? num_dims : 1) * sizeof(int));
+        t->strides = (long long*)malloc((num_dims > 0 ? num_dims : 1) * sizeof(long long));
+        t->parents = num_parents > 0 ? (Tensor**)malloc(num_parents * sizeof(Tensor*)) : NULL;
+        t->from_arena = 0;
+        if (!t->shape || !t->strides || (num_parents > 0 && !t->parents)) {
+            fprintf(stderr, "Memory allocation failed when allocating memory for an op result.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int requires_grad = 0;
+    for (int i = 0; i < num_parents; i++) {
+        t->parents[i] = parents[i];
+        requires_grad = requires_grad || parents[i]->requires_grad;
+    }
+    t->num_dims = num_dims;
+    t->num_parents = num_parents;
     t->requires_grad = requires_grad;
+    t->forward_func = NULL;
+    t->visit_generation = 0;
+    t->backward_func = NULL;
+    t->lazy_op = 0;
+    t->lazy_consumers = 0;
+    t->fused = NULL;
+    return t;
+}
+
+/* Create the output tensor of an op with uninitialised data and zeroed grads.
+   The result requires grad if any of its parents do. When a tensor arena is set the
+   struct, shape, parents, data and grad are all bump allocated from it, which makes
+   releasing a whole graph a single arena_reset(). */
+Tensor* create_op_result(int* shape, int num_dims, Tensor** parents, int num_parents, void (*backward_func)(Tensor*)) {
+    Tensor* t = create_lazy_op_result(shape, num_dims, parents, num_parents, backward_func);
+    alloc_op_data(t);
+    alloc_op_grad(t);
+    return t;
+}
+
+/* Same as create_op_result() but the data and grad are left NULL until alloc_op_data()
+   and alloc_op_grad(), so the results of ops fused away in lazy mode never take up
+   memory. Buffers of a result from an arena come from the arena set when they are
+   allocated. */
+Tensor* create_lazy_op_result(int* shape, int num_dims, Tensor** parents, int num_parents, void (*backward_func)(Tensor*)) {
+    Tensor* t = alloc_tensor_header(num_dims, parents, num_parents);
+
+    long long size = 1;
+    for (int i = 0; i < num_dims; i++) {
+        t->shape[i] = shape[i];
+        size *= shape[i];
+    }
+    t->size = size;
+    set_contiguous_strides(t);
+    t->offset = 0;
+    t->owns_data = 1;
+    t->backward_func = backward_func;
+    t->data = NULL;
+    t->grad = NULL;
+    return t;
+}
+
+static float* alloc_op_buffer(const Tensor* t, int zeroed) {
+    size_t size = t->size * sizeof(float);
+    if (t->from_arena) {
+        if (!tensor_arena) {
+            fprintf(stderr, "An op result from an arena needs its buffers but no tensor arena is set.\n");
+            exit(EXIT_FAILURE);
+        }
+        return (float*)(zeroed ? arena_calloc(tensor_arena, size) : arena_alloc(tensor_arena, size));
+    }
+    float* buffer = (float*)(zeroed ? calloc(t->size, sizeof(float)) : malloc(size));
+    if (!buffer) {
+        fprintf(stderr, "Memory allocation failed when allocating memory for an op result.\n");
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+/* Allocate the uninitialised data of an op result if it has none yet */
+void alloc_op_data(Tensor* t) {
+    if (!t->data && t->owns_data) t->data = alloc_op_buffer(t, 0);
+}
+
+/* Allocate the zeroed grads of an op result if it has none yet */
+void alloc_op_grad(Tensor* t) {
+    if (!t->grad && t->owns_data) t->grad = alloc_op_buffer(t, 1);
+}
+
+/* Create a tensor that shares data and grads with base. offset is the number of elements
+   from the first element of base to the first element of the view. The view is added to
+   the graph as a child of base but needs no backward function since gradients written to
+   the view land directly in the grads of base. */
+Tensor* create_view(Tensor* base, int* shape, long long* strides, int num_dims, long long offset) {
+    materialize(base);
+    if (base->requires_grad) alloc_op_grad(base); // the view shares them
+    Tensor* t = alloc_tensor_header(num_dims, &base, 1);
+
+    long long size = 1;
+    for (int i = 0; i < num_dims; i++) {
+        t->shape[i] = shape[i];
+        t->strides[i] = strides[i];
+        size *= shape[i];
+    }
+    t->size = size;
+    t->offset = base->offset + offset;
+    t->data = base->data + offset;
+    t->grad = base->grad ? base->grad + offset : NULL;
+    t->owns_data = 0;
     return t;
 }
 
+/* Check if the elements of a tensor are laid out densely in row-major order */
+int is_contiguous(const Tensor* t) {
+    long long expected_stride = 1;
+    for (int i = t->num_dims-1; i >= 0; i--) {
+        // the stride of a dim with a single element is never used
+        if (t->shape[i] != 1 && t->strides[i] != expected_stride) {
+            return 0;
+        }
+        expected_stride *= t->shape[i];
+    }
+    return 1;
+}
+
+/* Copy the elements of t from src (its data or grad) into the contiguous buffer dst */
+void gather_strided(const Tensor* t, const float* src, float* dst) {
+    if (t->num_dims == 0) {
+        dst[0] = src[0];
+        return;
+    }
+    int* index = (int*)calloc(t->num_dims, sizeof(int));
+    if (!index) {
+        fprintf(stderr, "Memory allocation failed when walking a strided tensor.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int last = t->num_dims-1;
+    int inner_size = t->shape[last];
+    long long inner_stride = t->strides[last];
+    long long src_offset = 0;
+    for (long long i = 0; i < t->size; i += inner_size) {
+        for (int j = 0; j < inner_size; j++) {
+            dst[i + j] = src[src_offset + j * inner_stride];
+        }
+        // increment the index of the outer dims like an odometer
+        for (int dim = last-1; dim >= 0; dim--) {
+            index[dim]++;
+            src_offset += t->strides[dim];
+            if (index[dim] < t->shape[dim]) break;
+            src_offset -= index[dim] * t->strides[dim];
+            index[dim] = 0;
+        }
+    }
+    free(index);
+}
+
+/* Add the contiguous buffer src onto the elements of t in dst (its data or grad) */
+void scatter_add_strided(Tensor* t, const float* src, float* dst) {
+    if (t->num_dims == 0) {
+        dst[0] += src[0];
+        return;
+    }
+    int* index = (int*)calloc(t->num_dims, sizeof(int));
+    if (!index) {
+        fprintf(stderr, "Memory allocation failed when walking a strided tensor.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int last = t->num_dims-1;
+    int inner_size = t->shape[last];
+    long long inner_stride = t->strides[last];
+    long long dst_offset = 0;
+    for (long long i = 0; i < t->size; i += inner_size) {
+        for (int j = 0; j < inner_size; j++) {
+            dst[dst_offset + j * inner_stride] += src[i + j];
+        }
+        for (int dim = last-1; dim >= 0; dim--) {
+            index[dim]++;
+            dst_offset += t->strides[dim];
+            if (index[dim] < t->shape[dim]) break;
+            dst_offset -= index[dim] * t->strides[dim];
+            index[dim] = 0;
+        }
+    }
+    free(index);
+}
+
+/* Return the data of t in contiguous row-major order. This is t->data unless t is a
+   strided view, in which case the elements are gathered into a temporary buffer that
+   must be given back with release_contiguous_data(). An op recorded in lazy mode is
+   computed first. */
+float* contiguous_data(Tensor* t) {
+    materialize(t);
+    if (is_contiguous(t)) {
+        return t->data;
+    }
+    float* data = (float*)malloc(t->size * sizeof(float));
+    if (!data) {
+        fprintf(stderr, "Memory allocation failed when gathering a strided tensor.\n");
+        exit(EXIT_FAILURE);
+    }
+    gather_strided(t, t->data, data);
+    return data;
+}
+
+void release_contiguous_data(Tensor* t, float* data) {
+    if (data != t->data) {
+        free(data);
+    }
+}
+
+/* Return a contiguous buffer that gradients for t can be accumulated into. This is t->grad
+   unless t is a strided view, in which case a zeroed temporary buffer is returned that
+   commit_contiguous_grad() adds back onto the strided grads. */
+float* contiguous_grad(Tensor* t) {
+    if (is_contiguous(t)) {
+        return t->grad;
+    }
+    float* grad = (float*)calloc(t->size, sizeof(float));
+    if (!grad) {
+        fprintf(stderr, "Memory allocation failed when accumulating grads of a strided tensor.\n");
+        exit(EXIT_FAILURE);
+    }
+    return grad;
+}
+
+void commit_contiguous_grad(Tensor* t, float* grad) {
+    if (grad != t->grad) {
+        scatter_add_strided(t, grad, t->grad);
+        free(grad);
+    }
+}
+
 /* Add a new parent to a tensor */
 void add_parent(Tensor* child, Tensor* parent) {
     child->num_parents++;
 
-    if (child->num_parents==1) {
+    if (child->from_arena) {
+        // arena memory can't be realloc'd so copy the existing parents over
+        Tensor** parents = (Tensor**)arena_alloc(tensor_arena, child->num_parents * sizeof(Tensor*));
+        for (int i = 0; i < child->num_parents-1; i++) {
+            parents[i] = child->parents[i];
+        }
+        child->parents = parents;
+    } else if (child->num_parents==1) {
         child->parents = (Tensor**)malloc(child->num_parents * sizeof(Tensor*));
     } else {
         child->parents = (Tensor**)realloc(child->parents, child->num_parents * sizeof(Tensor*));
     }
-    child->parents[child->num_parents] = parent;
+    child->parents[child->num_parents-1] = parent;
 }
 
 
 /* Free the memory of a tensor */
 void free_tensor(Tensor* t) {
-    if (t) {
-        if (t->data) {
+    // Arena tensors are released all at once by arena_reset()
+    if (t && !t->from_arena) {
+        // Views and wrapped buffers don't own their data
+        if (t->data && t->owns_data) {
             free(t->data);
             t->data = NULL;
         }
-        if (t->grad) {
+        if (t->grad && t->owns_data) {
             free(t->grad);
             t->grad = NULL;
         }
@@ -76,6 +419,14 @@ void free_tensor(Tensor* t) {
             free(t->shape);
             t->shape = NULL;
         }
+        if (t->strides) {
+            free(t->strides);
+            t->strides = NULL;
+        }
+        // a fused result owns the ops fused into it and its parents array
+        if (t->fused) {
+            free_fused_program(t);
+        }
         if (t->parents) {
             free(t->parents);
             t->parents = NULL;
@@ -1,21 +1,48 @@
 #ifndef TENSOR_H
 #define TENSOR_H
 
+#include "arena.h"
+
 typedef struct Tensor {
-    float* data;
+    float* data; // points to the first element of the tensor, storage + offset for views
     float* grad;
     int* shape;
-    int size;
+    long long* strides; // number of elements to step over to move one index along each dim
+    long long offset; // offset of the first element into the storage the data is shared with
+    long long size; // 64-bit so tensors can hold more than 2^31 elements, each dim fits in an int
     int num_dims;
+    void (*forward_func)(struct Tensor*); // recomputes data from the parents, NULL for leaves and views
     void (*backward_func)(struct Tensor*); // points to a function that takes a pointer to a Tensor struct as its argument
     struct Tensor** parents; // pointer to a list of tensor pointers
     int num_parents;
     int requires_grad;
+    int owns_data; // views and wrapped buffers share data and grad with another tensor
+    int from_arena; // memory is owned by the step arena and released by arena_reset()
+    unsigned int visit_generation; // marks the tensor as visited by the latest build_topo()
+    int lazy_op; // FusedOpKind + 1 of an op recorded in lazy mode and not computed yet, else 0
+    int lazy_consumers; // ops recorded in lazy mode that read this tensor
+    struct FusedProgram* fused; // the ops materialize() fused into this result, NULL otherwise
 } Tensor;
 
 Tensor* create_tensor(float* data, int* shape, int num_dims, int requires_grad);
+Tensor* create_tensor_from_buffer(float* data, int* shape, int num_dims);
+Tensor* create_tensor_from_buffers(float* data, float* grad, int* shape, int num_dims);
+Tensor* create_op_result(int* shape, int num_dims, Tensor** parents, int num_parents, void (*backward_func)(Tensor*));
+Tensor* create_lazy_op_result(int* shape, int num_dims, Tensor** parents, int num_parents, void (*backward_func)(Tensor*));
+void alloc_op_data(Tensor* t);
+void alloc_op_grad(Tensor* t);
+Tensor* create_view(Tensor* base, int* shape, long long* strides, int num_dims, long long offset);
+void set_tensor_arena(Arena* arena);
+Arena* get_tensor_arena(void);
+int is_contiguous(const Tensor* t);
+void gather_strided(const Tensor* t, const float* src, float* dst);
+void scatter_add_strided(Tensor* t, const float* src, float* dst);
+float* contiguous_data(Tensor* t);
+void release_contiguous_data(Tensor* t, float* data);
+float* contiguous_grad(Tensor* t);
+void commit_contiguous_grad(Tensor* t, float* grad);
 void add_parent(Tensor* child, Tensor* parent);
 void print_tensor(const Tensor* t, int print_grad);
 void free_tensor(Tensor* t);
 
-#endif // TENSOR_H
\ No newline at end of file
+#endif // TENSOR_H
@@ -5,6 +5,12 @@
 #include "tensor.h"
 #include "utility.h"
 #include "backward.h"
+#include "broadcast.h"
+#include "gemm.h"
+#include "fusion.h"
+#include "kernels.h"
+#include "reduce.h"
+#include "thread_pool.h"
 
 int ensure_requires_grad(Tensor* t) {
     if (!t->requires_grad) {
@@ -23,84 +29,320 @@ int ensure_one_of_requires_grad(Tensor* a, Tensor* b) {
     }
 }
 
+// Rough cost of one element of a kernel, used to decide how many elements a thread gets
+#define COST_ADD 1
+#define COST_SIGMOID 16
+#define COST_TANH 20
+#define COST_GELU 24
+
+// Elementwise kernel applied to a range of the output by parallel_for, only one kernel is set
+typedef struct ElementwiseTask {
+    void (*binary)(const float* a, const float* b, float* out, long long n);
+    void (*unary)(const float* x, float* out, long long n);
+    void (*scalar)(const float* a, float b, float* out, long long n);
+    const float* a;
+    const float* b;
+    float b_scalar;
+    float* out;
+} ElementwiseTask;
+
+static void elementwise_task(void* ctx, long long start, long long end) {
+    ElementwiseTask* task = (ElementwiseTask*)ctx;
+    if (task->unary) {
+        task->unary(task->a + start, task->out + start, end - start);
+        return;
+    }
+    if (task->scalar) {
+        task->scalar(task->a + start, task->b_scalar, task->out + start, end - start);
+        return;
+    }
+    task->binary(task->a + start, task->b + start, task->out + start, end - start);
+}
+
+/* Run an elementwise kernel over a, b and out of the same size, split across threads */
+static void parallel_binary(void (*kernel)(const float*, const float*, float*, long long),
+                            const float* a, const float* b, float* out, long long n, int cost) {
+    ElementwiseTask task = {kernel, NULL, NULL, a, b, 0, out};
+    parallel_for(n, grain_size_for_cost(cost), elementwise_task, &task);
+}
+
+static void parallel_unary(void (*kernel)(const float*, float*, long long), const float* x, float* out, long long n, int cost) {
+    ElementwiseTask task = {NULL, kernel, NULL, x, NULL, 0, out};
+    parallel_for(n, grain_size_for_cost(cost), elementwise_task, &task);
+}
+
+static void parallel_add_scalar(const float* a, float b, float* out, long long n) {
+    ElementwiseTask task = {NULL, NULL, kernels.add_scalar, a, NULL, b, out};
+    parallel_for(n, grain_size_for_cost(COST_ADD), elementwise_task, &task);
+}
+
+/* Iterator over the shape of a binary op result with the operands out, x and y in that
+   order. out is written, the result itself in the forward pass or a parent whose grad is
+   reduced in the backward pass. */
+static void init_binary_iter(BroadcastIter* it, Tensor* result, Tensor* out, Tensor* x, Tensor* y) {
+    const int* shapes[3] = {out->shape, x->shape, y->shape};
+    int dims[3] = {out->num_dims, x->num_dims, y->num_dims};
+    init_broadcast_iter(it, result->shape, result->num_dims, shapes, dims, 3);
+}
+
+// Runs of broadcast binary ops, data holds out, a and b. out is never broadcast.
+static void add_run(void* ctx, float** data, const long long* strides, long long n) {
+    (void)ctx;
+    float* out = data[0];
+    const float* a = data[1];
+    const float* b = data[2];
+    if (strides[1] && strides[2]) {
+        kernels.add(a, b, out, n);
+    } else if (strides[1]) {
+        kernels.add_scalar(a, b[0], out, n);
+    } else if (strides[2]) {
+        kernels.add_scalar(b, a[0], out, n);
+    } else {
+        for (long long i = 0; i < n; i++) out[i] = a[0] + b[0];
+    }
+}
+
+static void mul_run(void* ctx, float** data, const long long* strides, long long n) {
+    (void)ctx;
+    float* out = data[0];
+    const float* a = data[1];
+    const float* b = data[2];
+    if (strides[1] && strides[2]) {
+        kernels.mul(a, b, out, n);
+    } else if (strides[1]) {
+        kernels.mul_scalar(a, b[0], out, n);
+    } else if (strides[2]) {
+        kernels.mul_scalar(b, a[0], out, n);
+    } else {
+        for (long long i = 0; i < n; i++) out[i] = a[0] * b[0];
+    }
+}
+
+// Runs of grad reductions, data holds the parent grad and the result grad, and for mul
+// the data of the other parent. The parent grad sums the result grad along broadcast dims.
+static void add_grad_run(void* ctx, float** data, const long long* strides, long long n) {
+    (void)ctx;
+    float* grad = data[0];
+    const float* result_grad = data[1];
+    if (strides[0]) {
+        kernels.add(grad, result_grad, grad, n);
+    } else {
+        grad[0] += pairwise_sum(result_grad, n);
+    }
+}
+
+static void mul_grad_run(void* ctx, float** data, const long long* strides, long long n) {
+    (void)ctx;
+    float* grad = data[0];
+    const float* result_grad = data[1];
+    const float* other = data[2];
+    if (strides[0] && strides[2]) {
+        kernels.mul_add(result_grad, other, grad, n);
+    } else if (strides[0]) {
+        kernels.mul_scalar_add(result_grad, other[0], grad, n);
+    } else if (strides[2]) {
+        grad[0] += kernels.dot(result_grad, other, n);
+    } else {
+        grad[0] += other[0] * pairwise_sum(result_grad, n);
+    }
+}
+
+// Per-row work of sum and its backward
+typedef struct RowTask {
+    const float* in;
+    float* out;
+    int row_size;
+} RowTask;
+
+static void sum_rows_task(void* ctx, long long start, long long end) {
+    RowTask* task = (RowTask*)ctx;
+    for (long long i = start; i < end; i++) {
+        task->out[i] = pairwise_sum(task->in + i*task->row_size, task->row_size);
+    }
+}
+
+static void sum_rows_backward_task(void* ctx, long long start, long long end) {
+    RowTask* task = (RowTask*)ctx;
+    for (long long i = start; i < end; i++) {
+        float* row_grad = task->out + i*task->row_size;
+        kernels.add_scalar(row_grad, task->in[i], row_grad, task->row_size);
+    }
+}
+
+/* Each parent gets the result grad summed over the dims it was broadcast in */
 void backward_add(Tensor* result) {
+    ensure_one_of_requires_grad(result->parents[0], result->parents[1]);
+
     for (int i = 0; i < result->num_parents; i++) {
-        ensure_requires_grad(result->parents[i]);
-        for (int j = 0; j < result->parents[i]->size; j++) {
-            result->parents[i]->grad[j] += result->grad[j];
-        }
+        Tensor* parent = result->parents[i];
+        if (!parent->requires_grad) continue;
+
+        BroadcastIter it;
+        const int* shapes[2] = {parent->shape, result->shape};
+        int dims[2] = {parent->num_dims, result->num_dims};
+        init_broadcast_iter(&it, result->shape, result->num_dims, shapes, dims, 2);
+        float* parent_grad = contiguous_grad(parent);
+        float* data[2] = {parent_grad, result->grad};
+        broadcast_for_each(&it, data, COST_ADD, add_grad_run, NULL);
+        commit_contiguous_grad(parent, parent_grad);
     }
 }
 
 void backward_sum(Tensor* result) {
     Tensor* parent = result->parents[0];
     ensure_requires_grad(parent);
+    float* parent_grad = contiguous_grad(parent);
     int last_parent_dim = parent->shape[parent->num_dims-1];
-    for (int i = 0; i < result->size; i++) {
-        for (int j=0; j < last_parent_dim; j++) {
-            parent->grad[i*last_parent_dim + j] += result->grad[i];
-        }
-    }
+    RowTask task = {result->grad, parent_grad, last_parent_dim};
+    parallel_for(result->size, grain_size_for_cost(last_parent_dim), sum_rows_backward_task, &task);
+    commit_contiguous_grad(parent, parent_grad);
 }
 
 void backward_reduce_sum(Tensor* result) {
     Tensor* parent = result->parents[0];
     ensure_requires_grad(parent);
-    for (int i = 0; i < parent->size; i++) {
-        // deposit the grad from the result value into each grad of the parent
-        parent->grad[i] += result->grad[0];
+    float* parent_grad = contiguous_grad(parent);
+    // deposit the grad from the result value into each grad of the parent
+    parallel_add_scalar(parent_grad, result->grad[0], parent_grad, parent->size);
+    commit_contiguous_grad(parent, parent_grad);
+}
+
+/* Get the data of a matmul operand along with the strides of its last two dims.
+   2D tensors, including transposed views, are read in place through their strides. */
+static float* matmul_operand(Tensor* t, long long* row_stride, long long* col_stride) {
+    if (t->num_dims == 2) {
+        materialize(t);
+        *row_stride = t->strides[0];
+        *col_stride = t->strides[1];
+        return t->data;
+    }
+    *row_stride = t->shape[t->num_dims-1];
+    *col_stride = 1;
+    return contiguous_data(t);
+}
+
+// Operands of a batched matmul, split across threads by batch
+typedef struct MatmulBatches {
+    int M, N, K;
+    const float* a_data;
+    long long a_row_stride, a_col_stride, a_size;
+    const float* b_data;
+    long long b_row_stride, b_col_stride, b_size;
+    float* result; // result data in the forward pass, result grad in the backward pass
+    float* a_grad;
+    float* b_grad;
+    BroadcastIter batches; // of the leading dims of the result, a and b, for the batch offsets
+} MatmulBatches;
+
+/* Set up the batch iterator of a matmul of operands with 2 or more dims, the matrices of a
+   batch are found by broadcasting the leading dims of a and b to those of the result */
+static void init_matmul_batches(MatmulBatches* m, Tensor* result, Tensor* a, Tensor* b) {
+    const int* shapes[3] = {result->shape, a->shape, b->shape};
+    int dims[3] = {result->num_dims-2, a->num_dims-2, b->num_dims-2};
+    init_broadcast_iter(&m->batches, result->shape, result->num_dims-2, shapes, dims, 3);
+}
+
+static void matmul_batch_task(void* ctx, long long start, long long end) {
+    MatmulBatches* m = (MatmulBatches*)ctx;
+    int M = m->M, N = m->N, K = m->K;
+    for (long long batch = start; batch < end; batch++) {
+        // Calculate offsets since matrix elements are a flattened 1D array
+        long long offset_a = broadcast_offset(&m->batches, 1, batch) * M * K;
+        long long offset_b = broadcast_offset(&m->batches, 2, batch) * K * N;
+        long long offset_result = batch * M * N;
+        gemm(M, N, K, m->a_data + offset_a, m->a_row_stride, m->a_col_stride,
+             m->b_data + offset_b, m->b_row_stride, m->b_col_stride,
+             m->result + offset_result, N, 0);
+    }
+}
+
+static void matmul_backward_batch_task(void* ctx, long long start, long long end) {
+    MatmulBatches* m = (MatmulBatches*)ctx;
+    int M = m->M, N = m->N, K = m->K;
+    for (long long batch = start; batch < end; batch++) {
+        // take the number of elements in the last two dims and repeat it batch times to offset the calculations
+        long long offset_a = broadcast_offset(&m->batches, 1, batch) * M * K;
+        long long offset_b = broadcast_offset(&m->batches, 2, batch) * K * N;
+        float* result_grad = m->result + batch * M * N;
+
+        // dA += dC @ B^T and dB += A^T @ dC, the transposes are just swapped strides
+        if (m->a_grad) {
+            gemm(M, K, N, result_grad, N, 1, m->b_data + offset_b, m->b_col_stride, m->b_row_stride,
+                 m->a_grad + offset_a, K, 1);
+        }
+        if (m->b_grad) {
+            gemm(K, N, M, m->a_data + offset_a, m->a_col_stride, m->a_row_stride, result_grad, N, 1,
+                 m->b_grad + offset_b, N, 1);
+        }
     }
 }
 
+/* Batches go to separate threads when there are enough of them, otherwise each gemm
+   is split across the threads instead */
+static void run_matmul_batches(MatmulBatches* m, long long num_batches, int backward) {
+    ParallelForFunc task = backward ? matmul_backward_batch_task : matmul_batch_task;
+    // Broadcast operands share their grad between batches, so those are accumulated serially
+    int shared_grad = backward && (m->a_size != num_batches * m->M * m->K || m->b_size != num_batches * m->K * m->N);
+    if (num_batches < get_num_threads() || shared_grad) {
+        task(m, 0, num_batches);
+        return;
+    }
+    parallel_for(num_batches, grain_size_for_cost(2LL * m->M * m->N * m->K), task, m);
+}
+
 void backward_matmul(Tensor* result) {
     Tensor* a = result->parents[0];
     Tensor* b = result->parents[1];
 
     ensure_one_of_requires_grad(a, b);
 
+    long long a_row_stride, a_col_stride, b_row_stride, b_col_stride;
+    float* a_data = matmul_operand(a, &a_row_stride, &a_col_stride);
+    float* b_data = matmul_operand(b, &b_row_stride, &b_col_stride);
+    float* a_grad = a->requires_grad ? contiguous_grad(a) : NULL;
+    float* b_grad = b->requires_grad ? contiguous_grad(b) : NULL;
+
     // Case 1: One or both of the tensors are 1D
     if (a->num_dims == 1 || b->num_dims == 1) {
         // Get the 1D tensor (both can be 1D)
-        Tensor* t_1d = a->num_dims == 1 ? a : b;
-        Tensor* t_other = a->num_dims == 1 ? b : a;
+        int a_is_1d = a->num_dims == 1;
+        float* data_1d = a_is_1d ? a_data : b_data;
+        float* grad_1d = a_is_1d ? a_grad : b_grad;
+        Tensor* t_other = a_is_1d ? b : a;
+        float* data_other = a_is_1d ? b_data : a_data;
+        float* grad_other = a_is_1d ? b_grad : a_grad;
+        long long other_row_stride = a_is_1d ? b_row_stride : a_row_stride;
+        long long other_col_stride = a_is_1d ? b_col_stride : a_col_stride;
         
         int last_dim_size = t_other->shape[t_other->num_dims-1];
-        for (int i = 0; i < result->size; i++) {
+        for (long long i = 0; i < result->size; i++) {
             for (int j=0; j < last_dim_size; j++) {
-                t_1d->grad[j] += result->grad[i] * t_other->data[i*last_dim_size + j];
-                t_other->grad[i*last_dim_size + j] += result->grad[i] * t_1d->data[j];
+                if (grad_1d) grad_1d[j] += result->grad[i] * data_other[i*other_row_stride + j*other_col_stride];
+                if (grad_other) grad_other[i*last_dim_size + j] += result->grad[i] * data_1d[j];
             }
         }
     } 
     // Case 2: Both tensors have arbitrary shapes 2D+
     else { 
         int num_leading_dims = result->num_dims-2;
-        int leading_dims_size = 1;
+        long long leading_dims_size = 1;
         for (int i = 0; i < num_leading_dims; i++) {
             leading_dims_size *= result->shape[i];
         }
-        int M = a->shape[num_leading_dims]; // 2nd last dim in a [.., .., M, ..]
-        int K = a->shape[num_leading_dims + 1]; // last dim in a [.., .., .., K]
-        int N = b->shape[num_leading_dims + 1]; // last dim in b [.., .., .., N]
-
-        for (int batch = 0; batch < leading_dims_size; batch++) {
-            // Calculate offsets since matrix elements are a flattened 1D array
-            // take the number of elements in the last two dims and repeat it batch times to offset the calculations
-            int offset_a = (batch * M * K) % a->size; 
-            int offset_b = (batch * K * N) % b->size;
-            int offset_result = batch * M * N;
-            for (int i = 0; i < M; i++) {
-                for (int j = 0; j < N; j++) {
-                    for (int k = 0; k < K; k++) {
-                        a->grad[offset_a + i * K + k] += 
-                            result->grad[offset_result + i * N + j] * b->data[offset_b + k * N + j];
-                        b->grad[offset_b + k * N + j] += 
-                            result->grad[offset_result + i * N + j] * a->data[offset_a + i * K + k];
-                    }
-                }
-            }
-        }
+        int M = a->shape[a->num_dims-2]; // 2nd last dim in a [.., .., M, ..]
+        int K = a->shape[a->num_dims-1]; // last dim in a [.., .., .., K]
+        int N = b->shape[b->num_dims-1]; // last dim in b [.., .., .., N]
+
+        MatmulBatches batches = {M, N, K, a_data, a_row_stride, a_col_stride, a->size,
+                                 b_data, b_row_stride, b_col_stride, b->size, result->grad, a_grad, b_grad, {0}};
+        init_matmul_batches(&batches, result, a, b);
+        run_matmul_batches(&batches, leading_dims_size, 1);
     }
+
+    release_contiguous_data(a, a_data);
+    release_contiguous_data(b, b_data);
+    if (a_grad) commit_contiguous_grad(a, a_grad);
+    if (b_grad) commit_contiguous_grad(b, b_grad);
 }
 
 void backward_mul(Tensor* result) {
@@ -109,132 +351,240 @@ void backward_mul(Tensor* result) {
 
     ensure_one_of_requires_grad(a, b);
 
-    for (int i = 0; i < result->size; i++) {
-        int offset_a = i % a->size;
-        int offset_b = i % b->size;
-        a->grad[offset_a] += result->grad[i] * b->data[offset_b];
-        b->grad[offset_b] += result->grad[i] * a->data[offset_a];    
+    float* a_data = contiguous_data(a);
+    float* b_data = contiguous_data(b);
+    float* a_grad = a->requires_grad ? contiguous_grad(a) : NULL;
+    float* b_grad = b->requires_grad ? contiguous_grad(b) : NULL;
+
+    // Each grad sums the result grad times the other parent over the dims it was broadcast in
+    BroadcastIter it;
+    if (a_grad) {
+        init_binary_iter(&it, result, a, result, b);
+        float* data[3] = {a_grad, result->grad, b_data};
+        broadcast_for_each(&it, data, COST_ADD, mul_grad_run, NULL);
     }
+    if (b_grad) {
+        init_binary_iter(&it, result, b, result, a);
+        float* data[3] = {b_grad, result->grad, a_data};
+        broadcast_for_each(&it, data, COST_ADD, mul_grad_run, NULL);
+    }
+
+    release_contiguous_data(a, a_data);
+    release_contiguous_data(b, b_data);
+    if (a_grad) commit_contiguous_grad(a, a_grad);
+    if (b_grad) commit_contiguous_grad(b, b_grad);
 }
 
 void backward_relu(Tensor* result) {
     Tensor* parent = result->parents[0];
     ensure_requires_grad(parent);
+    float* parent_grad = contiguous_grad(parent);
     
-    for (int i = 0; i < result->size; ++i) {
-        parent->grad[i] += result->grad[i] * (result->data[i] > 0 ? 1 : 0);
-    }
+    parallel_binary(kernels.relu_backward, result->data, result->grad, parent_grad, result->size, COST_ADD);
+    commit_contiguous_grad(parent, parent_grad);
 }
 
 void backward_sigmoid(Tensor* result) {
     Tensor* parent = result->parents[0];
     ensure_requires_grad(parent);
+    float* parent_grad = contiguous_grad(parent);
     
-    for (int i = 0; i < result->size; ++i) {
-        parent->grad[i] += result->grad[i] * (result->data[i] * (1 - result->data[i]));
-    }
+    parallel_binary(kernels.sigmoid_backward, result->data, result->grad, parent_grad, result->size, COST_ADD);
+    commit_contiguous_grad(parent, parent_grad);
 }
 
-Tensor* add(Tensor* a, Tensor* b) {
-    // Ensure that the tensors have the same shape
-    if (!is_broadcastable(a, b)) {
-        handle_shape_mismatch(a, b);
-    }
-    float* result_data;
-    // Case 1: Two 1D tensors
-    if (a->num_dims == 1 && b->num_dims == 1) {
-        int size = a->shape[0];
-        result_data = (float*)malloc(size * sizeof(float));
-        for (int i = 0; i < size; i++) {
-            result_data[i] = a->data[i] + b->data[i];
-        }
-    } 
-    // Case 2: Two arbitrary shaped 2D+ tensors 
-    else {
-        const Tensor* t1 = a->num_dims > b->num_dims ? a : b;
-        const Tensor* t2 = a->num_dims <= b->num_dims ? a : b;
+void backward_tanh(Tensor* result) {
+    Tensor* parent = result->parents[0];
+    ensure_requires_grad(parent);
+    float* parent_grad = contiguous_grad(parent);
 
-        int num_leading_dims = t1->num_dims - 1;
+    parallel_binary(kernels.tanh_backward, result->data, result->grad, parent_grad, result->size, COST_ADD);
+    commit_contiguous_grad(parent, parent_grad);
+}
 
-        // Calculate shape after broadcasting
-        int size = 1;
-        for (int i=0; i < num_leading_dims; i++) {
-            size *= t1->shape[i] > t2->shape[i] ? t1->shape[i] : t2->shape[i];
-        }
+/* The grads of gelu and silu can't be recovered from their output, so they are
+   computed from the input */
+void backward_gelu(Tensor* result) {
+    Tensor* parent = result->parents[0];
+    ensure_requires_grad(parent);
+    float* parent_data = contiguous_data(parent);
+    float* parent_grad = contiguous_grad(parent);
 
-        int last_dim_size = t1->shape[t1->num_dims - 1];
-        result_data = (float*)malloc((size*last_dim_size) * sizeof(float));
+    parallel_binary(kernels.gelu_backward, parent_data, result->grad, parent_grad, result->size, COST_GELU);
+    release_contiguous_data(parent, parent_data);
+    commit_contiguous_grad(parent, parent_grad);
+}
 
-        // Essentially flattens the leading dims and adds the last two dims
-        for (int batch = 0; batch < size; batch++) {
-            for (int i = 0; i < last_dim_size; i++) {
-                result_data[batch * last_dim_size + i] = t1->data[(batch * last_dim_size + i) % t1->size] + t2->data[(batch * last_dim_size + i) % t2->size];
-            }
-        }
+void backward_silu(Tensor* result) {
+    Tensor* parent = result->parents[0];
+    ensure_requires_grad(parent);
+    float* parent_data = contiguous_data(parent);
+    float* parent_grad = contiguous_grad(parent);
+
+    parallel_binary(kernels.silu_backward, parent_data, result->grad, parent_grad, result->size, COST_SIGMOID);
+    release_contiguous_data(parent, parent_data);
+    commit_contiguous_grad(parent, parent_grad);
+}
+
+/* Gradients of a contiguous copy are scattered back to the strided parent */
+void backward_contiguous(Tensor* result) {
+    Tensor* parent = result->parents[0];
+    ensure_requires_grad(parent);
+    scatter_add_strided(parent, result->grad, parent->grad);
+}
+
+/* Forward functions recompute the data of an op result from the current data of its
+   parents without allocating, so a captured graph can be replayed in place */
+void forward_add(Tensor* result) {
+    Tensor* a = result->parents[0];
+    Tensor* b = result->parents[1];
+    float* a_data = contiguous_data(a);
+    float* b_data = contiguous_data(b);
+    BroadcastIter it;
+    init_binary_iter(&it, result, result, a, b);
+    float* data[3] = {result->data, a_data, b_data};
+    broadcast_for_each(&it, data, COST_ADD, add_run, NULL);
+    release_contiguous_data(a, a_data);
+    release_contiguous_data(b, b_data);
+}
+
+/* Heap copy of the shape of t for the shape of a result or view, the caller frees it */
+static int* copy_shape(const Tensor* t) {
+    int* shape = (int*)malloc((t->num_dims > 0 ? t->num_dims : 1) * sizeof(int));
+    if (!shape) {
+        fprintf(stderr, "Memory allocation failed when allocating a result shape.\n");
+        exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < t->num_dims; i++) {
+        shape[i] = t->shape[i];
+    }
+    return shape;
+}
 
-    int requires_grad = a->requires_grad || b->requires_grad;
-    Tensor* result = create_tensor(result_data, a->shape, a->num_dims, requires_grad);
-    free(result_data);
+static long long* alloc_strides(int num_dims) {
+    long long* strides = (long long*)malloc((num_dims > 0 ? num_dims : 1) * sizeof(long long));
+    if (!strides) {
+        fprintf(stderr, "Memory allocation failed when allocating view strides.\n");
+        exit(EXIT_FAILURE);
+    }
+    return strides;
+}
 
-    result->parents = (Tensor**)malloc(2 * sizeof(Tensor*));
-    result->parents[0] = a;
-    result->parents[1] = b;
-    result->num_parents = 2;
-    result->backward_func = backward_add;
+/* Result of a binary op whose operands are broadcast against each other, without its
+   buffers until record_lazy_op() */
+static Tensor* create_broadcast_result(Tensor* a, Tensor* b, void (*backward_func)(Tensor*)) {
+    int max_dims = a->num_dims > b->num_dims ? a->num_dims : b->num_dims;
+    int* shape = (int*)malloc((max_dims > 0 ? max_dims : 1) * sizeof(int));
+    if (!shape) {
+        fprintf(stderr, "Memory allocation failed when allocating a result shape.\n");
+        exit(EXIT_FAILURE);
+    }
+    int result_dims = broadcast_shapes(a->shape, a->num_dims, b->shape, b->num_dims, shape);
+    if (result_dims < 0) {
+        free(shape);
+        handle_shape_mismatch(a, b);
+    }
 
+    Tensor* parents[2] = {a, b};
+    Tensor* result = create_lazy_op_result(shape, result_dims, parents, 2, backward_func);
+    free(shape);
     return result;
 }
 
-/* Sum over the last dim */
-Tensor* sum(Tensor* t) {
-    int last_dim = t->shape[t->num_dims-1];
-    int result_size = t->size / last_dim;
-    float result_data[result_size];
+Tensor* add(Tensor* a, Tensor* b) {
+    Tensor* result = create_broadcast_result(a, b, backward_add);
+    result->forward_func = forward_add;
+    if (!record_lazy_op(result, FUSED_ADD)) forward_add(result);
 
-    for (int i=0; i < result_size; i++) {
-        result_data[i] = 0; // zero before sum
-        for (int j=0; j < last_dim; j++) {
-            result_data[i] += t->data[i*last_dim + j];
+    return result;
+}
+
+void forward_sum(Tensor* result) {
+    Tensor* t = result->parents[0];
+    int last_dim = t->shape[t->num_dims-1];
+    float* t_data = contiguous_data(t);
+    if (result->size < get_num_threads()) {
+        // too few rows to keep the threads busy, split each row instead
+        for (long long i = 0; i < result->size; i++) {
+            result->data[i] = parallel_sum(t_data + i*last_dim, last_dim);
         }
+    } else {
+        RowTask task = {t_data, result->data, last_dim};
+        parallel_for(result->size, grain_size_for_cost(last_dim), sum_rows_task, &task);
     }
+    release_contiguous_data(t, t_data);
+}
 
-    Tensor* result = create_tensor(result_data, t->shape, t->num_dims-1, t->requires_grad);
-
-    result->parents = (Tensor**)malloc(sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in sum.\n");
-        free_tensor(result);
-        exit(EXIT_FAILURE);
-    }
-    result->parents[0] = t;
-    result->num_parents = 1;
-    result->backward_func = backward_sum;
+/* Sum over the last dim with pairwise summation, see reduce.c */
+Tensor* sum(Tensor* t) {
+    Tensor* result = create_op_result(t->shape, t->num_dims-1, &t, 1, backward_sum);
+    result->forward_func = forward_sum;
+    forward_sum(result);
 
     return result;
 }
 
-/* Sum all elements across dimensions */
+void forward_reduce_sum(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    result->data[0] = parallel_sum(t_data, t->size);
+    release_contiguous_data(t, t_data);
+}
+
+/* Sum all elements across dimensions with a pairwise sum split across threads */
 Tensor* reduce_sum(Tensor* t) {
     int result_shape[1] = {1};
-    float result_data[1] = {0};
-    for (int i=0; i < t->size; i++) {
-        result_data[0] += t->data[i];
+    Tensor* result = create_lazy_op_result(result_shape, 1, &t, 1, backward_reduce_sum);
+    result->forward_func = forward_reduce_sum;
+    if (!record_lazy_op(result, FUSED_SUM)) forward_reduce_sum(result);
+
+    return result;
+}
+
+void forward_matmul(Tensor* result) {
+    Tensor* a = result->parents[0];
+    Tensor* b = result->parents[1];
+    long long a_row_stride, a_col_stride, b_row_stride, b_col_stride;
+    float* a_data = matmul_operand(a, &a_row_stride, &a_col_stride);
+    float* b_data = matmul_operand(b, &b_row_stride, &b_col_stride);
+
+    // Case 1: One or both of the tensors are 1D
+    if (a->num_dims == 1 || b->num_dims == 1) {
+        // Get the 1D tensor (both can be 1D)
+        Tensor* t_other = a->num_dims == 1 ? b : a;
+        float* data_1d = a->num_dims == 1 ? a_data : b_data;
+        float* data_other = a->num_dims == 1 ? b_data : a_data;
+        long long other_row_stride = a->num_dims == 1 ? b_row_stride : a_row_stride;
+        long long other_col_stride = a->num_dims == 1 ? b_col_stride : a_col_stride;
+
+        int last_dim_size = t_other->shape[t_other->num_dims-1];
+        for (long long i = 0; i < result->size; i++) {
+            result->data[i] = 0;
+            for (int j=0; j < last_dim_size; j++) {
+                result->data[i] += data_1d[j] * data_other[i*other_row_stride + j*other_col_stride];
+            }
+        }
     }
-    
-    Tensor* result = create_tensor(result_data, result_shape, 1, t->requires_grad);
+    // Case 2: Both tensors have arbitrary shapes 2D+
+    else {
+        int num_leading_dims = result->num_dims - 2;
+        long long leading_dims_size = 1;
+        for (int i = 0; i < num_leading_dims; i++) {
+            leading_dims_size *= result->shape[i];
+        }
 
-    result->parents = (Tensor**)malloc(sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in reduce_sum.\n");
-        free_tensor(result);
-        exit(EXIT_FAILURE);
+        int M = result->shape[num_leading_dims]; // 2nd last dim in shape [.., .., M, ..]
+        int N = result->shape[num_leading_dims + 1]; // last dim in shape [.., .., .., N]
+        int K = a->shape[a->num_dims-1]; // last dim in a [.., .., .., K]
+
+        MatmulBatches batches = {M, N, K, a_data, a_row_stride, a_col_stride, a->size,
+                                 b_data, b_row_stride, b_col_stride, b->size, result->data, NULL, NULL, {0}};
+        init_matmul_batches(&batches, result, a, b);
+        run_matmul_batches(&batches, leading_dims_size, 0);
     }
-    result->parents[0] = t;
-    result->num_parents = 1;
-    result->backward_func = backward_reduce_sum;
 
-    return result;
+    release_contiguous_data(a, a_data);
+    release_contiguous_data(b, b_data);
 }
 
 Tensor* matmul(Tensor* a, Tensor* b) {
@@ -243,20 +593,18 @@ Tensor* matmul(Tensor* a, Tensor* b) {
         handle_shape_mismatch(a, b);
     }
 
+    Tensor* parents[2] = {a, b};
+    Tensor* result;
     int result_dims;
-    float* result_data;
     int* shape;
-    int result_size = 1;
 
     // Case 1: One or both of the tensors are 1D
     if (a->num_dims == 1 || b->num_dims == 1) {
-        // Get the 1D tensor (both can be 1D)
-        Tensor* t_1d = a->num_dims == 1 ? a : b;
         Tensor* t_other = a->num_dims == 1 ? b : a;
 
         // Drop the last dim for the result and ensure it is at least 1
         result_dims = t_other->num_dims-1 < 1 ? 1 : t_other->num_dims-1;
-        shape = (int*)malloc(result_dims * sizeof(int));
+        shape = (int*)malloc(t_other->num_dims * sizeof(int));
 
         if (a->num_dims == 1 && b->num_dims == 1) { // both 1D
             shape[0] = 1;
@@ -265,15 +613,6 @@ Tensor* matmul(Tensor* a, Tensor* b) {
             for (int i=0; i < t_other->num_dims; i++) {
                 shape[i] = t_other->shape[i]; // copy the shape
             }
-            result_size = t_other->size;
-        }
-        
-        result_data = (float*)calloc(result_size, sizeof(float));
-        int last_dim_size = t_other->shape[t_other->num_dims-1];
-        for (int i = 0; i < result_size; i++) {
-            for (int j=0; j < last_dim_size; j++) {
-                result_data[i] += t_1d->data[j] * t_other->data[i*last_dim_size + j];
-            }
         }
     } 
     // Case 2: Both tensors have arbitrary shapes 2D+
@@ -281,147 +620,335 @@ Tensor* matmul(Tensor* a, Tensor* b) {
         result_dims = a->num_dims > b->num_dims ? a->num_dims : b->num_dims;
         int num_leading_dims = result_dims - 2; // Number of leading dimensions (batch or arbitrary)
         
-        // Get the shape after broadcasting
+        // Get the shape after broadcasting the leading dims
         shape = (int*)malloc(result_dims * sizeof(int));
-        for (int i = 0; i < num_leading_dims; i++) {
-            shape[i] = a->shape[i] > b->shape[i] ? a->shape[i] : b->shape[i];;
-        }
+        broadcast_shapes(a->shape, a->num_dims-2, b->shape, b->num_dims-2, shape);
         shape[num_leading_dims] = a->shape[a->num_dims-2];
         shape[num_leading_dims + 1] = b->shape[b->num_dims-1];
+    }
 
-        // Calculate the sizes
-        int leading_dims_size = 1;
-        for (int i = 0; i < result_dims; i++) {
-            result_size *= shape[i];
-            if (i < num_leading_dims) leading_dims_size *= shape[i];
-        }
+    result = create_op_result(shape, result_dims, parents, 2, backward_matmul);
+    result->forward_func = forward_matmul;
+    forward_matmul(result);
+    free(shape);
 
-        // Initialise the result array to zeros since we are summing not assigning
-        result_data = (float*)calloc(result_size, sizeof(float));
-
-        int M = shape[num_leading_dims]; // 2nd last dim in shape [.., .., M, ..]
-        int N = shape[num_leading_dims + 1]; // last dim in shape [.., .., .., N]
-        int K = a->shape[num_leading_dims + 1]; // last dim in a [.., .., .., K]
-
-        for (int batch = 0; batch < leading_dims_size; batch++) {
-            // Calculate offsets since matrix elements are a flattened 1D array
-            int offset_a = (batch * M * K) % a->size;
-            int offset_b = (batch * K * N) % b->size;
-            int offset_result = batch * M * N;
-            // loop over last two dims
-            for (int i = 0; i < M; i++) { // each row in result
-                for (int j = 0; j < N; j++) { // each column in result
-                    for (int k = 0; k < K; k++) {  // each column of a
-                        // a->data[offset_a + i * K + k] goes through each column of a and increments the row i
-                        // b->data[offset_b + k * N + j] goes through each row of b and increments the column with j
-                        result_data[offset_result + i * N + j] += a->data[offset_a + i * K + k] * b->data[offset_b + k * N + j];
-                    }
-                }
-            }
-        }
-    }
+    return result;
+}
 
-    int requires_grad = a->requires_grad || b->requires_grad;
-    Tensor* result = create_tensor(result_data, shape, result_dims, requires_grad);
+void forward_mul(Tensor* result) {
+    Tensor* a = result->parents[0];
+    Tensor* b = result->parents[1];
+    float* a_data = contiguous_data(a);
+    float* b_data = contiguous_data(b);
+    BroadcastIter it;
+    init_binary_iter(&it, result, result, a, b);
+    float* data[3] = {result->data, a_data, b_data};
+    broadcast_for_each(&it, data, COST_ADD, mul_run, NULL);
+    release_contiguous_data(a, a_data);
+    release_contiguous_data(b, b_data);
+}
 
-    result->parents = (Tensor**)malloc(2 * sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in matmul.\n");
-        free_tensor(result);
-        exit(EXIT_FAILURE);
-    }
-    result->parents[0] = a;
-    result->parents[1] = b;
-    result->num_parents = 2;
-    result->backward_func = backward_matmul;
+Tensor* mul(Tensor* a, Tensor* b) {
+    Tensor* result = create_broadcast_result(a, b, backward_mul);
+    result->forward_func = forward_mul;
+    if (!record_lazy_op(result, FUSED_MUL)) forward_mul(result);
 
-    free(result_data);
-    free(shape);
+    return result;
+}
+
+void forward_relu(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    parallel_unary(kernels.relu, t_data, result->data, t->size, COST_ADD);
+    release_contiguous_data(t, t_data);
+}
 
+Tensor* relu(Tensor* t) {
+    Tensor* result = create_lazy_op_result(t->shape, t->num_dims, &t, 1, backward_relu);
+    result->forward_func = forward_relu;
+    if (!record_lazy_op(result, FUSED_RELU)) forward_relu(result);
     return result;
 }
 
-Tensor* mul(Tensor* a, Tensor* b) {
-    // Ensure that the tensors are compatible for mul
-    if (!is_broadcastable(a, b)) {
-        handle_shape_mismatch(a, b);
-    }
+void forward_sigmoid(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    parallel_unary(kernels.sigmoid, t_data, result->data, t->size, COST_SIGMOID);
+    release_contiguous_data(t, t_data);
+}
+
+Tensor* sigmoid(Tensor* t) {
+    Tensor* result = create_lazy_op_result(t->shape, t->num_dims, &t, 1, backward_sigmoid);
+    result->forward_func = forward_sigmoid;
+    if (!record_lazy_op(result, FUSED_SIGMOID)) forward_sigmoid(result);
+    return result;
+}
 
-    // Calculate the shape of the result with broadcasting
-    int result_dims = a->num_dims > b->num_dims ? a->num_dims : b->num_dims;
-    int shape[result_dims];
+void forward_tanh(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    parallel_unary(kernels.tanh, t_data, result->data, t->size, COST_TANH);
+    release_contiguous_data(t, t_data);
+}
 
-    int result_size = 1;
-    for (int i = 0; i < result_dims; i++) {
-        // Tensors may have differing number of dims
-        if (i < a->num_dims && i < b->num_dims) {
-            shape[i] = a->shape[i] > b->shape[i] ? a->shape[i] : b->shape[i];
-        } 
-        else if (i >= a->num_dims) {
-            shape[i] = b->shape[i];
-        } else {
-            shape[i] = a->shape[i];
-        }
-        result_size *= shape[i];
+/* Named so it doesn't clash with tanh from math.h */
+Tensor* tensor_tanh(Tensor* t) {
+    Tensor* result = create_lazy_op_result(t->shape, t->num_dims, &t, 1, backward_tanh);
+    result->forward_func = forward_tanh;
+    if (!record_lazy_op(result, FUSED_TANH)) forward_tanh(result);
+    return result;
+}
+
+void forward_gelu(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    parallel_unary(kernels.gelu, t_data, result->data, t->size, COST_GELU);
+    release_contiguous_data(t, t_data);
+}
+
+/* GELU with the tanh approximation, 0.5 * x * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3))) */
+Tensor* gelu(Tensor* t) {
+    Tensor* result = create_lazy_op_result(t->shape, t->num_dims, &t, 1, backward_gelu);
+    result->forward_func = forward_gelu;
+    if (!record_lazy_op(result, FUSED_GELU)) forward_gelu(result);
+    return result;
+}
+
+void forward_silu(Tensor* result) {
+    Tensor* t = result->parents[0];
+    float* t_data = contiguous_data(t);
+    parallel_unary(kernels.silu, t_data, result->data, t->size, COST_SIGMOID);
+    release_contiguous_data(t, t_data);
+}
+
+/* x * sigmoid(x) */
+Tensor* silu(Tensor* t) {
+    Tensor* result = create_lazy_op_result(t->shape, t->num_dims, &t, 1, backward_silu);
+    result->forward_func = forward_silu;
+    if (!record_lazy_op(result, FUSED_SILU)) forward_silu(result);
+    return result;
+}
+
+void forward_contiguous(Tensor* result) {
+    Tensor* t = result->parents[0];
+    materialize(t);
+    gather_strided(t, t->data, result->data);
+}
+
+/* Copy a strided tensor into a new contiguous tensor */
+Tensor* contiguous(Tensor* t) {
+    Tensor* result = create_op_result(t->shape, t->num_dims, &t, 1, backward_contiguous);
+    result->forward_func = forward_contiguous;
+    forward_contiguous(result);
+    return result;
+}
+
+/* View the elements of t with a different shape of the same size. Strided tensors are
+   copied into a contiguous tensor first. */
+Tensor* reshape(Tensor* t, int* shape, int num_dims) {
+    long long size = 1;
+    for (int i = 0; i < num_dims; i++) {
+        size *= shape[i];
+    }
+    if (size != t->size) {
+        printf("Cannot reshape a tensor of size %lld into a tensor of size %lld!\n", t->size, size);
+        free_graph_from_tensor(t);
+        exit(EXIT_FAILURE);
     }
 
-    float result_data[result_size];
-    for (int i = 0; i < result_size; i++) {
-        result_data[i] = a->data[i % a->size] * b->data[i % b->size];    
+    Tensor* base = is_contiguous(t) ? t : contiguous(t);
+    long long* strides = alloc_strides(num_dims);
+    long long stride = 1;
+    for (int i = num_dims-1; i >= 0; i--) {
+        strides[i] = stride;
+        stride *= shape[i];
     }
+    Tensor* view = create_view(base, shape, strides, num_dims, 0);
+    free(strides);
+    return view;
+}
 
-    int requires_grad = a->requires_grad || b->requires_grad;
-    Tensor* result = create_tensor(result_data, shape, result_dims, requires_grad);
+/* View t with two of its dims swapped */
+Tensor* transpose(Tensor* t, int dim0, int dim1) {
+    if (dim0 < 0 || dim0 >= t->num_dims || dim1 < 0 || dim1 >= t->num_dims) {
+        printf("Cannot transpose dims %d and %d of a tensor with %d dims!\n", dim0, dim1, t->num_dims);
+        free_graph_from_tensor(t);
+        exit(EXIT_FAILURE);
+    }
+
+    int* shape = copy_shape(t);
+    long long* strides = alloc_strides(t->num_dims);
+    for (int i = 0; i < t->num_dims; i++) {
+        strides[i] = t->strides[i];
+    }
+    shape[dim0] = t->shape[dim1];
+    shape[dim1] = t->shape[dim0];
+    strides[dim0] = t->strides[dim1];
+    strides[dim1] = t->strides[dim0];
+    Tensor* view = create_view(t, shape, strides, t->num_dims, 0);
+    free(shape);
+    free(strides);
+    return view;
+}
 
-    result->parents = (Tensor**)malloc(2 * sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in mul.\n");
-        free_tensor(result);
+/* View the indices [start, end) of t along dim. Slicing rows of a batch (dim 0)
+   keeps the view contiguous. */
+Tensor* slice(Tensor* t, int dim, int start, int end) {
+    if (dim < 0 || dim >= t->num_dims || start < 0 || end > t->shape[dim] || start >= end) {
+        printf("Invalid slice [%d, %d) of dim %d!\n", start, end, dim);
+        free_graph_from_tensor(t);
         exit(EXIT_FAILURE);
     }
-    result->parents[0] = a;
-    result->parents[1] = b;
-    result->num_parents = 2;
-    result->backward_func = backward_mul;
 
-    return result;
+    int* shape = copy_shape(t);
+    shape[dim] = end - start;
+    Tensor* view = create_view(t, shape, t->strides, t->num_dims, start * t->strides[dim]);
+    free(shape);
+    return view;
 }
 
-Tensor* relu(Tensor* t) {
-    float activations[t->size];
-    for (int i = 0; i < t->size; ++i) {
-        activations[i] = t->data[i] > 0 ? t->data[i] : 0;
+/* Shared backward of dense. dZ = dY * activation'(Y) is computed in one pass over the
+   result grad, which also sums db, then dW += X^T @ dZ and dX += dZ @ W^T. */
+static void backward_dense(Tensor* result, Activation activation) {
+    Tensor* input = result->parents[0];
+    Tensor* weights = result->parents[1];
+    Tensor* biases = result->parents[2];
+    // at least one parent has to need grads, the error is reported for the input
+    if (!input->requires_grad && !weights->requires_grad && !biases->requires_grad) {
+        ensure_requires_grad(input);
     }
-    
-    Tensor* result = create_tensor(activations, t->shape, t->num_dims, t->requires_grad);
 
-    result->parents = (Tensor**)malloc(sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in relu.\n");
-        free_tensor(result);
-        exit(EXIT_FAILURE);
+    int in_features = weights->shape[0];
+    int out_features = weights->shape[1];
+    long long rows = result->size / out_features;
+
+    float* dz = result->grad;
+    if (activation != ACTIVATION_NONE) {
+        dz = (float*)calloc(result->size, sizeof(float));
+        if (!dz) {
+            fprintf(stderr, "Memory allocation failed when allocating the dense backward buffer.\n");
+            exit(EXIT_FAILURE);
+        }
     }
-    result->parents[0] = t;
-    result->num_parents = 1;
-    result->backward_func = backward_relu;
-    return result;
+    float* b_grad = biases->requires_grad ? contiguous_grad(biases) : NULL;
+    for (long long i = 0; i < rows; i++) {
+        long long offset = i * out_features;
+        if (activation == ACTIVATION_RELU) {
+            kernels.relu_backward(result->data + offset, result->grad + offset, dz + offset, out_features);
+        } else if (activation == ACTIVATION_SIGMOID) {
+            kernels.sigmoid_backward(result->data + offset, result->grad + offset, dz + offset, out_features);
+        } else if (activation == ACTIVATION_TANH) {
+            kernels.tanh_backward(result->data + offset, result->grad + offset, dz + offset, out_features);
+        }
+        if (b_grad) kernels.add(b_grad, dz + offset, b_grad, out_features);
+    }
+    if (b_grad) commit_contiguous_grad(biases, b_grad);
+
+    if (weights->requires_grad) {
+        float* x_data = contiguous_data(input);
+        float* w_grad = contiguous_grad(weights);
+        gemm(in_features, out_features, rows, x_data, 1, in_features, dz, out_features, 1,
+             w_grad, out_features, 1);
+        commit_contiguous_grad(weights, w_grad);
+        release_contiguous_data(input, x_data);
+    }
+    if (input->requires_grad) {
+        float* x_grad = contiguous_grad(input);
+        gemm(rows, in_features, out_features, dz, out_features, 1,
+             weights->data, weights->strides[1], weights->strides[0], x_grad, in_features, 1);
+        commit_contiguous_grad(input, x_grad);
+    }
+
+    if (dz != result->grad) free(dz);
 }
 
-Tensor* sigmoid(Tensor* t) {
-    float activations[t->size];
-    for (int i = 0; i < t->size; ++i) {
-        activations[i] = 1 / (1 + exp(-t->data[i]));
+void backward_dense_linear(Tensor* result) {
+    backward_dense(result, ACTIVATION_NONE);
+}
+
+void backward_dense_relu(Tensor* result) {
+    backward_dense(result, ACTIVATION_RELU);
+}
+
+void backward_dense_sigmoid(Tensor* result) {
+    backward_dense(result, ACTIVATION_SIGMOID);
+}
+
+void backward_dense_tanh(Tensor* result) {
+    backward_dense(result, ACTIVATION_TANH);
+}
+
+/* activation(input @ weights + biases). The bias and activation are applied by the gemm
+   epilogue while each tile of the result is in cache. */
+static void forward_dense_activation(Tensor* result, Activation activation) {
+    Tensor* input = result->parents[0];
+    Tensor* weights = result->parents[1];
+    Tensor* biases = result->parents[2];
+    int in_features = weights->shape[0];
+    int out_features = weights->shape[1];
+    long long rows = input->size / in_features;
+
+    float* x_data = contiguous_data(input);
+    float* b_data = contiguous_data(biases);
+    materialize(weights); // read in place through its strides
+    gemm_bias_activation(rows, out_features, in_features, x_data, in_features, 1,
+                         weights->data, weights->strides[0], weights->strides[1],
+                         result->data, out_features, 0, b_data, get_activation_kernel(activation));
+    release_contiguous_data(input, x_data);
+    release_contiguous_data(biases, b_data);
+}
+
+void forward_dense_linear(Tensor* result) {
+    forward_dense_activation(result, ACTIVATION_NONE);
+}
+
+void forward_dense_relu(Tensor* result) {
+    forward_dense_activation(result, ACTIVATION_RELU);
+}
+
+void forward_dense_sigmoid(Tensor* result) {
+    forward_dense_activation(result, ACTIVATION_SIGMOID);
+}
+
+void forward_dense_tanh(Tensor* result) {
+    forward_dense_activation(result, ACTIVATION_TANH);
+}
+
+/* activation(input @ weights + biases) in one op without intermediate tensors.
+   Weights must be 2D [in, out] and the biases hold out values. The grads of relu,
+   sigmoid and tanh come from the result, GELU and SiLU need the value before the
+   activation, so for them it is kept in its own tensor and the activation is a
+   separate op. */
+Tensor* dense(Tensor* input, Tensor* weights, Tensor* biases, Activation activation) {
+    if (weights->num_dims != 2 || input->shape[input->num_dims-1] != weights->shape[0]) {
+        handle_shape_mismatch(input, weights);
+    }
+    if (biases->size != weights->shape[1]) {
+        handle_shape_mismatch(weights, biases);
     }
-    Tensor* result = create_tensor(activations, t->shape, t->num_dims, t->requires_grad);
 
-    result->parents = (Tensor**)malloc(sizeof(Tensor*));
-    if (!result->parents) {
-        fprintf(stderr, "Memory allocation failed in sigmoid.\n");
-        free_tensor(result);
-        exit(EXIT_FAILURE);
+    void (*forward_func)(Tensor*) = forward_dense_linear;
+    void (*backward_func)(Tensor*) = backward_dense_linear;
+    if (activation == ACTIVATION_RELU) {
+        forward_func = forward_dense_relu;
+        backward_func = backward_dense_relu;
+    } else if (activation == ACTIVATION_SIGMOID) {
+        forward_func = forward_dense_sigmoid;
+        backward_func = backward_dense_sigmoid;
+    } else if (activation == ACTIVATION_TANH) {
+        forward_func = forward_dense_tanh;
+        backward_func = backward_dense_tanh;
     }
-    result->parents[0] = t;
-    result->num_parents = 1;
-    result->backward_func = backward_sigmoid;
+
+    int* shape = copy_shape(input);
+    shape[input->num_dims-1] = weights->shape[1];
+    Tensor* parents[3] = {input, weights, biases};
+    Tensor* result = create_op_result(shape, input->num_dims, parents, 3, backward_func);
+    free(shape);
+    result->forward_func = forward_func;
+    forward_func(result);
+
+    if (activation == ACTIVATION_GELU) return gelu(result);
+    if (activation == ACTIVATION_SILU) return silu(result);
     return result;
-}
\ No newline at end of file
+}
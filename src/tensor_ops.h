@@ -3,6 +3,16 @@
 
 #include "tensor.h"
 
+// Activations that can be fused into other ops, such as the epilogue of dense
+typedef enum {
+    ACTIVATION_NONE,
+    ACTIVATION_RELU,
+    ACTIVATION_SIGMOID,
+    ACTIVATION_TANH,
+    ACTIVATION_GELU,
+    ACTIVATION_SILU
+} Activation;
+
 Tensor* add(Tensor* a, Tensor* b); 
 Tensor* sum(Tensor* t);
 Tensor* reduce_sum(Tensor* t);
@@ -10,5 +20,13 @@ Tensor* matmul(Tensor* a, Tensor* b);
 Tensor* mul(Tensor* a, Tensor* b);
 Tensor* relu(Tensor* input);
 Tensor* sigmoid(Tensor* input);
+Tensor* tensor_tanh(Tensor* input);
+Tensor* gelu(Tensor* input);
+Tensor* silu(Tensor* input);
+Tensor* contiguous(Tensor* t);
+Tensor* reshape(Tensor* t, int* shape, int num_dims);
+Tensor* transpose(Tensor* t, int dim0, int dim1);
+Tensor* slice(Tensor* t, int dim, int start, int end);
+Tensor* dense(Tensor* input, Tensor* weights, Tensor* biases, Activation activation);
 
 #endif // TENSOROPS_H
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "thread_pool.h"
+
+/* A persistent pool of worker threads. parallel_for() publishes a job made of equal
+   chunks, wakes the workers and the calling thread takes chunks alongside them until
+   all are done. Workers sleep on a condition variable between jobs. */
+
+typedef struct ParallelJob {
+    ParallelForFunc func;
+    void* ctx;
+    long long n;
+    long long chunk_size;
+    int num_chunks;
+    atomic_int next_chunk;
+    int chunks_done;
+} ParallelJob;
+
+static int num_threads = 0; // 0 until read from the environment
+static pthread_t* workers = NULL;
+static int num_workers = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER; // one job at a time
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static ParallelJob job;
+static unsigned long job_generation = 0;
+static int active_workers = 0; // workers that have joined the current job and not left it
+static int shutting_down = 0;
+
+// Set on worker threads and on the caller while it runs a job, so nested loops run serially
+static _Thread_local int inside_parallel_for = 0;
+
+static int default_num_threads(void) {
+    const char* env = getenv("MLP_NUM_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+#endif
+}
+
+/* Copy the description of the current job, the caller must hold pool_lock */
+static void copy_job(ParallelJob* current) {
+    current->func = job.func;
+    current->ctx = job.ctx;
+    current->n = job.n;
+    current->chunk_size = job.chunk_size;
+    current->num_chunks = job.num_chunks;
+}
+
+/* Take chunks of the current job until none are left, returns how many were run */
+static int run_chunks(ParallelJob* current) {
+    int completed = 0;
+    int chunk;
+    while ((chunk = atomic_fetch_add(&job.next_chunk, 1)) < current->num_chunks) {
+        long long start = chunk * current->chunk_size;
+        long long end = start + current->chunk_size < current->n ? start + current->chunk_size : current->n;
+        current->func(current->ctx, start, end);
+        completed++;
+    }
+    return completed;
+}
+
+static void* worker_loop(void* arg) {
+    (void)arg;
+    inside_parallel_for = 1;
+    unsigned long seen_generation = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    seen_generation = job_generation;
+    while (1) {
+        while (job_generation == seen_generation && !shutting_down) {
+            pthread_cond_wait(&work_ready, &pool_lock);
+        }
+        if (shutting_down) break;
+        seen_generation = job_generation;
+
+        // copy the job while holding the lock, it can't be replaced while we are active
+        ParallelJob current;
+        copy_job(&current);
+        active_workers++;
+        pthread_mutex_unlock(&pool_lock);
+
+        int completed = run_chunks(&current);
+
+        pthread_mutex_lock(&pool_lock);
+        job.chunks_done += completed;
+        active_workers--;
+        if (job.chunks_done == job.num_chunks && active_workers == 0) {
+            pthread_cond_broadcast(&work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+static void start_workers(void) {
+    num_workers = get_num_threads() - 1; // the calling thread does work as well
+    if (num_workers <= 0) {
+        num_workers = 0;
+        return;
+    }
+    workers = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation failed when allocating the thread pool.\n");
+        exit(EXIT_FAILURE);
+    }
+    shutting_down = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, worker_loop, NULL) != 0) {
+            // run with the threads we managed to start
+            fprintf(stderr, "Failed to start thread pool worker %d.\n", i);
+            num_workers = i;
+            break;
+        }
+    }
+}
+
+/* Stop and join the worker threads. They are started again by the next parallel_for. */
+void shutdown_thread_pool(void) {
+    pthread_mutex_lock(&submit_lock);
+    pthread_mutex_lock(&pool_lock);
+    shutting_down = 1;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+    shutting_down = 0;
+    pthread_mutex_unlock(&submit_lock);
+}
+
+/* Set the number of threads used by parallel loops, including the calling thread.
+   Defaults to the MLP_NUM_THREADS environment variable or the number of CPUs. */
+void set_num_threads(int threads) {
+    if (threads < 1) threads = 1;
+    if (workers) {
+        shutdown_thread_pool();
+    }
+    num_threads = threads;
+}
+
+int get_num_threads(void) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    return num_threads;
+}
+
+/* Number of items a task needs so that it does at least PARALLEL_MIN_WORK work */
+int grain_size_for_cost(long long cost_per_item) {
+    if (cost_per_item < 1) cost_per_item = 1;
+    long long grain = PARALLEL_MIN_WORK / cost_per_item;
+    return grain > 1 ? (int)grain : 1;
+}
+
+/* Call func over [0, n) split into at most one chunk per thread, each at least
+   grain_size items. Loops that are too small to split, and loops started from inside
+   another parallel_for, run on the calling thread. */
+void parallel_for(long long n, int grain_size, ParallelForFunc func, void* ctx) {
+    if (n <= 0) return;
+    if (grain_size < 1) grain_size = 1;
+
+    int threads = get_num_threads();
+    long long num_chunks = (n + grain_size - 1) / grain_size;
+    if (num_chunks > threads) num_chunks = threads;
+    if (num_chunks <= 1 || inside_parallel_for) {
+        func(ctx, 0, n);
+        return;
+    }
+
+    pthread_mutex_lock(&submit_lock);
+    if (!workers && threads > 1) {
+        start_workers();
+    }
+    if (num_workers == 0) {
+        pthread_mutex_unlock(&submit_lock);
+        func(ctx, 0, n);
+        return;
+    }
+
+    long long chunk_size = (n + num_chunks - 1) / num_chunks;
+    pthread_mutex_lock(&pool_lock);
+    // a worker may still be leaving the previous job
+    while (active_workers > 0) {
+        pthread_cond_wait(&work_done, &pool_lock);
+    }
+    job.func = func;
+    job.ctx = ctx;
+    job.n = n;
+    job.chunk_size = chunk_size;
+    job.num_chunks = (n + chunk_size - 1) / chunk_size;
+    job.chunks_done = 0;
+    atomic_store(&job.next_chunk, 0);
+    job_generation++;
+    pthread_cond_broadcast(&work_ready);
+    ParallelJob current;
+    copy_job(&current);
+    pthread_mutex_unlock(&pool_lock);
+
+    inside_parallel_for = 1;
+    int completed = run_chunks(&current);
+    inside_parallel_for = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    job.chunks_done += completed;
+    while (job.chunks_done < job.num_chunks || active_workers > 0) {
+        pthread_cond_wait(&work_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&submit_lock);
+}
@@ -0,0 +1,16 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Minimum amount of work (roughly in flops) worth handing to another thread
+#define PARALLEL_MIN_WORK 32768
+
+// Points to a function that processes the items [start, end) of a parallel loop
+typedef void (*ParallelForFunc)(void* ctx, long long start, long long end);
+
+void set_num_threads(int num_threads);
+int get_num_threads(void);
+int grain_size_for_cost(long long cost_per_item);
+void parallel_for(long long n, int grain_size, ParallelForFunc func, void* ctx);
+void shutdown_thread_pool(void);
+
+#endif // THREAD_POOL_H
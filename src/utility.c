@@ -7,6 +7,8 @@
 #include "tensor.h"
 #include "tensor_ops.h"
 #include "backward.h"
+#include "broadcast.h"
+#include "kernels.h"
 
 
 /* Return N evenly spaced numbers between two values. */
@@ -25,16 +27,16 @@ float* linspace(float start, float end, int n) {
 }
 
 /* Element-wise compare float arrays using relative and absolute tolerances */
-int compare_tensor_data(float* data1, float* data2, int size) {
+int compare_tensor_data(float* data1, float* data2, long long size) {
     float rtol = 0.00001;
     float atol = 0.00000001;
 
-    for (int i = 0; i < size; i++) {
+    for (long long i = 0; i < size; i++) {
         float diff = fabs(data1[i] - data2[i]);
         float tolerance = atol + rtol * fabs(data2[i]);
         
         if (diff > tolerance) {
-            printf("Mismatch at index %d: %.8lf != %.8lf\n", i, data1[i], data2[i]);
+            printf("Mismatch at index %lld: %.8lf != %.8lf\n", i, data1[i], data2[i]);
             return 0;
         }
     }
@@ -83,26 +85,11 @@ char* getTensorShapeString(Tensor* tensor) {
 
 /* Check if the shape of two tensors is broadcastable */
 int is_broadcastable(const Tensor* a, const Tensor* b) {
-    // Broadcasting valid conditions:
+    // Broadcasting valid conditions, comparing dims from the last one:
     // 1. Same size at dim
     // 2. 1 at dim
     // 3. dim does not exist
-
-    // Determine the larger and smaller tensors if they are not the same size
-    const Tensor* t1 = a->num_dims > b->num_dims ? a : b;
-    const Tensor* t2 = a->num_dims <= b->num_dims ? a : b;
-    const int diff = t1->num_dims - t2->num_dims;
-
-    int start_idx = t1->num_dims-1;
-    // single dim is treated differently so that it only iterates once
-    int end_idx = t2->num_dims == 1 ? t2->num_dims : t1->num_dims - t2->num_dims;
-    for (int i=start_idx; i >= end_idx; i--) {
-        // negate diff from i so that the last dims are aligned
-        if (t1->shape[i] != t2->shape[i-diff] && (t1->shape[i] != 1 && t2->shape[i-diff] != 1)) {
-            return 0;
-        }
-    }
-    return 1;
+    return broadcast_shapes(a->shape, a->num_dims, b->shape, b->num_dims, NULL) >= 0;
 }
 
 /* Check if the shape of two tensors is broadcastable for matrix multiplication */
@@ -117,28 +104,8 @@ int is_broadcastable_matmul(const Tensor* a, const Tensor* b) {
     if (a->shape[a->num_dims - 1] != b->shape[b->num_dims - 2]) {
         return 0;
     }
-    // Check leading dimensions for broadcasting
-    int num_leading_dims = a->num_dims - 2;
-    if (num_leading_dims > 0) {
-        // ignore last two dims
-        const Tensor* t1 = a->num_dims > b->num_dims ? a : b;
-        const Tensor* t2 = a->num_dims <= b->num_dims ? a : b;
-        const int diff = t1->num_dims - t2->num_dims;
-
-        int start_idx = t1->num_dims-1 -2;
-        // single dim is treated differently so that it only iterates once
-        int end_idx = t2->num_dims == 1 ? t2->num_dims-2 : t2->num_dims-1 -2;
-        if (end_idx <= 0) return 1; // no leading dims to compare
-
-        for (int i=start_idx; i >= end_idx; i--) {
-            // negate diff from i so that the last dims are aligned
-            if (t1->shape[i] != t2->shape[i-diff] && (t1->shape[i] != 1 && t2->shape[i-diff] != 1)) {
-                return 0;
-            }
-        }
-    }
-    
-    return 1;
+    // Check leading dimensions for broadcasting, ignoring the last two dims
+    return broadcast_shapes(a->shape, a->num_dims-2, b->shape, b->num_dims-2, NULL) >= 0;
 }
 
 /* Displays the tensor shapes then errors/exits */
@@ -160,22 +127,61 @@ void handle_shape_mismatch(Tensor* a, Tensor* b) {
     }
 }
 
-ActivationFuncPointer get_activation_func_from_str(char activation[]) {
+Activation get_activation_from_str(char activation[]) {
     if (activation == NULL) {
-        return NULL;
+        return ACTIVATION_NONE;
     }
     else if (strcmp(activation, "relu") == 0) 
     {
-        return relu;
+        return ACTIVATION_RELU;
     } 
     else if (strcmp(activation, "sigmoid") == 0)
     {
-        return sigmoid;
+        return ACTIVATION_SIGMOID;
+    }
+    else if (strcmp(activation, "tanh") == 0)
+    {
+        return ACTIVATION_TANH;
+    }
+    else if (strcmp(activation, "gelu") == 0)
+    {
+        return ACTIVATION_GELU;
+    }
+    else if (strcmp(activation, "silu") == 0)
+    {
+        return ACTIVATION_SILU;
     }
     else /* default: */
     {
         printf("Unknown activation function given... defaulting to ReLU.");
-        return relu;
+        return ACTIVATION_RELU;
+    }
+}
+
+ActivationFuncPointer get_activation_func(Activation activation) {
+    switch (activation) {
+        case ACTIVATION_RELU: return relu;
+        case ACTIVATION_SIGMOID: return sigmoid;
+        case ACTIVATION_TANH: return tensor_tanh;
+        case ACTIVATION_GELU: return gelu;
+        case ACTIVATION_SILU: return silu;
+        default: return NULL;
+    }
+}
+
+ActivationFuncPointer get_activation_func_from_str(char activation[]) {
+    return get_activation_func(get_activation_from_str(activation));
+}
+
+/* Kernel of an activation for the gemm epilogue, NULL for none */
+ActivationKernel get_activation_kernel(Activation activation) {
+    switch (activation) {
+        case ACTIVATION_RELU: return kernels.relu;
+        case ACTIVATION_SIGMOID: return kernels.sigmoid;
+        case ACTIVATION_TANH: return kernels.tanh;
+        case ACTIVATION_GELU: return kernels.gelu;
+        case ACTIVATION_SILU: return kernels.silu;
+        default: return NULL;
     }
 }
 
@@ -185,10 +191,10 @@ float generate_uniform_random_float(float min, float max) {
 }
 
 /* Return an array filled with uniformly sampled random floats between min and max */
-float* uniform_random_array(int size, float min, float max) {
+float* uniform_random_array(long long size, float min, float max) {
     float* arr = (float*)malloc(size * sizeof(float));
 
-    for (int i = 0; i < size; i ++) {
+    for (long long i = 0; i < size; i ++) {
         arr[i] = generate_uniform_random_float(min, max);
     }
     return arr;
@@ -244,12 +250,21 @@ void print_tensor_helper(float* values, int* shape, int dims, int depth, int off
 
 /* Recursively print a tensors data */
 void print_tensor(const Tensor* t, int print_grads) {
+    float* values = print_grads ? t->grad : t->data;
+    // Views are gathered into row-major order first
+    float* gathered = NULL;
+    if (!is_contiguous(t)) {
+        gathered = (float*)malloc(t->size * sizeof(float));
+        gather_strided(t, values, gathered);
+        values = gathered;
+    }
+
     if (print_grads) {
         printf("Tensor Gradients:\n");
-        print_tensor_helper(t->grad, t->shape, t->num_dims, 0, 0);
     } else {
         printf("Tensor Data:\n");
-        print_tensor_helper(t->data, t->shape, t->num_dims, 0, 0);
     }
+    print_tensor_helper(values, t->shape, t->num_dims, 0, 0);
     if (t->num_dims == 1) printf("\n");
+    free(gathered);
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../src/arena.h"
+#include "../src/backward.h"
+#include "../src/tensor.h"
+#include "../src/tensor_ops.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+void test_arena_alloc_aligned() {
+    Arena* arena = create_arena(256);
+
+    int aligned = 1;
+    for (int i = 0; i < 20; i++) {
+        // odd sizes and a request larger than the block size
+        void* ptr = arena_alloc(arena, i == 10 ? 1000 : 3 + i);
+        aligned = aligned && ((uintptr_t)ptr % ARENA_ALIGNMENT == 0);
+    }
+
+    if (aligned) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_arena_alloc_aligned:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_arena_alloc_aligned:");
+    }
+
+    free_arena(arena);
+}
+
+void test_arena_reset_reuses_memory() {
+    Arena* arena = create_arena(1024);
+
+    void* first = arena_alloc(arena, 100);
+    arena_alloc(arena, 2000); // spills into a second block
+    arena_reset(arena);
+    void* after_reset = arena_alloc(arena, 100);
+
+    if (first == after_reset) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_arena_reset_reuses_memory:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_arena_reset_reuses_memory:");
+    }
+
+    free_arena(arena);
+}
+
+void test_op_results_from_arena() {
+    int shape[] = {2, 2};
+    float data1[] = {1.0, -2.0, 3.0, -4.0};
+    float data2[] = {1.0, 1.0, 1.0, 1.0};
+    Tensor* t1 = create_tensor(data1, shape, 2, 1);
+    Tensor* t2 = create_tensor(data2, shape, 2, 1);
+
+    Arena* arena = create_arena(1 << 12);
+    set_tensor_arena(arena);
+
+    Tensor* out = relu(add(t1, t2));
+    Tensor* loss = reduce_sum(out);
+    Topo* topo = backward(loss);
+
+    float expected_data[] = {2.0, 0.0, 4.0, 0.0};
+    float expected_grads[] = {1.0, 0.0, 1.0, 0.0};
+
+    if (out->from_arena && !t1->from_arena && compare_tensor_data(out->data, expected_data, out->size)
+        && compare_tensor_data(t1->grad, expected_grads, t1->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_op_results_from_arena:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_op_results_from_arena:");
+    }
+
+    // free_graph_from_topo leaves arena tensors alone, the reset releases them
+    free_graph_from_topo(topo);
+    arena_reset(arena);
+    set_tensor_arena(NULL);
+
+    free_arena(arena);
+    free_tensor(t1);
+    free_tensor(t2);
+}
+
+int main() {
+    test_arena_alloc_aligned();
+    test_arena_reset_reuses_memory();
+    test_op_results_from_arena();
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/csv.h"
+#include "../src/dataset.h"
+#include "../src/thread_pool.h"
+
+const int PADDING_WIDTH = -35;
+
+/* The parser must agree with strtof to within an ulp */
+void test_parse_csv_float() {
+    const char* numbers[] = {"0", "-0.5", "+3", "12.", ".25", "1e3", "-1.5E-3", "123456789.123456789",
+                             "0.000000000000000000000000000000000000001", "3.4028234e38", "1e-50", "1e50",
+                             "12345678901234567890123", "7e", "2.5,3"};
+    int passed = 1;
+    for (int i = 0; i < (int)(sizeof(numbers) / sizeof(numbers[0])); i++) {
+        const char* end;
+        char* expected_end;
+        float value = parse_csv_float(numbers[i], &end);
+        float expected = strtof(numbers[i], &expected_end);
+        float tolerance = fabsf(nextafterf(expected, INFINITY) - expected);
+        if (end != expected_end || (value != expected && !(fabsf(value - expected) <= tolerance))) {
+            printf("Parsed %s as %.9g, expected %.9g\n", numbers[i], value, expected);
+            passed = 0;
+        }
+    }
+    const char* end;
+    parse_csv_float("abc", &end);
+    passed = passed && strcmp(end, "abc") == 0;
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_parse_csv_float:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_parse_csv_float:");
+    }
+}
+
+/* A file bigger than a chunk is split across threads and chunks without losing or
+   reordering rows */
+void test_load_csv_dataset() {
+    int rows = 900000;
+    FILE* f = fopen("test_csv.csv", "w");
+    fprintf(f, "x1,x2,x3,label\n");
+    for (int i = 0; i < rows; i++) {
+        fprintf(f, "%d,%.3f, %d ,%d\n", i, i * 0.5, -i, i % 3);
+        if (i % 100000 == 7) fprintf(f, "\r\n");
+    }
+    fclose(f);
+
+    set_num_threads(4);
+    Dataset* dataset = load_csv_dataset("test_csv.csv");
+
+    int passed = dataset->length == rows && dataset->num_features == 3;
+    for (int i = 0; i < rows && passed; i++) {
+        float* x = dataset->x + i * 3;
+        if (x[0] != i || x[1] != i * 0.5f || x[2] != -i || dataset->y[i] != i % 3) {
+            printf("Mismatch in row %d: %f %f %f %f\n", i, x[0], x[1], x[2], dataset->y[i]);
+            passed = 0;
+        }
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_load_csv_dataset:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_load_csv_dataset:");
+    }
+
+    free_dataset(dataset);
+    remove("test_csv.csv");
+    shutdown_thread_pool();
+}
+
+/* Blank lines before the header are skipped, the header is still recognised */
+void test_load_csv_leading_blank_line() {
+    FILE* f = fopen("test_csv_blank.csv", "w");
+    fprintf(f, "\n  \r\nx1,x2,label\n1,2,0\n\n3,4,1\n");
+    fclose(f);
+
+    Dataset* dataset = load_csv_dataset("test_csv_blank.csv");
+    float expected_x[] = {1, 2, 3, 4};
+    float expected_y[] = {0, 1};
+    int passed = dataset->length == 2 && dataset->num_features == 2 &&
+                 memcmp(dataset->x, expected_x, sizeof(expected_x)) == 0 &&
+                 memcmp(dataset->y, expected_y, sizeof(expected_y)) == 0;
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_load_csv_leading_blank_line:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_load_csv_leading_blank_line:");
+    }
+
+    free_dataset(dataset);
+    remove("test_csv_blank.csv");
+}
+
+int main() {
+    test_parse_csv_float();
+    test_load_csv_leading_blank_line();
+    test_load_csv_dataset();
+
+    return 0;
+}
@@ -1,7 +1,11 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../src/dataset.h"
 
+const int PADDING_WIDTH = -35;
+
 /* Create moons dataset and export the points to be visualised by 3rd party software e.g. python*/
 void test_moons_dataset() {
     Dataset* moons = create_moons(50, 50, 0.1);
@@ -12,8 +16,151 @@ void test_moons_dataset() {
     free(moons);
 }
 
+/* Dataset where both features and the label of sample i are i, so batches show which
+   samples they hold */
+Dataset* create_indexed_dataset(int length) {
+    Dataset* dataset = (Dataset*)malloc(sizeof(Dataset));
+    dataset->x = (float*)malloc(length * 2 * sizeof(float));
+    dataset->y = (float*)malloc(length * sizeof(float));
+    for (int i = 0; i < length; i++) {
+        dataset->x[i * 2] = i;
+        dataset->x[i * 2 + 1] = i;
+        dataset->y[i] = i;
+    }
+    dataset->length = length;
+    dataset->num_features = 2;
+    dataset->mapping = NULL;
+    dataset->mapping_size = 0;
+    return dataset;
+}
+
+/* Every sample appears once per epoch, in a different order each epoch */
+void test_data_loader_shuffle() {
+    int length = 103;
+    Dataset* dataset = create_indexed_dataset(length);
+    DataLoader* loader = create_data_loader(dataset, 10, 1, 0);
+
+    int passed = loader->num_batches == 11;
+    int first_epoch[103];
+    int same_order = 1;
+    for (int epoch = 0; epoch < 3; epoch++) {
+        int counts[103] = {0};
+        int position = 0;
+        for (int b = 0; b < loader->num_batches; b++) {
+            Batch* batch = data_loader_next(loader);
+            int expected_size = b == 10 ? 3 : 10;
+            if (batch->epoch != epoch || batch->index != b || batch->size != expected_size ||
+                batch->inputs->shape[0] != expected_size || batch->labels->size != expected_size ||
+                (size_t)batch->inputs->data % 64 != 0) {
+                passed = 0;
+            }
+            for (int i = 0; i < batch->size; i++) {
+                int sample = (int)batch->labels->data[i];
+                if (batch->inputs->data[i * 2] != sample || batch->inputs->data[i * 2 + 1] != sample) passed = 0;
+                counts[sample]++;
+                if (epoch == 0) first_epoch[position] = sample;
+                if (epoch == 1 && first_epoch[position] != sample) same_order = 0;
+                position++;
+            }
+        }
+        for (int i = 0; i < length; i++) {
+            if (counts[i] != 1) passed = 0;
+        }
+    }
+
+    if (passed && !same_order) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_data_loader_shuffle:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_data_loader_shuffle:");
+    }
+
+    free_data_loader(loader);
+    free_dataset(dataset);
+}
+
+/* Without shuffle batches follow the dataset, drop_last skips the short batch */
+void test_data_loader_drop_last() {
+    Dataset* dataset = create_indexed_dataset(25);
+    DataLoader* loader = create_data_loader(dataset, 8, 0, 1);
+
+    int passed = loader->num_batches == 3;
+    for (int step = 0; step < 7; step++) {
+        Batch* batch = data_loader_next(loader);
+        int b = step % 3;
+        if (batch->size != 8 || batch->index != b || batch->epoch != step / 3) passed = 0;
+        for (int i = 0; i < batch->size; i++) {
+            if (batch->labels->data[i] != b * 8 + i) passed = 0;
+        }
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_data_loader_drop_last:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_data_loader_drop_last:");
+    }
+
+    // freed while the loader thread is waiting with a batch ready
+    free_data_loader(loader);
+    free_dataset(dataset);
+}
+
+/* A saved dataset maps back with the same samples, straight from aligned file pages */
+void test_save_load_dataset_mmap() {
+    Dataset* moons = create_moons(50, 53, 0.1);
+    save_dataset("test_dataset.bin", moons);
+    Dataset* loaded = load_dataset_mmap("test_dataset.bin");
+
+    int passed = loaded->length == moons->length && loaded->num_features == moons->num_features &&
+                 loaded->mapping != NULL && (size_t)loaded->x % 64 == 0 && (size_t)loaded->y % 64 == 0 &&
+                 memcmp(loaded->x, moons->x, moons->length * 2 * sizeof(float)) == 0 &&
+                 memcmp(loaded->y, moons->y, moons->length * sizeof(float)) == 0;
+
+    // the views of a batch point into the mapping
+    Tensor* inputs = dataset_inputs_view(loaded, 10, 20);
+    passed = passed && inputs->data == loaded->x + 20;
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_save_load_dataset_mmap:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_save_load_dataset_mmap:");
+    }
+
+    free_tensor(inputs);
+    free_dataset(loaded);
+    free_dataset(moons);
+    remove("test_dataset.bin");
+}
+
+void test_convert_csv_to_dataset() {
+    FILE* f = fopen("test_dataset.csv", "w");
+    fprintf(f, "a,b,c,label\n1.5,2,3,0\n-4, 5e-1,6,1\r\n\n7,8,9.25,1\n");
+    fclose(f);
+    convert_csv_to_dataset("test_dataset.csv", "test_dataset.bin");
+    Dataset* loaded = load_dataset_mmap("test_dataset.bin");
+
+    float expected_x[] = {1.5, 2, 3, -4, 0.5, 6, 7, 8, 9.25};
+    float expected_y[] = {0, 1, 1};
+    int passed = loaded->length == 3 && loaded->num_features == 3 &&
+                 memcmp(loaded->x, expected_x, sizeof(expected_x)) == 0 &&
+                 memcmp(loaded->y, expected_y, sizeof(expected_y)) == 0;
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_convert_csv_to_dataset:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_convert_csv_to_dataset:");
+    }
+
+    free_dataset(loaded);
+    remove("test_dataset.csv");
+    remove("test_dataset.bin");
+}
+
 int main() {
     test_moons_dataset();
+    test_data_loader_shuffle();
+    test_data_loader_drop_last();
+    test_save_load_dataset_mmap();
+    test_convert_csv_to_dataset();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,255 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/backward.h"
+#include "../src/fusion.h"
+#include "../src/graph.h"
+#include "../src/reduce.h"
+#include "../src/tensor.h"
+#include "../src/tensor_ops.h"
+#include "../src/thread_pool.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+/* sum(tanh(gelu(x * y + c))), long enough to span several blocks */
+Tensor* chain_loss(Tensor* x, Tensor* y, Tensor* c) {
+    return reduce_sum(tensor_tanh(gelu(add(mul(x, y), c))));
+}
+
+void test_fused_chain() {
+    int shape[] = {70, 100};
+    int scalar_shape[] = {1};
+    float* x_data = uniform_random_array(7000, -2, 2);
+    float* y_data = uniform_random_array(7000, -2, 2);
+    float c_data[] = {0.25};
+    Tensor* x = create_tensor(x_data, shape, 2, 1);
+    Tensor* y = create_tensor(y_data, shape, 2, 1);
+    Tensor* c = create_tensor(c_data, scalar_shape, 1, 1);
+
+    Topo* topo = backward(chain_loss(x, y, c));
+    float expected_loss = topo->ordering[topo->length-1]->data[0];
+    float* expected_x_grad = (float*)malloc(7000 * sizeof(float));
+    float* expected_y_grad = (float*)malloc(7000 * sizeof(float));
+    memcpy(expected_x_grad, x->grad, 7000 * sizeof(float));
+    memcpy(expected_y_grad, y->grad, 7000 * sizeof(float));
+    float expected_c_grad = c->grad[0];
+    free_graph_from_topo(topo);
+    memset(x->grad, 0, 7000 * sizeof(float));
+    memset(y->grad, 0, 7000 * sizeof(float));
+    c->grad[0] = 0;
+
+    // The five ops become one op that reads x, y and c
+    set_lazy_mode(1);
+    Tensor* loss = chain_loss(x, y, c);
+    set_lazy_mode(0);
+    topo = backward(loss);
+    int passed = loss->fused && loss->fused->num_ops == 5 && loss->num_parents == 3;
+    passed = passed && compare_tensor_data(loss->data, &expected_loss, 1);
+    passed = passed && compare_tensor_data(x->grad, expected_x_grad, 7000);
+    passed = passed && compare_tensor_data(y->grad, expected_y_grad, 7000);
+    passed = passed && compare_tensor_data(c->grad, &expected_c_grad, 1);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_fused_chain:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_fused_chain:");
+    }
+
+    free_graph_from_topo(topo);
+    free_tensor(x);
+    free_tensor(y);
+    free_tensor(c);
+    free(x_data);
+    free(y_data);
+    free(expected_x_grad);
+    free(expected_y_grad);
+}
+
+/* A fused sum adds the same blocks in the same order as reduce_sum, in the default
+   mode too, where the number of pieces depends on the size and the threads */
+void test_fused_reduce_sum_bitwise() {
+    float* w_data = uniform_random_array(300000, -1, 1);
+
+    int passed = 1;
+    set_deterministic_reductions(0);
+    for (int rows = 5; rows <= 300; rows += 7) {
+        int shape[] = {rows, 1000};
+        Tensor* w = create_tensor(w_data, shape, 2, 1);
+        for (int threads = 1; threads <= 3; threads += 2) {
+            set_num_threads(threads);
+            Tensor* expected = reduce_sum(mul(w, w));
+            set_lazy_mode(1);
+            Tensor* fused = reduce_sum(mul(w, w));
+            set_lazy_mode(0);
+            materialize(fused);
+            passed = passed && fused->fused && memcmp(fused->data, expected->data, sizeof(float)) == 0;
+            free_graph_from_tensor(expected);
+            free_graph_from_tensor(fused);
+        }
+        free_tensor(w);
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_fused_reduce_sum_bitwise:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_fused_reduce_sum_bitwise:");
+    }
+
+    set_num_threads(1);
+    free(w_data);
+}
+
+/* A captured graph replays the fused op on new inputs */
+void test_fused_graph_replay() {
+    int shape[] = {70, 100};
+    int scalar_shape[] = {1};
+    float* x_data = uniform_random_array(7000, -2, 2);
+    float* y_data = uniform_random_array(7000, -2, 2);
+    float* new_x_data = uniform_random_array(7000, -2, 2);
+    float c_data[] = {-0.5};
+    Tensor* x = create_tensor(x_data, shape, 2, 1);
+    Tensor* y = create_tensor(y_data, shape, 2, 1);
+    Tensor* c = create_tensor(c_data, scalar_shape, 1, 1);
+
+    set_lazy_mode(1);
+    Graph* graph = capture_graph(chain_loss(x, y, c));
+    set_lazy_mode(0);
+    memcpy(x->data, new_x_data, 7000 * sizeof(float));
+    graph_forward(graph);
+    Tensor* expected = chain_loss(x, y, c);
+
+    if (graph->output->fused && compare_tensor_data(graph->output->data, expected->data, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_fused_graph_replay:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_fused_graph_replay:");
+    }
+
+    free_graph(graph);
+    free_graph_from_tensor(expected);
+    free_tensor(x);
+    free_tensor(y);
+    free_tensor(c);
+    free(x_data);
+    free(y_data);
+    free(new_x_data);
+}
+
+/* A result read by two ops is computed, its readers fuse on top of it */
+void test_shared_result_not_fused() {
+    int shape[] = {4, 3};
+    float* x_data = uniform_random_array(12, -1, 1);
+    Tensor* x = create_tensor(x_data, shape, 2, 1);
+
+    set_lazy_mode(1);
+    Tensor* h = relu(x);
+    Tensor* out = add(sigmoid(h), tensor_tanh(h));
+    set_lazy_mode(0);
+    materialize(out);
+    Tensor* expected = relu(x);
+
+    int passed = !h->fused && out->fused && out->fused->num_ops == 3 && out->num_parents == 1;
+    passed = passed && compare_tensor_data(h->data, expected->data, 12);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_shared_result_not_fused:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_shared_result_not_fused:");
+    }
+
+    free_graph_from_tensor(out);
+    free_graph_from_tensor(expected);
+    free_tensor(x);
+    free(x_data);
+}
+
+/* Recorded ops get their data when they run and their grads when backward needs them,
+   the results fused into a later op never get either */
+void test_lazy_buffers_deferred() {
+    int shape[] = {50, 40};
+    float* x_data = uniform_random_array(2000, -1, 1);
+    Tensor* x = create_tensor(x_data, shape, 2, 1);
+
+    Tensor* h = relu(x);
+    Topo* topo = backward(reduce_sum(add(sigmoid(h), tensor_tanh(h))));
+    float* expected_x_grad = (float*)malloc(2000 * sizeof(float));
+    memcpy(expected_x_grad, x->grad, 2000 * sizeof(float));
+    free_graph_from_topo(topo);
+    memset(x->grad, 0, 2000 * sizeof(float));
+
+    set_lazy_mode(1);
+    h = relu(x);
+    Tensor* out = reduce_sum(add(sigmoid(h), tensor_tanh(h)));
+    set_lazy_mode(0);
+    int passed = !h->data && !h->grad && !out->data && !out->grad;
+
+    // h is read twice so it runs on its own, the other ops are fused into the sum
+    materialize(out);
+    passed = passed && h->data && !h->grad && out->data && !out->grad;
+    passed = passed && out->fused && out->fused->num_absorbed == 3;
+    topo = backward(out);
+    passed = passed && h->grad && out->grad;
+    for (int i = 0; out->fused && i < out->fused->num_absorbed; i++) {
+        passed = passed && !out->fused->absorbed[i]->data && !out->fused->absorbed[i]->grad;
+    }
+    passed = passed && compare_tensor_data(x->grad, expected_x_grad, 2000);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_lazy_buffers_deferred:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_lazy_buffers_deferred:");
+    }
+
+    free_graph_from_topo(topo);
+    free_tensor(x);
+    free(x_data);
+    free(expected_x_grad);
+}
+
+/* Ops that read values, like matmul and views, materialize recorded ops first */
+void test_materialize_on_read() {
+    int x_shape[] = {2, 3};
+    int w_shape[] = {3, 2};
+    float x_data[] = {1, -2, 3, -4, 5, -6};
+    float w_data[] = {1, 2, 3, 4, 5, 6};
+    Tensor* x = create_tensor(x_data, x_shape, 2, 1);
+    Tensor* w = create_tensor(w_data, w_shape, 2, 1);
+
+    set_lazy_mode(1);
+    Tensor* product = matmul(relu(x), w);
+    Tensor* column = slice(silu(x), 1, 1, 2);
+    set_lazy_mode(0);
+
+    float expected_product[] = {16, 20, 15, 20};
+    float* column_data = contiguous_data(column);
+    float expected_column[] = {-2 / (1 + expf(2)), 5 / (1 + expf(-5))};
+    int passed = compare_tensor_data(product->data, expected_product, 4);
+    passed = passed && compare_tensor_data(column_data, expected_column, 2);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_materialize_on_read:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_materialize_on_read:");
+    }
+
+    release_contiguous_data(column, column_data);
+    free_graph_from_tensor(product);
+    free_graph_from_tensor(column);
+    free_tensor(x);
+    free_tensor(w);
+}
+
+int main() {
+    srand(1);
+    test_fused_chain();
+    test_fused_reduce_sum_bitwise();
+    test_fused_graph_replay();
+    test_shared_result_not_fused();
+    test_lazy_buffers_deferred();
+    test_materialize_on_read();
+    shutdown_thread_pool();
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/gemm.h"
+#include "../src/kernels.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+/* Reference C (+)= A @ B with strided A and B */
+void naive_gemm(int M, int N, int K, const float* A, int ars, int acs, const float* B, int brs, int bcs,
+                float* C, int accumulate) {
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            double acc = accumulate ? C[i * N + j] : 0;
+            for (int k = 0; k < K; k++) {
+                acc += (double)A[i * ars + k * acs] * B[k * brs + j * bcs];
+            }
+            C[i * N + j] = acc;
+        }
+    }
+}
+
+/* Compare with a tolerance that scales with the length of the dot products */
+int compare_gemm(const float* C, const float* expected, int size, int K) {
+    for (int i = 0; i < size; i++) {
+        if (fabs(C[i] - expected[i]) > 1e-5 * K * (1 + fabs(expected[i]))) {
+            printf("Mismatch at index %d: %.8f != %.8f\n", i, C[i], expected[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Sizes that are not multiples of the register tile or cache blocks, and a K deeper than KC */
+int check_gemm(int M, int N, int K, int transpose_a, int transpose_b, int accumulate) {
+    float* A = uniform_random_array(M * K, -1, 1);
+    float* B = uniform_random_array(K * N, -1, 1);
+    float* C = uniform_random_array(M * N, -1, 1);
+    float* expected = (float*)malloc(M * N * sizeof(float));
+    for (int i = 0; i < M * N; i++) expected[i] = C[i];
+
+    // a transposed operand is stored as its transpose and read through swapped strides
+    int ars = transpose_a ? 1 : K, acs = transpose_a ? M : 1;
+    int brs = transpose_b ? 1 : N, bcs = transpose_b ? K : 1;
+
+    naive_gemm(M, N, K, A, ars, acs, B, brs, bcs, expected, accumulate);
+    gemm(M, N, K, A, ars, acs, B, brs, bcs, C, N, accumulate);
+    int passed = compare_gemm(C, expected, M * N, K);
+
+    free(A);
+    free(B);
+    free(C);
+    free(expected);
+    return passed;
+}
+
+void test_gemm_small() {
+    if (check_gemm(5, 7, 3, 0, 0, 0) && check_gemm(1, 1, 1, 0, 0, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_small:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_small:");
+    }
+}
+
+void test_gemm_blocked() {
+    if (check_gemm(101, 67, 300, 0, 0, 0) && check_gemm(200, 2100, 40, 0, 0, 0)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_blocked:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_blocked:");
+    }
+}
+
+void test_gemm_blocked_accumulate() {
+    if (check_gemm(97, 35, 513, 0, 0, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_blocked_accumulate:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_blocked_accumulate:");
+    }
+}
+
+void test_gemm_transposed() {
+    if (check_gemm(64, 50, 70, 1, 0, 0) && check_gemm(64, 50, 70, 0, 1, 1) && check_gemm(13, 17, 600, 1, 1, 0)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_transposed:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_transposed:");
+    }
+}
+
+/* The packing panels are kept between calls, so a call after a larger one must only use
+   its own part of them and a call after a smaller one must grow them */
+void test_gemm_reused_pack_buffers() {
+    if (check_gemm(40, 30, 50, 0, 0, 0) && check_gemm(101, 67, 300, 0, 0, 0) &&
+        check_gemm(40, 30, 50, 0, 0, 1) && check_gemm(150, 2100, 260, 0, 1, 0) && check_gemm(9, 11, 5, 1, 0, 0)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_reused_pack_buffers:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_reused_pack_buffers:");
+    }
+}
+
+/* The epilogue has to see the finished sum, including when K spans several KC slices */
+int check_gemm_bias_relu(int M, int N, int K) {
+    float* A = uniform_random_array(M * K, -1, 1);
+    float* B = uniform_random_array(K * N, -1, 1);
+    float* bias = uniform_random_array(N, -1, 1);
+    float* C = (float*)malloc(M * N * sizeof(float));
+    float* expected = (float*)malloc(M * N * sizeof(float));
+
+    naive_gemm(M, N, K, A, K, 1, B, N, 1, expected, 0);
+    for (int i = 0; i < M * N; i++) {
+        float z = expected[i] + bias[i % N];
+        expected[i] = z > 0 ? z : 0;
+    }
+    gemm_bias_activation(M, N, K, A, K, 1, B, N, 1, C, N, 0, bias, kernels.relu);
+    int passed = compare_gemm(C, expected, M * N, K);
+
+    free(A);
+    free(B);
+    free(bias);
+    free(C);
+    free(expected);
+    return passed;
+}
+
+void test_gemm_bias_activation() {
+    if (check_gemm_bias_relu(5, 7, 3) && check_gemm_bias_relu(101, 67, 300) && check_gemm_bias_relu(130, 40, 600)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_bias_activation:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_bias_activation:");
+    }
+}
+
+int main() {
+    srand(1);
+    test_gemm_small();
+    test_gemm_blocked();
+    test_gemm_blocked_accumulate();
+    test_gemm_transposed();
+    test_gemm_reused_pack_buffers();
+    test_gemm_bias_activation();
+
+    return 0;
+}
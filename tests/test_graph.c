@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/graph.h"
+#include "../src/loss.h"
+#include "../src/mlp.h"
+#include "../src/optimizer.h"
+#include "../src/tensor.h"
+#include "../src/tensor_ops.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+/* Loss of a small mlp on a batch, built the normal way */
+Tensor* mlp_loss(LayerList* mlp, Tensor* input, Tensor* y_true) {
+    Tensor* output = forward_layers(input, mlp);
+    Tensor* loss = binary_cross_entropy(output, y_true);
+    Tensor* w_sqr = mul(mlp->layers[0]->weights, mlp->layers[0]->weights);
+    return add(loss, reduce_sum(w_sqr));
+}
+
+void test_graph_replay_forward() {
+    int input_shape[] = {4, 2};
+    int label_shape[] = {4, 1};
+    float labels[] = {0, 1, 1, 0};
+    float* first_batch = uniform_random_array(8, -1, 1);
+    float* second_batch = uniform_random_array(8, -1, 1);
+
+    int layer_sizes[] = {8, 1};
+    LayerList* mlp = create_mlp(2, layer_sizes, 2, "sigmoid");
+    Tensor* input = create_tensor(first_batch, input_shape, 2, 0);
+    Tensor* y_true = create_tensor(labels, label_shape, 2, 0);
+    Graph* graph = capture_graph(mlp_loss(mlp, input, y_true));
+
+    // Feed the second batch through the captured graph and through a fresh one
+    memcpy(input->data, second_batch, 8 * sizeof(float));
+    graph_forward(graph);
+    Tensor* expected = mlp_loss(mlp, input, y_true);
+
+    if (compare_tensor_data(graph->output->data, expected->data, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_graph_replay_forward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_graph_replay_forward:");
+    }
+
+    free_graph(graph);
+    free_graph_from_tensor(expected);
+    free_tensor(input);
+    free_tensor(y_true);
+    free_layer_list(mlp);
+    free(first_batch);
+    free(second_batch);
+}
+
+void test_graph_replay_backward() {
+    int input_shape[] = {4, 2};
+    int label_shape[] = {4, 1};
+    float labels[] = {0, 1, 1, 0};
+    float* batch = uniform_random_array(8, -1, 1);
+
+    int layer_sizes[] = {8, 1};
+    LayerList* mlp = create_mlp(2, layer_sizes, 2, "sigmoid");
+    Tensor* input = create_tensor(batch, input_shape, 2, 0);
+    Tensor* y_true = create_tensor(labels, label_shape, 2, 0);
+    Tensor* weights = mlp->layers[0]->weights;
+
+    Topo* topo = backward(mlp_loss(mlp, input, y_true));
+    float expected_grad[16];
+    memcpy(expected_grad, weights->grad, sizeof(expected_grad));
+    free_graph_from_topo(topo);
+
+    // Op results are reset on every replay, the weights only by zero_grad
+    ParamList* params = mlp_parameters(mlp);
+    Graph* graph = capture_graph(mlp_loss(mlp, input, y_true));
+    zero_grad(params);
+    graph_backward(graph);
+    graph_forward(graph);
+    zero_grad(params);
+    graph_backward(graph);
+    int passed = compare_tensor_data(weights->grad, expected_grad, 16);
+
+    // Without zero_grad a second replay accumulates the same grads again
+    graph_forward(graph);
+    graph_backward(graph);
+    float doubled_grad[16];
+    for (int i = 0; i < 16; i++) doubled_grad[i] = 2 * expected_grad[i];
+    passed = passed && compare_tensor_data(weights->grad, doubled_grad, 16);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_graph_replay_backward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_graph_replay_backward:");
+    }
+
+    free_graph(graph);
+    free_param_list(params);
+    free_tensor(input);
+    free_tensor(y_true);
+    free_layer_list(mlp);
+    free(batch);
+}
+
+/* A long chain would overflow the stack of a recursive sort, and a node shared by
+   every link would make a linear visited scan quadratic */
+void test_build_topo_long_chain() {
+    int shape[] = {1};
+    float data[] = {0.5};
+    Tensor* shared = create_tensor(data, shape, 1, 1);
+    Arena* arena = create_arena(1 << 20);
+    set_tensor_arena(arena);
+
+    int n = 200000;
+    Tensor* x = shared;
+    for (int i = 0; i < n; i++) {
+        x = add(relu(x), shared);
+    }
+    Topo* topo = build_topo(x);
+
+    // shared once, then a relu and an add per link, each after its parents
+    int passed = topo->length == 2*n + 1 && topo->ordering[0] == shared && topo->ordering[topo->length-1] == x;
+    for (int i = 1; i < topo->length && passed; i++) {
+        Tensor* t = topo->ordering[i];
+        if (t->parents[0] != topo->ordering[i-1]) passed = 0;
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_build_topo_long_chain:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_build_topo_long_chain:");
+    }
+
+    free_topo(topo);
+    set_tensor_arena(NULL);
+    free_arena(arena);
+    free_tensor(shared);
+}
+
+int main() {
+    srand(1);
+    test_graph_replay_forward();
+    test_graph_replay_backward();
+    test_build_topo_long_chain();
+
+    return 0;
+}
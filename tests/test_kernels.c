@@ -0,0 +1,300 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/gemm.h"
+#include "../src/kernels.h"
+#include "../src/simd_math.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+#define MAX_SIZE 301
+
+double reference_exp(float x) { return exp(x); }
+double reference_log(float x) { return log(x); }
+double reference_tanh(float x) { return tanh(x); }
+double reference_sigmoid(float x) { return 1 / (1 + exp(-(double)x)); }
+
+int close_enough(const float* data1, const float* data2, int size, float tolerance) {
+    for (int i = 0; i < size; i++) {
+        if (fabs(data1[i] - data2[i]) > tolerance * (1 + fabs(data2[i]))) {
+            printf("Mismatch at index %d: %.8f != %.8f\n", i, data1[i], data2[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Run every elementwise kernel of the given table against the scalar kernels for sizes
+   that exercise the vector tails */
+int check_elementwise_kernels(const Kernels* simd) {
+    float* a = uniform_random_array(MAX_SIZE, -10, 10);
+    float* b = uniform_random_array(MAX_SIZE, -10, 10);
+    float* grad = uniform_random_array(MAX_SIZE, -1, 1);
+    float* probs = uniform_random_array(MAX_SIZE, 0, 1);
+    float labels[MAX_SIZE];
+    float positive[MAX_SIZE];
+    for (int i = 0; i < MAX_SIZE; i++) {
+        labels[i] = b[i] > 0;
+        positive[i] = fabs(b[i]) + 1e-3;
+    }
+    float expected[MAX_SIZE];
+    float result[MAX_SIZE];
+    int passed = 1;
+
+    for (int n = 0; n <= MAX_SIZE && passed; n += n < 40 ? 1 : 37) {
+        scalar_kernels.add(a, b, expected, n);
+        simd->add(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.add_scalar(a, 3.0, expected, n);
+        simd->add_scalar(a, 3.0, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.mul(a, b, expected, n);
+        simd->mul(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.mul_add(a, b, expected, n);
+        simd->mul_add(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        scalar_kernels.mul_scalar(a, -1.5, expected, n);
+        simd->mul_scalar(a, -1.5, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.mul_scalar_add(a, -1.5, expected, n);
+        simd->mul_scalar_add(a, -1.5, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        float expected_dot = scalar_kernels.dot(a, b, n);
+        float result_dot = simd->dot(a, b, n);
+        passed = passed && close_enough(&result_dot, &expected_dot, 1, 1e-5 * n);
+
+        scalar_kernels.relu(a, expected, n);
+        simd->relu(a, result, n);
+        passed = passed && close_enough(result, expected, n, 0);
+
+        scalar_kernels.sigmoid(a, expected, n);
+        simd->sigmoid(a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.tanh(a, expected, n);
+        simd->tanh(a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.gelu(a, expected, n);
+        simd->gelu(a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.silu(a, expected, n);
+        simd->silu(a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.exp(a, expected, n);
+        simd->exp(a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        scalar_kernels.log(positive, expected, n);
+        simd->log(positive, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        float expected_sum = scalar_kernels.sum(a, n);
+        float result_sum = simd->sum(a, n);
+        passed = passed && close_enough(&result_sum, &expected_sum, 1, 1e-5 * n);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.relu_backward(a, b, expected, n);
+        simd->relu_backward(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.sigmoid_backward(a, b, expected, n);
+        simd->sigmoid_backward(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        // grad holds values of tanh in [-1, 1]
+        for (int i = 0; i < n; i++) expected[i] = result[i] = b[i];
+        scalar_kernels.tanh_backward(grad, a, expected, n);
+        simd->tanh_backward(grad, a, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.gelu_backward(a, b, expected, n);
+        simd->gelu_backward(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.silu_backward(a, b, expected, n);
+        simd->silu_backward(a, b, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-5);
+
+        float expected_bce = scalar_kernels.bce(probs, labels, n);
+        float result_bce = simd->bce(probs, labels, n);
+        passed = passed && close_enough(&result_bce, &expected_bce, 1, 1e-5 * n);
+
+        float expected_loss = scalar_kernels.bce_with_logits(a, labels, n);
+        float result_loss = simd->bce_with_logits(a, labels, n);
+        passed = passed && close_enough(&result_loss, &expected_loss, 1, 1e-5 * n);
+
+        for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+        scalar_kernels.bce_with_logits_backward(a, labels, 0.5, expected, n);
+        simd->bce_with_logits_backward(a, labels, 0.5, result, n);
+        passed = passed && close_enough(result, expected, n, 1e-6);
+
+        if (n > 0) {
+            float expected_lse = scalar_kernels.logsumexp(a, n);
+            float result_lse = simd->logsumexp(a, n);
+            passed = passed && close_enough(&result_lse, &expected_lse, 1, 1e-6);
+
+            for (int i = 0; i < n; i++) expected[i] = result[i] = grad[i];
+            scalar_kernels.softmax_cross_entropy_backward(a, expected_lse, n / 2, 0.5, expected, n);
+            simd->softmax_cross_entropy_backward(a, expected_lse, n / 2, 0.5, result, n);
+            passed = passed && close_enough(result, expected, n, 1e-6);
+        }
+
+        // a is the param, b and result the moments, the second moment must be positive
+        AdamStep step = {0.9, 0.999, 1e-8, 0.01, 0.999, 0.05, 1.2};
+        float expected_param[MAX_SIZE], expected_m[MAX_SIZE], expected_v[MAX_SIZE];
+        float result_param[MAX_SIZE], result_m[MAX_SIZE], result_v[MAX_SIZE];
+        for (int i = 0; i < n; i++) {
+            expected_param[i] = result_param[i] = a[i];
+            expected_m[i] = result_m[i] = b[i];
+            expected_v[i] = result_v[i] = fabs(b[i]);
+        }
+        scalar_kernels.adam(expected_param, grad, expected_m, expected_v, n, &step);
+        simd->adam(result_param, grad, result_m, result_v, n, &step);
+        passed = passed && close_enough(result_param, expected_param, n, 1e-6);
+        passed = passed && close_enough(result_m, expected_m, n, 1e-6);
+        passed = passed && close_enough(result_v, expected_v, n, 1e-6);
+    }
+
+    free(a);
+    free(b);
+    free(grad);
+    free(probs);
+    return passed;
+}
+
+/* Error of approx in units of the spacing of floats around exact */
+double ulp_error(float approx, double exact) {
+    float rounded = fabsf((float)exact);
+    double ulp = rounded < FLT_MIN ? ldexp(1, -149) : (double)nextafterf(rounded, INFINITY) - rounded;
+    return fabs(approx - exact) / ulp;
+}
+
+/* Check the ulp bounds documented in simd_math.h on a sample of every 1021st float of
+   each range, which takes in all the exponents */
+int check_simd_math_ulp(const Kernels* simd) {
+    enum { SAMPLE = 4096 };
+    struct {
+        const char* name;
+        void (*kernel)(const float* x, float* out, long long n);
+        double (*reference)(float x);
+        float min;
+        float max;
+        double max_ulp;
+    } funcs[] = {
+        {"exp", simd->exp, reference_exp, -87.3365f, 88.3762f, SIMD_MATH_ULP_EXP},
+        {"log", simd->log, reference_log, FLT_MIN, FLT_MAX, SIMD_MATH_ULP_LOG},
+        {"tanh", simd->tanh, reference_tanh, -FLT_MAX, FLT_MAX, SIMD_MATH_ULP_TANH},
+        {"sigmoid", simd->sigmoid, reference_sigmoid, -87.3f, FLT_MAX, SIMD_MATH_ULP_SIGMOID},
+    };
+    float x[SAMPLE], y[SAMPLE];
+    int passed = 1;
+    for (int f = 0; f < (int)(sizeof(funcs) / sizeof(funcs[0])); f++) {
+        double worst = 0;
+        int n = 0;
+        for (long long bits = 0; bits < (1LL << 32); bits += 1021) {
+            uint32_t u = (uint32_t)bits;
+            float value;
+            memcpy(&value, &u, sizeof(value));
+            if (value >= funcs[f].min && value <= funcs[f].max) x[n++] = value;
+            if (n == SAMPLE || (n > 0 && bits + 1021 >= (1LL << 32))) {
+                funcs[f].kernel(x, y, n);
+                for (int i = 0; i < n; i++) {
+                    double error = ulp_error(y[i], funcs[f].reference(x[i]));
+                    if (error > worst) worst = error;
+                }
+                n = 0;
+            }
+        }
+        if (worst > funcs[f].max_ulp) {
+            printf("%s is off by %.3f ulp, more than %.1f\n", funcs[f].name, worst, funcs[f].max_ulp);
+            passed = 0;
+        }
+    }
+    return passed;
+}
+
+/* sigmoid of large negative inputs stops at FLT_MIN instead of going subnormal */
+int check_sigmoid_floor(const Kernels* simd) {
+    float x[] = {-87.3f, -88.0f, -91.9f, -100.0f, -1000.0f, -FLT_MAX, -INFINITY, -87.0f, -89.5f};
+    int n = sizeof(x) / sizeof(x[0]);
+    float y[sizeof(x) / sizeof(x[0])];
+    simd->sigmoid(x, y, n);
+    for (int i = 0; i < n; i++) {
+        if (!(y[i] >= FLT_MIN && y[i] < 2e-38f)) {
+            printf("sigmoid(%g) is %g, not in [FLT_MIN, 2e-38)\n", x[i], y[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Run a blocked gemm with the selected kernels against the scalar micro-kernel */
+int check_gemm_kernel(const char* isa) {
+    int M = 71, N = 83, K = 300;
+    float* A = uniform_random_array(M * K, -1, 1);
+    float* B = uniform_random_array(K * N, -1, 1);
+    float* expected = (float*)malloc(M * N * sizeof(float));
+    float* result = (float*)malloc(M * N * sizeof(float));
+
+    select_kernels("scalar");
+    gemm(M, N, K, A, K, 1, B, N, 1, expected, N, 0);
+    select_kernels(isa);
+    gemm(M, N, K, A, K, 1, B, N, 1, result, N, 0);
+    int passed = close_enough(result, expected, M * N, 1e-4);
+
+    free(A);
+    free(B);
+    free(expected);
+    free(result);
+    return passed;
+}
+
+void test_kernels_for_isa(const char* isa, const Kernels* simd) {
+    char name[64];
+    snprintf(name, sizeof(name), "test_kernels_%s:", isa);
+
+    Kernels selected = kernels;
+    if (!select_kernels(isa)) {
+        printf("%-*s SKIPPED (not supported by this CPU)\n", PADDING_WIDTH, name);
+        return;
+    }
+
+    if (check_elementwise_kernels(simd) && check_simd_math_ulp(simd) && check_sigmoid_floor(simd) &&
+        check_gemm_kernel(isa)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, name);
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, name);
+    }
+    kernels = selected;
+}
+
+int main() {
+    srand(1);
+    printf("Kernels selected at startup: %s\n", kernels.isa);
+#ifdef KERNELS_X86
+    test_kernels_for_isa("avx2", &avx2_kernels);
+    test_kernels_for_isa("avx512", &avx512_kernels);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "../src/backward.h"
+#include "../src/tensor.h"
+#include "../src/tensor_ops.h"
+#include "../src/thread_pool.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+// ROWS x COLS is just past 2^31 elements, the last row starts at element 2^31
+#define ROWS ((1 << 21) + 1)
+#define COLS 1024
+#define LARGE_SIZE ((long long)ROWS * COLS)
+
+/* Zeroed buffer of size floats. The mapping reserves no memory, untouched pages read as
+   the shared zero page, so only the few pages written by a test take up memory. NULL
+   when the address space isn't available. */
+float* map_zeros(long long size) {
+    void* data = mmap(NULL, size * sizeof(float), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return data == MAP_FAILED ? NULL : (float*)data;
+}
+
+/* A ROWS x COLS tensor of zeros except for 2 in the first row and 5 and 1 in the last,
+   whose elements are all past index 2^31 */
+Tensor* create_large_tensor() {
+    float* data = map_zeros(LARGE_SIZE);
+    if (!data) return NULL;
+    data[3] = 2;
+    data[(1LL << 31) + 7] = 5;
+    data[LARGE_SIZE - 1] = 1;
+    int shape[] = {ROWS, COLS};
+    return create_tensor_from_buffer(data, shape, 2);
+}
+
+void free_large_tensor(Tensor* t) {
+    munmap(t->data, LARGE_SIZE * sizeof(float));
+    free_tensor(t);
+}
+
+void print_skipped(const char* name) {
+    printf("%-*s SKIPPED (no address space for %lld floats)\n", PADDING_WIDTH, name, LARGE_SIZE);
+}
+
+void test_reduce_sum_past_int_max() {
+    Tensor* t = create_large_tensor();
+    if (!t) {
+        print_skipped("test_reduce_sum_past_int_max:");
+        return;
+    }
+
+    Tensor* total = reduce_sum(t);
+
+    if (total->data[0] == 8) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_reduce_sum_past_int_max:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_reduce_sum_past_int_max:");
+    }
+
+    free_tensor(total);
+    free_large_tensor(t);
+}
+
+/* Every row is summed, the rows past 2^31 elements included */
+void test_sum_rows_past_int_max() {
+    Tensor* t = create_large_tensor();
+    if (!t) {
+        print_skipped("test_sum_rows_past_int_max:");
+        return;
+    }
+
+    Tensor* row_sums = sum(t);
+
+    int passed = row_sums->size == ROWS && row_sums->data[0] == 2 && row_sums->data[ROWS-1] == 6;
+    for (long long i = 1; i < ROWS-1 && passed; i++) {
+        passed = row_sums->data[i] == 0;
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_sum_rows_past_int_max:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_sum_rows_past_int_max:");
+    }
+
+    free_tensor(row_sums);
+    free_large_tensor(t);
+}
+
+/* A view whose offset doesn't fit in an int */
+void test_slice_past_int_max() {
+    Tensor* t = create_large_tensor();
+    if (!t) {
+        print_skipped("test_slice_past_int_max:");
+        return;
+    }
+
+    Tensor* last_row = slice(t, 0, ROWS-1, ROWS);
+    Tensor* column = slice(transpose(last_row, 0, 1), 0, 7, 8);
+    float* column_data = contiguous_data(column);
+
+    int passed = last_row->offset == (1LL << 31) && last_row->data[7] == 5 && last_row->data[COLS-1] == 1;
+    passed = passed && column->size == 1 && column_data[0] == 5;
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_slice_past_int_max:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_slice_past_int_max:");
+    }
+
+    release_contiguous_data(column, column_data);
+    free_graph_from_tensor(column);
+    free_large_tensor(t);
+}
+
+/* The rows of A past 2^31 elements go through the gemm */
+void test_matmul_past_int_max() {
+    Tensor* t = create_large_tensor();
+    if (!t) {
+        print_skipped("test_matmul_past_int_max:");
+        return;
+    }
+    float* ones = (float*)malloc(COLS * sizeof(float));
+    for (int i = 0; i < COLS; i++) ones[i] = 1;
+    int w_shape[] = {COLS, 1};
+    Tensor* w = create_tensor(ones, w_shape, 2, 0);
+
+    Tensor* product = matmul(t, w);
+
+    int passed = product->size == ROWS && product->data[0] == 2 && product->data[ROWS-1] == 6;
+    for (long long i = 1; i < ROWS-1 && passed; i++) {
+        passed = product->data[i] == 0;
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_matmul_past_int_max:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_matmul_past_int_max:");
+    }
+
+    free_tensor(product);
+    free_tensor(w);
+    free(ones);
+    free_large_tensor(t);
+}
+
+int main() {
+    test_reduce_sum_past_int_max();
+    test_sum_rows_past_int_max();
+    test_slice_past_int_max();
+    test_matmul_past_int_max();
+    shutdown_thread_pool();
+
+    return 0;
+}
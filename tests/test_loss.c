@@ -1,6 +1,11 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "../src/backward.h"
+#include "../src/graph.h"
 #include "../src/loss.h"
+#include "../src/thread_pool.h"
 #include "../src/tensor.h"
 #include "../src/utility.h"
 
@@ -54,10 +59,189 @@ void test_binary_cross_entropy_backward() {
     free_tensor(loss);
 }
 
+void test_binary_cross_entropy_with_logits() {
+    int shape[] = {5};
+    float y_true_data[] = {1, 0, 1, 0, 1};
+    // logits of the predictions in test_binary_cross_entropy
+    float logits_data[5];
+    float y_pred_data[] = {0.9, 0.1, 0.8, 0.3, 0.95};
+    for (int i = 0; i < 5; i++) logits_data[i] = log(y_pred_data[i] / (1 - y_pred_data[i]));
+    Tensor* y_true = create_tensor(y_true_data, shape, 1, 0);
+    Tensor* logits = create_tensor(logits_data, shape, 1, 0);
+
+    float expected_loss_data[] = {0.16836658};
+    Tensor* loss = binary_cross_entropy_with_logits(logits, y_true);
+
+    // Logits that saturate the sigmoid stay finite
+    float large_data[] = {100, -100, 100, -100, 0}; // all on the right side
+    Tensor* large = create_tensor(large_data, shape, 1, 0);
+    Tensor* large_loss = binary_cross_entropy_with_logits(large, y_true);
+    float expected_large_loss[] = {log(2) / 5};
+
+    if (compare_tensor_data(loss->data, expected_loss_data, loss->size) &&
+        compare_tensor_data(large_loss->data, expected_large_loss, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_binary_cross_entropy_with_logits:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_binary_cross_entropy_with_logits:");
+    }
+
+    free_tensor(y_true);
+    free_tensor(logits);
+    free_tensor(loss);
+    free_tensor(large);
+    free_tensor(large_loss);
+}
+
+void test_binary_cross_entropy_with_logits_backward() {
+    int shape[] = {4};
+    float y_true_data[] = {0, 0, 1, 1};
+    float logits_data[] = {-2.0, 0.5, 0.0, 30.0};
+    Tensor* y_true = create_tensor(y_true_data, shape, 1, 0);
+    Tensor* logits = create_tensor(logits_data, shape, 1, 1);
+
+    // (sigmoid(z) - y) / n
+    float expected_grads[4];
+    for (int i = 0; i < 4; i++) {
+        expected_grads[i] = (1 / (1 + exp(-logits_data[i])) - y_true_data[i]) / 4;
+    }
+
+    Tensor* loss = binary_cross_entropy_with_logits(logits, y_true);
+    loss->grad[0] = 1.0;
+    loss->backward_func(loss);
+
+    if (compare_tensor_data(logits->grad, expected_grads, logits->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_binary_cross_entropy_with_logits_backward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_binary_cross_entropy_with_logits_backward:");
+    }
+
+    free_tensor(y_true);
+    free_tensor(logits);
+    free_tensor(loss);
+}
+
+void test_softmax_cross_entropy() {
+    int shape[] = {2, 3};
+    int label_shape[] = {2};
+    float logits_data[] = {1.0, 2.0, 3.0, 1000.0, 0.0, -1000.0};
+    float labels_data[] = {2, 1};
+    Tensor* logits = create_tensor(logits_data, shape, 2, 1);
+    Tensor* labels = create_tensor(labels_data, label_shape, 1, 0);
+
+    // -log(softmax(z)[label]) averaged over the rows, the second row must not overflow
+    float lse0 = 3 + log(exp(-2.0) + exp(-1.0) + 1);
+    float expected_loss[] = {((lse0 - 3) + 1000) / 2};
+    float expected_grads[6];
+    for (int i = 0; i < 3; i++) {
+        expected_grads[i] = (exp(logits_data[i] - lse0) - (i == 2)) / 2;
+    }
+    expected_grads[3] = 0.5;
+    expected_grads[4] = -0.5;
+    expected_grads[5] = 0;
+
+    Tensor* loss = softmax_cross_entropy(logits, labels);
+    loss->grad[0] = 1.0;
+    loss->backward_func(loss);
+
+    if (compare_tensor_data(loss->data, expected_loss, 1) &&
+        compare_tensor_data(logits->grad, expected_grads, logits->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_softmax_cross_entropy:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_softmax_cross_entropy:");
+    }
+
+    free_graph_from_tensor(loss);
+    free_tensor(logits);
+    free_tensor(labels);
+}
+
+/* A replayed graph recomputes the row log-sum-exps the backward reads */
+void test_softmax_cross_entropy_replay() {
+    int shape[] = {4, 5};
+    int label_shape[] = {4};
+    float labels_data[] = {0, 4, 2, 2};
+    float* first_data = uniform_random_array(20, -3, 3);
+    float* new_data = uniform_random_array(20, -3, 3);
+    Tensor* logits = create_tensor(first_data, shape, 2, 1);
+    Tensor* labels = create_tensor(labels_data, label_shape, 1, 0);
+    Graph* graph = capture_graph(softmax_cross_entropy(logits, labels));
+
+    for (int i = 0; i < 20; i++) logits->data[i] = new_data[i];
+    graph_forward(graph);
+    graph_backward(graph);
+
+    Tensor* expected_logits = create_tensor(new_data, shape, 2, 1);
+    Tensor* expected = softmax_cross_entropy(expected_logits, labels);
+    Topo* topo = backward(expected);
+
+    if (compare_tensor_data(graph->output->data, expected->data, 1) &&
+        compare_tensor_data(logits->grad, expected_logits->grad, 20)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_softmax_cross_entropy_replay:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_softmax_cross_entropy_replay:");
+    }
+
+    free_graph(graph);
+    free_graph_from_topo(topo);
+    free_tensor(logits);
+    free_tensor(expected_logits);
+    free_tensor(labels);
+    free(first_data);
+    free(new_data);
+}
+
+/* A few rows of many classes are split into chunks across the threads */
+void test_softmax_cross_entropy_threads() {
+    int classes = 20000;
+    int shape[] = {2, classes};
+    int label_shape[] = {2};
+    float labels_data[] = {123, 19999};
+    float* logits_data = uniform_random_array(2 * classes, -5, 5);
+    float results[2][2];
+    float* grads[2];
+
+    int threads[2] = {1, 4};
+    for (int run = 0; run < 2; run++) {
+        set_num_threads(threads[run]);
+        Tensor* logits = create_tensor(logits_data, shape, 2, 1);
+        Tensor* labels = create_tensor(labels_data, label_shape, 1, 0);
+        Tensor* loss = softmax_cross_entropy(logits, labels);
+        loss->grad[0] = 1.0;
+        loss->backward_func(loss);
+        results[run][0] = loss->data[0];
+        // the grads of each row sum to zero
+        float grad_sum = 0;
+        for (int i = 0; i < classes; i++) grad_sum += logits->grad[i];
+        results[run][1] = grad_sum;
+        grads[run] = (float*)malloc(logits->size * sizeof(float));
+        for (int i = 0; i < logits->size; i++) grads[run][i] = logits->grad[i];
+        free_graph_from_tensor(loss);
+        free_tensor(logits);
+        free_tensor(labels);
+    }
+
+    int passed = compare_tensor_data(&results[1][0], &results[0][0], 1) && fabs(results[0][1]) < 1e-5 &&
+                 compare_tensor_data(grads[1], grads[0], 2 * classes);
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_softmax_cross_entropy_threads:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_softmax_cross_entropy_threads:");
+    }
+
+    free(grads[0]);
+    free(grads[1]);
+    free(logits_data);
+    shutdown_thread_pool();
+}
 
 int main() {
     test_binary_cross_entropy();
     test_binary_cross_entropy_backward();
+    test_binary_cross_entropy_with_logits();
+    test_binary_cross_entropy_with_logits_backward();
+    test_softmax_cross_entropy();
+    test_softmax_cross_entropy_replay();
+    test_softmax_cross_entropy_threads();
 
     return 0;
 }
\ No newline at end of file
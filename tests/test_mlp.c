@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../src/tensor_ops.h"
 #include "../src/tensor.h"
@@ -18,8 +20,8 @@ void test_dense_forward() {
     // Manually set the weights for predictability
     float weight_data[] = {1.0, 1.0, 2.0, 2.0, 3.0, 3.0};
     float bias_data[] = {0.0, 10.0};
-    dense_layer->weights->data = weight_data;
-    dense_layer->biases->data = bias_data;
+    memcpy(dense_layer->weights->data, weight_data, sizeof(weight_data));
+    memcpy(dense_layer->biases->data, bias_data, sizeof(bias_data));
 
     Tensor *output = forward_dense(input, dense_layer);
 
@@ -33,9 +35,9 @@ void test_dense_forward() {
     }
 
     // Free the allocated memory
+    free_graph_from_tensor(output);
     free_tensor(input);
     free_dense(dense_layer);
-    free_graph_from_tensor(output);
 }
 
 void test_dense_backward() {
@@ -50,8 +52,8 @@ void test_dense_backward() {
     // Manually set the weights for predictability
     float weight_data[] = {1.0, 1.0, 2.0, 2.0, 3.0, 3.0};
     float bias_data[] = {0.0, 10.0};
-    dense_layer->weights->data = weight_data;
-    dense_layer->biases->data = bias_data;
+    memcpy(dense_layer->weights->data, weight_data, sizeof(weight_data));
+    memcpy(dense_layer->biases->data, bias_data, sizeof(bias_data));
 
     Tensor* output = forward_dense(input, dense_layer); // output from relu
     Tensor* loss = reduce_sum(output);
@@ -67,16 +69,202 @@ void test_dense_backward() {
     }
 
     // Free the allocated memory
+    free_graph_from_topo(topo);
     free_tensor(input);
     free_dense(dense_layer);
-    free_graph_from_tensor(loss);
-    free_topo(topo);
+}
+
+void test_forward_layers_inference() {
+    float input_data[] = {1.0, -2.0, 3.0, 0.5, 2.0, -1.0, 4.0, 0.0};
+    // batch of 4 with 2 features each
+    int input_shape[] = {4, 2};
+    Tensor* input = create_tensor(input_data, input_shape, 2, 0);
+
+    int layer_sizes[] = {5, 3, 1};
+    LayerList* mlp = create_mlp(2, layer_sizes, 3, "sigmoid");
+    for (int i = 0; i < mlp->num_layers; i++) {
+        for (int j = 0; j < mlp->layers[i]->biases->size; j++) {
+            mlp->layers[i]->biases->data[j] = 0.1 * (j + 1);
+        }
+    }
+
+    // Both paths must agree, the inference output has no graph or grads
+    Tensor* expected = forward_layers(input, mlp);
+    Tensor* output = forward_layers_inference(input, mlp);
+
+    if (output->num_dims == 2 && output->shape[0] == 4 && output->shape[1] == 1 &&
+        output->grad == NULL && output->num_parents == 0 &&
+        compare_tensor_data(output->data, expected->data, output->size)) {
+        printf("%-30s PASSED\n", "test_forward_layers_inference:");
+    } else {
+        printf("%-30s FAILED\n", "test_forward_layers_inference:");
+    }
+
+    free_tensor(output);
+    free_graph_from_tensor(expected);
+    free_tensor(input);
+    free_layer_list(mlp);
+}
+
+void test_create_mlp_flat() {
+    float input_data[] = {1.0, -2.0, 3.0, 0.5, 2.0, -1.0};
+    int input_shape[] = {3, 2};
+    Tensor* input = create_tensor(input_data, input_shape, 2, 0);
+    int layer_sizes[] = {5, 3, 1};
+
+    // Same seed, so both mlps start from the same weights
+    srand(7);
+    LayerList* mlp = create_mlp(2, layer_sizes, 3, "sigmoid");
+    srand(7);
+    LayerList* flat = create_mlp_flat(2, layer_sizes, 3, "sigmoid");
+
+    // Every weight, bias and grad is an aligned slice of the flat buffers
+    int passed = flat->param_size == 16 + 16 + 16 + 16 + 16 + 16;
+    for (int i = 0; i < flat->num_layers; i++) {
+        Tensor* params[2] = {flat->layers[i]->weights, flat->layers[i]->biases};
+        for (int j = 0; j < 2; j++) {
+            long offset = params[j]->data - flat->param_data;
+            if (offset < 0 || offset + params[j]->size > flat->param_size ||
+                params[j]->grad != flat->param_grad + offset || (size_t)params[j]->data % 64 != 0) {
+                passed = 0;
+            }
+        }
+    }
+
+    Tensor* expected_loss = reduce_sum(forward_layers(input, mlp));
+    Tensor* loss = reduce_sum(forward_layers(input, flat));
+    Topo* expected_topo = backward(expected_loss);
+    Topo* topo = backward(loss);
+
+    DenseLayer* first = flat->layers[0];
+    if (passed && compare_tensor_data(loss->data, expected_loss->data, 1) &&
+        compare_tensor_data(first->weights->grad, mlp->layers[0]->weights->grad, first->weights->size) &&
+        compare_tensor_data(flat->param_grad, first->weights->grad, first->weights->size)) {
+        printf("%-30s PASSED\n", "test_create_mlp_flat:");
+    } else {
+        printf("%-30s FAILED\n", "test_create_mlp_flat:");
+    }
+
+    free_graph_from_topo(expected_topo);
+    free_graph_from_topo(topo);
+    free_tensor(input);
+    free_layer_list(mlp);
+    free_layer_list(flat);
+}
+
+/* A saved model loads back with the same layers and outputs, either copied into flat
+   buffers or mapped from the file */
+void test_save_load_mlp() {
+    float input_data[] = {1.0, -2.0, 3.0, 0.5, 2.0, -1.0, 4.0, 0.0};
+    int input_shape[] = {4, 2};
+    Tensor* input = create_tensor(input_data, input_shape, 2, 0);
+    int layer_sizes[] = {5, 3, 1};
+    LayerList* mlp = create_mlp(2, layer_sizes, 3, NULL);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        for (int j = 0; j < mlp->layers[i]->biases->size; j++) {
+            mlp->layers[i]->biases->data[j] = 0.1 * (j + 1);
+        }
+    }
+    save_mlp("test_mlp.ckpt", mlp);
+    Tensor* expected = forward_layers_inference(input, mlp);
+
+    LayerList* copied = load_mlp("test_mlp.ckpt", 0);
+    LayerList* mapped = load_mlp("test_mlp.ckpt", 1);
+    Tensor* copied_output = forward_layers_inference(input, copied);
+    Tensor* mapped_output = forward_layers_inference(input, mapped);
+
+    int passed = copied->num_layers == 3 && mapped->num_layers == 3 &&
+                 copied->param_data != NULL && copied->mapping == NULL &&
+                 mapped->param_data == NULL && mapped->mapping != NULL;
+    for (int i = 0; i < 3 && passed; i++) {
+        DenseLayer* layers[2] = {copied->layers[i], mapped->layers[i]};
+        for (int j = 0; j < 2; j++) {
+            char* mapping = (char*)mapped->mapping;
+            char* weights = (char*)layers[j]->weights->data;
+            passed = passed && layers[j]->in_features == mlp->layers[i]->in_features &&
+                     layers[j]->out_features == mlp->layers[i]->out_features &&
+                     layers[j]->activation == mlp->layers[i]->activation &&
+                     (size_t)layers[j]->weights->data % 64 == 0 && (size_t)layers[j]->biases->data % 64 == 0 &&
+                     compare_tensor_data(layers[j]->biases->data, mlp->layers[i]->biases->data, layers[j]->biases->size);
+            // mapped weights are read straight from the file, copied ones can be trained
+            if (j == 1) {
+                passed = passed && weights >= mapping && weights < mapping + mapped->mapping_size &&
+                         layers[j]->weights->grad == NULL;
+            } else {
+                passed = passed && layers[j]->weights->grad != NULL;
+            }
+        }
+    }
+
+    if (passed && compare_tensor_data(copied_output->data, expected->data, expected->size) &&
+        compare_tensor_data(mapped_output->data, expected->data, expected->size)) {
+        printf("%-30s PASSED\n", "test_save_load_mlp:");
+    } else {
+        printf("%-30s FAILED\n", "test_save_load_mlp:");
+    }
+
+    free_tensor(expected);
+    free_tensor(copied_output);
+    free_tensor(mapped_output);
+    free_tensor(input);
+    free_layer_list(mlp);
+    free_layer_list(copied);
+    free_layer_list(mapped);
+    remove("test_mlp.ckpt");
+}
+
+/* Each checkpoint holds the parameters as they were when it was taken, even when training
+   changes them while the file is written */
+void test_checkpoint_writer() {
+    int layer_sizes[] = {5, 3, 1};
+    LayerList* mlp = create_mlp_flat(2, layer_sizes, 3, NULL);
+    float* expected = (float*)malloc(mlp->param_size * sizeof(float));
+    memcpy(expected, mlp->param_data, mlp->param_size * sizeof(float));
+
+    CheckpointWriter* writer = create_checkpoint_writer(mlp, "test_writer.ckpt");
+    checkpoint_mlp(writer, 1);
+    // the snapshot is already taken, so this doesn't reach the file
+    for (int i = 0; i < mlp->param_size; i++) mlp->param_data[i] = 2;
+    wait_for_checkpoints(writer);
+
+    LayerList* first = load_mlp("test_writer.ckpt", 0);
+    int passed = writer->written_step == 1 && first->param_size == mlp->param_size &&
+                 compare_tensor_data(first->param_data, expected, mlp->param_size);
+
+    checkpoint_mlp(writer, 2);
+    free_checkpoint_writer(writer); // writes the pending snapshot first
+    LayerList* second = load_mlp("test_writer.ckpt", 1);
+    for (int i = 0; i < second->num_layers; i++) {
+        Tensor* weights = second->layers[i]->weights;
+        for (int j = 0; j < weights->size; j++) {
+            passed = passed && weights->data[j] == 2;
+        }
+    }
+    FILE* temp = fopen("test_writer.ckpt.tmp", "rb");
+    passed = passed && temp == NULL;
+    if (temp) fclose(temp);
+
+    if (passed) {
+        printf("%-30s PASSED\n", "test_checkpoint_writer:");
+    } else {
+        printf("%-30s FAILED\n", "test_checkpoint_writer:");
+    }
+
+    free(expected);
+    free_layer_list(mlp);
+    free_layer_list(first);
+    free_layer_list(second);
+    remove("test_writer.ckpt");
 }
 
 // Main function to run tests
 int main() {
     test_dense_forward(); 
     test_dense_backward(); 
+    test_forward_layers_inference();
+    test_create_mlp_flat();
+    test_save_load_mlp();
+    test_checkpoint_writer();
 
     return 0;
 }
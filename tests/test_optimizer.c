@@ -1,9 +1,13 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../src/tensor.h"
 #include "../src/utility.h"
 #include "../src/mlp.h"
 #include "../src/optimizer.h"
+#include "../src/backward.h"
 #include "../src/tensor_ops.h"
 
 void test_sgd_update() {
@@ -18,8 +22,8 @@ void test_sgd_update() {
     // Manually set the weights for predictability
     float weight_data[] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
     float bias_data[] = {0.0, 10.0};
-    dense_layer->weights->data = weight_data;
-    dense_layer->biases->data = bias_data;
+    memcpy(dense_layer->weights->data, weight_data, sizeof(weight_data));
+    memcpy(dense_layer->biases->data, bias_data, sizeof(bias_data));
 
     Tensor* output = forward_dense(input, dense_layer); // output from relu
     Tensor* loss = reduce_sum(output);
@@ -27,8 +31,10 @@ void test_sgd_update() {
     
     Topo* topo = backward(loss);
 
+    Tensor* tensors[2] = {dense_layer->weights, dense_layer->biases};
+    ParamList params = {tensors, 2, NULL, NULL, 0};
     SGD* optim = init_sgd(0.1);
-    optim->update(topo, optim->lr);
+    optim->update(&params, optim->lr);
 
     // Check if the result is as expected
     if (compare_tensor_data(dense_layer->weights->data, expected_weights_post_update, 2)) {
@@ -38,14 +44,177 @@ void test_sgd_update() {
     }
 
     // Free the allocated memory
+    free_graph_from_topo(topo);
     free_tensor(input);
     free_dense(dense_layer);
-    free_graph_from_tensor(loss);
-    free_topo(topo);
+    free(optim);
+}
+
+void test_sgd_update_flat() {
+    int layer_sizes[] = {4, 1};
+    LayerList* mlp = create_mlp_flat(3, layer_sizes, 2, "sigmoid");
+    ParamList* params = mlp_parameters(mlp);
+
+    Tensor* weights = mlp->layers[1]->weights;
+    float expected_weights[4];
+    for (int i = 0; i < weights->size; i++) {
+        weights->grad[i] = i + 1;
+        expected_weights[i] = weights->data[i] - 0.1 * (i + 1);
+    }
+    SGD* optim = init_sgd(0.1);
+    optim->update(params, optim->lr);
+
+    if (params->num_params == 4 && params->params[2] == weights &&
+        compare_tensor_data(weights->data, expected_weights, 4)) {
+        printf("%-30s PASSED\n", "test_sgd_update_flat:");
+    } else {
+        printf("%-30s FAILED\n", "test_sgd_update_flat:");
+    }
+
+    free_param_list(params);
+    free_layer_list(mlp);
+    free(optim);
+}
+
+/* Grads of two micro-batches accumulate to the grads of the whole batch */
+void test_zero_grad_accumulation() {
+    float input_data[] = {1.0, -2.0, 3.0, 0.5, 2.0, -1.0, 0.3, 0.7};
+    int batch_shape[] = {4, 2};
+    int micro_shape[] = {2, 2};
+    int layer_sizes[] = {5, 1};
+    LayerList* mlp = create_mlp_flat(2, layer_sizes, 2, "sigmoid");
+    ParamList* params = mlp_parameters(mlp);
+
+    Tensor* batch = create_tensor_from_buffer(input_data, batch_shape, 2);
+    zero_grad(params);
+    Topo* topo = backward(reduce_sum(forward_layers(batch, mlp)));
+    float* expected = (float*)malloc(params->flat_size * sizeof(float));
+    memcpy(expected, params->flat_grad, params->flat_size * sizeof(float));
+    free_graph_from_topo(topo);
+
+    zero_grad(params);
+    for (int i = 0; i < 2; i++) {
+        Tensor* micro_batch = create_tensor_from_buffer(input_data + 4 * i, micro_shape, 2);
+        topo = backward(reduce_sum(forward_layers(micro_batch, mlp)));
+        free_graph_from_topo(topo);
+        free_tensor(micro_batch);
+    }
+    int passed = compare_tensor_data(params->flat_grad, expected, params->flat_size);
+
+    // non-flat parameters are cleared one by one
+    ParamList tensor_params = {params->params, params->num_params, NULL, NULL, 0};
+    zero_grad(&tensor_params);
+    for (int i = 0; i < params->flat_size; i++) {
+        if (params->flat_grad[i] != 0) passed = 0;
+    }
+
+    if (passed) {
+        printf("%-30s PASSED\n", "test_zero_grad_accumulation:");
+    } else {
+        printf("%-30s FAILED\n", "test_zero_grad_accumulation:");
+    }
+
+    free(expected);
+    free_tensor(batch);
+    free_param_list(params);
+    free_layer_list(mlp);
+}
+
+/* Two Adam steps written out element by element */
+void adam_reference(float* param, const float* grad, int n, float lr, float weight_decay, int decoupled) {
+    float beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+    for (int i = 0; i < n; i++) {
+        float m = 0, v = 0;
+        for (int t = 1; t <= 2; t++) {
+            float g = decoupled ? grad[i] : grad[i] + weight_decay * param[i];
+            m = beta1 * m + (1 - beta1) * g;
+            v = beta2 * v + (1 - beta2) * g * g;
+            float m_hat = m / (1 - powf(beta1, t));
+            float v_hat = v / (1 - powf(beta2, t));
+            if (decoupled) param[i] -= lr * weight_decay * param[i];
+            param[i] -= lr * m_hat / (sqrtf(v_hat) + eps);
+        }
+    }
+}
+
+int check_adam(Adam* optim, int decoupled) {
+    int layer_sizes[] = {37, 5};
+    LayerList* mlp = create_mlp_flat(3, layer_sizes, 2, "sigmoid");
+    ParamList* params = mlp_parameters(mlp);
+
+    float* expected = (float*)malloc(params->flat_size * sizeof(float));
+    for (int i = 0; i < params->flat_size; i++) {
+        params->flat_grad[i] = (i % 7) - 3.0;
+        expected[i] = params->flat_data[i];
+    }
+    adam_reference(expected, params->flat_grad, params->flat_size, 0.01, optim->weight_decay, decoupled);
+    optim->update(optim, params, 0.01);
+    optim->update(optim, params, 0.01);
+
+    int passed = optim->size == params->flat_size && optim->step == 2;
+    for (int i = 0; i < params->flat_size && passed; i++) {
+        if (fabs(params->flat_data[i] - expected[i]) > 1e-5) {
+            printf("Mismatch at index %d: %.8f != %.8f\n", i, params->flat_data[i], expected[i]);
+            passed = 0;
+        }
+    }
+
+    // the same update on parameters that are not in a flat buffer
+    DenseLayer* layer = create_dense_layer(3, 4, "relu");
+    Tensor* weights = layer->weights;
+    float weights_expected[12];
+    for (int i = 0; i < weights->size; i++) {
+        weights->grad[i] = 0.5 - i;
+        weights_expected[i] = weights->data[i];
+    }
+    adam_reference(weights_expected, weights->grad, weights->size, 0.01, optim->weight_decay, decoupled);
+    Tensor* tensors[1] = {weights};
+    ParamList tensor_params = {tensors, 1, NULL, NULL, 0};
+    Adam* tensor_optim = decoupled ? init_adamw(0.01, 0.9, 0.999, 1e-8, optim->weight_decay)
+                                   : init_adam(0.01, 0.9, 0.999, 1e-8, optim->weight_decay);
+    tensor_optim->update(tensor_optim, &tensor_params, 0.01);
+    tensor_optim->update(tensor_optim, &tensor_params, 0.01);
+    for (int i = 0; i < weights->size && passed; i++) {
+        if (fabs(weights->data[i] - weights_expected[i]) > 1e-5) {
+            printf("Mismatch at index %d: %.8f != %.8f\n", i, weights->data[i], weights_expected[i]);
+            passed = 0;
+        }
+    }
+
+    free(expected);
+    free_dense(layer);
+    free_adam(tensor_optim);
+    free_param_list(params);
+    free_layer_list(mlp);
+    return passed;
+}
+
+void test_adam_update() {
+    Adam* optim = init_adam(0.01, 0.9, 0.999, 1e-8, 0.1);
+    if (check_adam(optim, 0)) {
+        printf("%-30s PASSED\n", "test_adam_update:");
+    } else {
+        printf("%-30s FAILED\n", "test_adam_update:");
+    }
+    free_adam(optim);
+}
+
+void test_adamw_update() {
+    Adam* optim = init_adamw(0.01, 0.9, 0.999, 1e-8, 0.1);
+    if (check_adam(optim, 1)) {
+        printf("%-30s PASSED\n", "test_adamw_update:");
+    } else {
+        printf("%-30s FAILED\n", "test_adamw_update:");
+    }
+    free_adam(optim);
 }
 
 int main() {
     test_sgd_update();
+    test_sgd_update_flat();
+    test_zero_grad_accumulation();
+    test_adam_update();
+    test_adamw_update();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/reduce.h"
+#include "../src/thread_pool.h"
+#include "../src/tensor.h"
+#include "../src/tensor_ops.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+/* Summing 0.1 ten million times one by one in float ends far from a million, the
+   pairwise sum stays within a few ulp of it */
+void test_pairwise_sum_accuracy() {
+    int n = 10000000;
+    float* x = (float*)malloc(n * sizeof(float));
+    double expected = 0;
+    for (int i = 0; i < n; i++) {
+        x[i] = 0.1f;
+        expected += x[i];
+    }
+
+    float result = pairwise_sum(x, n);
+    set_num_threads(4);
+    float parallel_result = parallel_sum(x, n);
+    int passed = fabs(result - expected) < 1e-6 * expected && fabs(parallel_result - expected) < 1e-6 * expected;
+    if (!passed) printf("Sums %.9g and %.9g, expected %.9g\n", result, parallel_result, expected);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_pairwise_sum_accuracy:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_pairwise_sum_accuracy:");
+    }
+    free(x);
+}
+
+/* In deterministic mode the sums are bitwise the same for any number of threads */
+void test_deterministic_sum() {
+    int n = 3000017;
+    float* x = uniform_random_array(n, -1, 1);
+    int shape[] = {2, n / 2};
+    Tensor* t = create_tensor(x, shape, 2, 0);
+
+    set_deterministic_reductions(1);
+    float expected = pairwise_sum(x, n);
+    float expected_rows[2] = {pairwise_sum(x, n / 2), pairwise_sum(x + n / 2, n / 2)};
+    int passed = 1;
+    for (int threads = 1; threads <= 5; threads++) {
+        set_num_threads(threads);
+        float result = parallel_sum(x, n);
+        Tensor* total = reduce_sum(t);
+        Tensor* rows = sum(t);
+        float reduced = parallel_sum(x, n / 2 * 2);
+        if (memcmp(&result, &expected, sizeof(float)) != 0 ||
+            memcmp(&total->data[0], &reduced, sizeof(float)) != 0 ||
+            memcmp(rows->data, expected_rows, sizeof(expected_rows)) != 0) {
+            printf("Sums with %d threads differ: %.9g != %.9g\n", threads, result, expected);
+            passed = 0;
+        }
+        free_tensor(total);
+        free_tensor(rows);
+    }
+    set_deterministic_reductions(0);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_deterministic_sum:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_deterministic_sum:");
+    }
+    free_tensor(t);
+    free(x);
+}
+
+/* The faster split across threads still agrees with a double sum */
+void test_parallel_reduce_sum() {
+    int n = 1 << 22;
+    float* x = uniform_random_array(n, 0, 1);
+    double expected = 0;
+    for (int i = 0; i < n; i++) expected += x[i];
+    int shape[] = {n};
+    Tensor* t = create_tensor(x, shape, 1, 0);
+
+    set_num_threads(4);
+    Tensor* total = reduce_sum(t);
+    int passed = fabs(total->data[0] - expected) < 1e-6 * expected;
+    if (!passed) printf("Sum %.9g, expected %.9g\n", total->data[0], expected);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_parallel_reduce_sum:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_parallel_reduce_sum:");
+    }
+    free_tensor(total);
+    free_tensor(t);
+    free(x);
+}
+
+int main() {
+    srand(1);
+    test_pairwise_sum_accuracy();
+    test_deterministic_sum();
+    test_parallel_reduce_sum();
+    shutdown_thread_pool();
+
+    return 0;
+}
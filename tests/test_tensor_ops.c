@@ -4,6 +4,7 @@
 #include "../src/tensor.h"
 #include "../src/utility.h"
 #include "../src/dataset.h"
+#include "../src/backward.h"
 
 const int PADDING_WIDTH = -35;
 
@@ -786,6 +787,47 @@ void test_sigmoid_backward_2d() {
     free_tensor(result);
 }
 
+/* Forward and backward of the activations built on the SIMD math kernels */
+void check_activation(const char* name, Tensor* (*activation)(Tensor*), float* expected, float* expected_grad) {
+    int shape[] = {2, 3};
+    float data[] = {-2.0, -0.5, 0.0, 0.3, 1.0, 1.5};
+
+    Tensor* t1 = create_tensor(data, shape, 2, 1);
+    Tensor* result = activation(t1);
+    for (int i = 0; i < result->size; i++) {
+        result->grad[i] = 1.0;
+    }
+    result->backward_func(result);
+
+    if (compare_tensor_data(result->data, expected, result->size) &&
+        compare_tensor_data(t1->grad, expected_grad, t1->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, name);
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, name);
+    }
+
+    free_tensor(t1);
+    free_tensor(result);
+}
+
+void test_tanh_backward_2d() {
+    float expected[] = {-0.96402758, -0.46211716, 0, 0.29131261, 0.76159416, 0.90514825};
+    float expected_grad[] = {0.070650825, 0.78644773, 1, 0.91513696, 0.41997434, 0.18070664};
+    check_activation("test_tanh_backward_2d:", tensor_tanh, expected, expected_grad);
+}
+
+void test_gelu_backward_2d() {
+    float expected[] = {-0.045402306, -0.15428599, 0, 0.18537092, 0.84119199, 1.3995716};
+    float expected_grad[] = {-0.086099257, 0.1326301, 0.5, 0.73229545, 1.0829641, 1.1277108};
+    check_activation("test_gelu_backward_2d:", gelu, expected, expected_grad);
+}
+
+void test_silu_backward_2d() {
+    float expected[] = {-0.23840584, -0.18877033, 0, 0.17233276, 0.73105858, 1.2263617};
+    float expected_grad[] = {-0.090784249, 0.26003881, 0.5, 0.64778001, 0.92767051, 1.0412942};
+    check_activation("test_silu_backward_2d:", silu, expected, expected_grad);
+}
+
 void test_broadcasting_valid_diff_dims() {
     int shape1[] = {2,3,2};
     int shape2[] = {1,2};
@@ -832,7 +874,7 @@ void test_broadcasting_invalid_same_dims() {
     int shape1[] = {2,3,2};
     int shape2[] = {1,2,2};
     float data1[] = {1.0, 2.0, 3.0, 1.0, 2.0, 3.0, 1.0, 2.0, 3.0, 1.0, 2.0, 3.0};
-    float data2[] = {3.0, 4.0};
+    float data2[] = {3.0, 4.0, 3.0, 4.0};
 
     Tensor* t1 = create_tensor(data1, shape1, 3, 0);
     Tensor* t2 = create_tensor(data2, shape2, 3, 0);
@@ -870,6 +912,332 @@ void test_broadcasting_invalid_diff_dims() {
     free_tensor(t2);
 }
 
+/* [4,1] + [2,1,3] broadcasts both operands to [2,4,3], and each grad sums the result
+   grad over the dims its operand was repeated along */
+void test_add_broadcast_backward() {
+    int a_shape[] = {4, 1};
+    int b_shape[] = {2, 1, 3};
+    float a_data[] = {1, 2, 3, 4};
+    float b_data[] = {10, 20, 30, 40, 50, 60};
+    Tensor* a = create_tensor(a_data, a_shape, 2, 1);
+    Tensor* b = create_tensor(b_data, b_shape, 3, 1);
+
+    Tensor* result = add(a, b);
+    for (int i = 0; i < result->size; i++) result->grad[i] = i;
+    result->backward_func(result);
+
+    int passed = result->num_dims == 3 && result->shape[0] == 2 && result->shape[1] == 4 && result->shape[2] == 3;
+    float a_grad[4] = {0};
+    float b_grad[6] = {0};
+    for (int i = 0; i < 2 && passed; i++) {
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 3; k++) {
+                int index = (i * 4 + j) * 3 + k;
+                passed = passed && result->data[index] == a_data[j] + b_data[i * 3 + k];
+                a_grad[j] += index;
+                b_grad[i * 3 + k] += index;
+            }
+        }
+    }
+
+    if (passed && compare_tensor_data(a->grad, a_grad, 4) && compare_tensor_data(b->grad, b_grad, 6)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_add_broadcast_backward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_add_broadcast_backward:");
+    }
+
+    free_tensor(a);
+    free_tensor(b);
+    free_tensor(result);
+}
+
+/* A column [3,1] times a matrix [3,4] and a scalar [1] times a row [4], the cases where one
+   operand is repeated along the inner dim */
+void test_mul_broadcast_backward() {
+    int column_shape[] = {3, 1};
+    int matrix_shape[] = {3, 4};
+    float column_data[] = {1, -2, 3};
+    float matrix_data[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    Tensor* column = create_tensor(column_data, column_shape, 2, 1);
+    Tensor* matrix = create_tensor(matrix_data, matrix_shape, 2, 1);
+
+    Tensor* result = mul(matrix, column);
+    for (int i = 0; i < result->size; i++) result->grad[i] = 0.5 * i;
+    result->backward_func(result);
+
+    int passed = result->num_dims == 2 && result->shape[0] == 3 && result->shape[1] == 4;
+    float column_grad[3] = {0};
+    float matrix_grad[12];
+    for (int i = 0; i < 3 && passed; i++) {
+        for (int j = 0; j < 4; j++) {
+            int index = i * 4 + j;
+            passed = passed && result->data[index] == matrix_data[index] * column_data[i];
+            column_grad[i] += 0.5 * index * matrix_data[index];
+            matrix_grad[index] = 0.5 * index * column_data[i];
+        }
+    }
+    passed = passed && compare_tensor_data(column->grad, column_grad, 3) &&
+             compare_tensor_data(matrix->grad, matrix_grad, 12);
+
+    int scalar_shape[] = {1};
+    int row_shape[] = {4};
+    float scalar_data[] = {2};
+    Tensor* scalar = create_tensor(scalar_data, scalar_shape, 1, 1);
+    Tensor* row = create_tensor(matrix_data, row_shape, 1, 1);
+    Tensor* scaled = mul(scalar, row);
+    for (int i = 0; i < 4; i++) scaled->grad[i] = 1;
+    scaled->backward_func(scaled);
+    float scaled_data[] = {2, 4, 6, 8};
+    float scalar_grad[] = {10};
+    float row_grad[] = {2, 2, 2, 2};
+    passed = passed && scaled->size == 4 && compare_tensor_data(scaled->data, scaled_data, 4) &&
+             compare_tensor_data(scalar->grad, scalar_grad, 1) && compare_tensor_data(row->grad, row_grad, 4);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_mul_broadcast_backward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_mul_broadcast_backward:");
+    }
+
+    free_tensor(column);
+    free_tensor(matrix);
+    free_tensor(result);
+    free_tensor(scalar);
+    free_tensor(row);
+    free_tensor(scaled);
+}
+
+/* Leading dims [2,1] and [3] of a matmul broadcast to [2,3] batches */
+void test_matmul_broadcast_batches() {
+    int a_shape[] = {2, 1, 2, 3};
+    int b_shape[] = {3, 3, 2};
+    float a_data[12];
+    float b_data[18];
+    for (int i = 0; i < 12; i++) a_data[i] = i - 5;
+    for (int i = 0; i < 18; i++) b_data[i] = 0.5 * i;
+    Tensor* a = create_tensor(a_data, a_shape, 4, 0);
+    Tensor* b = create_tensor(b_data, b_shape, 3, 0);
+
+    Tensor* result = matmul(a, b);
+
+    int passed = result->num_dims == 4 && result->shape[0] == 2 && result->shape[1] == 3 &&
+                 result->shape[2] == 2 && result->shape[3] == 2;
+    for (int i = 0; i < 2 && passed; i++) {
+        for (int j = 0; j < 3; j++) {
+            for (int m = 0; m < 2; m++) {
+                for (int n = 0; n < 2; n++) {
+                    float expected = 0;
+                    for (int k = 0; k < 3; k++) expected += a_data[i * 6 + m * 3 + k] * b_data[j * 6 + k * 2 + n];
+                    passed = passed && result->data[((i * 3 + j) * 2 + m) * 2 + n] == expected;
+                }
+            }
+        }
+    }
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_matmul_broadcast_batches:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_matmul_broadcast_batches:");
+    }
+
+    free_tensor(a);
+    free_tensor(b);
+    free_tensor(result);
+}
+
+void test_reshape_view() {
+    int shape[] = {2, 3};
+    int new_shape[] = {3, 2};
+    float data[] = {1, 2, 3, 4, 5, 6};
+
+    Tensor* t = create_tensor(data, shape, 2, 0);
+    Tensor* result = reshape(t, new_shape, 2);
+
+    // A reshape of a contiguous tensor shares its data
+    if (result->data == t->data && result->shape[0] == 3 && result->shape[1] == 2 && is_contiguous(result)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_reshape_view:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_reshape_view:");
+    }
+
+    free_tensor(t);
+    free_tensor(result);
+}
+
+void test_slice_rows() {
+    int shape[] = {4, 2};
+    float data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    Tensor* t = create_tensor(data, shape, 2, 0);
+    Tensor* result = slice(t, 0, 1, 3);
+
+    float expected_data[] = {3, 4, 5, 6};
+
+    // Row slices are contiguous views into the same buffer
+    if (result->data == t->data + 2 && is_contiguous(result) && compare_tensor_data(result->data, expected_data, result->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_slice_rows:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_slice_rows:");
+    }
+
+    free_tensor(t);
+    free_tensor(result);
+}
+
+void test_transpose_matmul() {
+    int shape[] = {2, 3};
+    float data1[] = {1, 2, 3, 4, 5, 6};
+    float data2[] = {1, 0, 1, 0, 1, 0};
+
+    Tensor* t1 = create_tensor(data1, shape, 2, 0);
+    Tensor* t2 = create_tensor(data2, shape, 2, 0);
+    Tensor* t2_transposed = transpose(t2, 0, 1); // [3, 2] view of t2
+
+    Tensor* result = matmul(t1, t2_transposed);
+
+    float expected_data[] = {4, 2, 10, 5};
+
+    if (!is_contiguous(t2_transposed) && compare_tensor_data(result->data, expected_data, result->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_transpose_matmul:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_transpose_matmul:");
+    }
+
+    free_tensor(t1);
+    free_tensor(t2);
+    free_tensor(t2_transposed);
+    free_tensor(result);
+}
+
+void test_transpose_backward() {
+    int shape[] = {2, 3};
+    float data[] = {1, -2, 3, -4, 5, -6};
+
+    Tensor* t = create_tensor(data, shape, 2, 1);
+    Tensor* t_transposed = transpose(t, 0, 1);
+    Tensor* activations = relu(t_transposed);
+
+    // Gradients flow through the view straight into the grads of t
+    for (int i = 0; i < activations->size; i++) {
+        activations->grad[i] = i + 1;
+    }
+    activations->backward_func(activations);
+
+    // activations is [3, 2] so grad i lands on t[i % 2][i / 2]
+    float expected_grad[] = {1, 0, 5, 0, 4, 0};
+
+    if (compare_tensor_data(t->grad, expected_grad, t->size)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_transpose_backward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_transpose_backward:");
+    }
+
+    free_tensor(t);
+    free_tensor(t_transposed);
+    free_tensor(activations);
+}
+
+void test_dense_forward() {
+    int input_shape[] = {4, 3};
+    float input_data[] = {1, -2, 3, 0.5, 0, -1, 2, 2, 2, -3, 1, 0};
+    int weight_shape[] = {3, 2};
+    float weight_data[] = {0.5, -1, 1, 0.25, -0.5, 2};
+    int bias_shape[] = {2};
+    float bias_data[] = {0.1, -0.2};
+
+    Tensor* input = create_tensor(input_data, input_shape, 2, 0);
+    Tensor* weights = create_tensor(weight_data, weight_shape, 2, 0);
+    Tensor* biases = create_tensor(bias_data, bias_shape, 1, 0);
+    Tensor* output = dense(input, weights, biases, ACTIVATION_RELU);
+
+    // rows of input @ weights + biases, then relu
+    float expected[] = {0, 4.3, 0.85, 0, 2.1, 2.3, 0, 3.05};
+
+    if (compare_tensor_data(output->data, expected, 8)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_dense_forward:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_dense_forward:");
+    }
+
+    free_tensor(input);
+    free_tensor(weights);
+    free_tensor(biases);
+    free_tensor(output);
+}
+
+void test_dense_backward_sigmoid() {
+    int input_shape[] = {2, 2};
+    float input_data[] = {1, -1, 0.5, 2};
+    int weight_shape[] = {2, 1};
+    float weight_data[] = {0.5, -0.5};
+    int bias_shape[] = {1};
+    float bias_data[] = {0};
+
+    Tensor* input = create_tensor(input_data, input_shape, 2, 1);
+    Tensor* weights = create_tensor(weight_data, weight_shape, 2, 1);
+    Tensor* biases = create_tensor(bias_data, bias_shape, 1, 1);
+    Tensor* output = dense(input, weights, biases, ACTIVATION_SIGMOID);
+    Tensor* loss = reduce_sum(output);
+    Topo* topo = backward(loss);
+
+    // z = [1, -0.75], dz = sigmoid(z) * (1 - sigmoid(z)) per row
+    float dz[] = {0.19661193, 0.21789499};
+    float expected_input_grad[] = {dz[0] * 0.5, dz[0] * -0.5, dz[1] * 0.5, dz[1] * -0.5};
+    float expected_weight_grad[] = {dz[0] * 1 + dz[1] * 0.5, dz[0] * -1 + dz[1] * 2};
+    float expected_bias_grad[] = {dz[0] + dz[1]};
+
+    if (compare_tensor_data(input->grad, expected_input_grad, 4) &&
+        compare_tensor_data(weights->grad, expected_weight_grad, 2) &&
+        compare_tensor_data(biases->grad, expected_bias_grad, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_dense_backward_sigmoid:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_dense_backward_sigmoid:");
+    }
+
+    free_graph_from_topo(topo);
+    free_tensor(input);
+    free_tensor(weights);
+    free_tensor(biases);
+}
+
+/* GELU needs the value before the activation for its grads, so dense applies it as its
+   own op after the fused bias */
+void test_dense_backward_gelu() {
+    int input_shape[] = {2, 2};
+    float input_data[] = {1, -1, 0.5, -0.5};
+    int weight_shape[] = {2, 1};
+    float weight_data[] = {0.5, -0.5};
+    int bias_shape[] = {1};
+    float bias_data[] = {0};
+
+    Tensor* input = create_tensor(input_data, input_shape, 2, 1);
+    Tensor* weights = create_tensor(weight_data, weight_shape, 2, 1);
+    Tensor* biases = create_tensor(bias_data, bias_shape, 1, 1);
+    Tensor* output = dense(input, weights, biases, ACTIVATION_GELU);
+    Tensor* loss = reduce_sum(output);
+    Topo* topo = backward(loss);
+
+    // z = [1, 0.5], dz = gelu'(z) per row
+    float expected_output[] = {0.84119199, 0.34571401};
+    float dz[] = {1.0829641, 0.8673699};
+    float expected_input_grad[] = {dz[0] * 0.5, dz[0] * -0.5, dz[1] * 0.5, dz[1] * -0.5};
+    float expected_weight_grad[] = {dz[0] * 1 + dz[1] * 0.5, dz[0] * -1 + dz[1] * -0.5};
+    float expected_bias_grad[] = {dz[0] + dz[1]};
+
+    if (compare_tensor_data(output->data, expected_output, 2) &&
+        compare_tensor_data(input->grad, expected_input_grad, 4) &&
+        compare_tensor_data(weights->grad, expected_weight_grad, 2) &&
+        compare_tensor_data(biases->grad, expected_bias_grad, 1)) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_dense_backward_gelu:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_dense_backward_gelu:");
+    }
+
+    free_graph_from_topo(topo);
+    free_tensor(input);
+    free_tensor(weights);
+    free_tensor(biases);
+}
 
 int main() {
     test_add_1d();
@@ -901,11 +1269,26 @@ int main() {
 
     test_sigmoid_2d();
     test_sigmoid_backward_2d();
+    test_tanh_backward_2d();
+    test_gelu_backward_2d();
+    test_silu_backward_2d();
 
     test_broadcasting_valid_diff_dims();
     test_broadcasting_valid_same_dims();
     test_broadcasting_invalid_same_dims();
     test_broadcasting_invalid_diff_dims();
+    test_add_broadcast_backward();
+    test_mul_broadcast_backward();
+    test_matmul_broadcast_batches();
+
+    test_reshape_view();
+    test_slice_rows();
+    test_transpose_matmul();
+    test_transpose_backward();
+
+    test_dense_forward();
+    test_dense_backward_sigmoid();
+    test_dense_backward_gelu();
 
     return 0;
 }
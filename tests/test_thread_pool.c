@@ -0,0 +1,193 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/thread_pool.h"
+#include "../src/gemm.h"
+#include "../src/tensor.h"
+#include "../src/backward.h"
+#include "../src/tensor_ops.h"
+#include "../src/utility.h"
+
+const int PADDING_WIDTH = -35;
+
+void count_indices(void* ctx, long long start, long long end) {
+    int* counts = (int*)ctx;
+    for (int i = start; i < end; i++) {
+        counts[i]++;
+    }
+}
+
+void test_parallel_for_covers_range() {
+    set_num_threads(4);
+    int n = 100003;
+    int* counts = (int*)calloc(n, sizeof(int));
+    parallel_for(n, 1000, count_indices, counts);
+
+    int passed = 1;
+    for (int i = 0; i < n; i++) {
+        if (counts[i] != 1) {
+            printf("Index %d was visited %d times\n", i, counts[i]);
+            passed = 0;
+            break;
+        }
+    }
+    free(counts);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_parallel_for_covers_range:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_parallel_for_covers_range:");
+    }
+}
+
+typedef struct NestedCounts {
+    int* counts;
+    int n;
+} NestedCounts;
+
+void nested_loop(void* ctx, long long start, long long end) {
+    NestedCounts* nested = (NestedCounts*)ctx;
+    for (int i = start; i < end; i++) {
+        parallel_for(nested->n, 1, count_indices, nested->counts + i * nested->n);
+    }
+}
+
+void test_parallel_for_nested() {
+    set_num_threads(4);
+    int outer = 8, inner = 1000;
+    int* counts = (int*)calloc(outer * inner, sizeof(int));
+    NestedCounts nested = {counts, inner};
+    parallel_for(outer, 1, nested_loop, &nested);
+
+    int passed = 1;
+    for (int i = 0; i < outer * inner; i++) {
+        if (counts[i] != 1) passed = 0;
+    }
+    free(counts);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_parallel_for_nested:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_parallel_for_nested:");
+    }
+}
+
+void test_set_num_threads() {
+    set_num_threads(3);
+    int three = get_num_threads();
+    set_num_threads(0);
+    int clamped = get_num_threads();
+
+    if (three == 3 && clamped == 1) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_set_num_threads:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_set_num_threads:");
+    }
+}
+
+/* The threaded gemm splits C into tiles, each tile must match the single threaded result */
+void test_gemm_threads() {
+    int M = 301, N = 203, K = 150;
+    float* A = uniform_random_array(M * K, -1, 1);
+    float* B = uniform_random_array(K * N, -1, 1);
+    float* serial = (float*)malloc(M * N * sizeof(float));
+    float* threaded = (float*)malloc(M * N * sizeof(float));
+
+    set_num_threads(1);
+    gemm(M, N, K, A, K, 1, B, N, 1, serial, N, 0);
+    set_num_threads(4);
+    gemm(M, N, K, A, K, 1, B, N, 1, threaded, N, 0);
+
+    int passed = 1;
+    for (int i = 0; i < M * N; i++) {
+        if (serial[i] != threaded[i]) {
+            printf("Mismatch at index %d: %.8f != %.8f\n", i, threaded[i], serial[i]);
+            passed = 0;
+            break;
+        }
+    }
+    free(A);
+    free(B);
+    free(serial);
+    free(threaded);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_gemm_threads:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_gemm_threads:");
+    }
+}
+
+/* Run a forward and backward pass through elementwise ops, a broadcast and a batched
+   matmul and return the output and input grads */
+void run_ops(float* x_data, float* w_data, float* b_data, float* out, float* x_grad, float* b_grad) {
+    int x_shape[3] = {8, 64, 256};
+    int w_shape[3] = {8, 256, 128};
+    int b_shape[3] = {1, 1, 128};
+    Tensor* x = create_tensor(x_data, x_shape, 3, 1);
+    Tensor* w = create_tensor(w_data, w_shape, 3, 1);
+    Tensor* b = create_tensor(b_data, b_shape, 3, 1);
+
+    Tensor* h = relu(add(matmul(x, w), b));
+    Tensor* y = sum(mul(sigmoid(h), h));
+    Tensor* loss = reduce_sum(y);
+    Topo* topo = backward(loss);
+
+    for (int i = 0; i < y->size; i++) out[i] = y->data[i];
+    for (int i = 0; i < x->size; i++) x_grad[i] = x->grad[i];
+    for (int i = 0; i < b->size; i++) b_grad[i] = b->grad[i];
+    free_graph_from_topo(topo);
+    free_tensor(x);
+    free_tensor(w);
+    free_tensor(b);
+}
+
+void test_ops_threads() {
+    int x_size = 8 * 64 * 256, w_size = 8 * 256 * 128, b_size = 128, y_size = 8 * 64;
+    float* x_data = uniform_random_array(x_size, -1, 1);
+    float* w_data = uniform_random_array(w_size, -1, 1);
+    float* b_data = uniform_random_array(b_size, -1, 1);
+    float* results[2][3];
+    int sizes[3] = {y_size, x_size, b_size};
+
+    int threads[2] = {1, 4};
+    for (int run = 0; run < 2; run++) {
+        set_num_threads(threads[run]);
+        for (int j = 0; j < 3; j++) results[run][j] = (float*)malloc(sizes[j] * sizeof(float));
+        run_ops(x_data, w_data, b_data, results[run][0], results[run][1], results[run][2]);
+    }
+
+    int passed = 1;
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < sizes[j]; i++) {
+            if (fabs(results[0][j][i] - results[1][j][i]) > 1e-4 * (1 + fabs(results[0][j][i]))) {
+                printf("Mismatch in output %d at index %d: %.8f != %.8f\n", j, i, results[1][j][i], results[0][j][i]);
+                passed = 0;
+                break;
+            }
+        }
+    }
+    for (int run = 0; run < 2; run++) {
+        for (int j = 0; j < 3; j++) free(results[run][j]);
+    }
+    free(x_data);
+    free(w_data);
+    free(b_data);
+
+    if (passed) {
+        printf("%-*s PASSED\n", PADDING_WIDTH, "test_ops_threads:");
+    } else {
+        printf("%-*s FAILED\n", PADDING_WIDTH, "test_ops_threads:");
+    }
+}
+
+int main() {
+    test_parallel_for_covers_range();
+    test_parallel_for_nested();
+    test_set_num_threads();
+    test_gemm_threads();
+    test_ops_threads();
+    shutdown_thread_pool();
+    return 0;
+}
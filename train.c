@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include "src/arena.h"
 #include "src/dataset.h"
+#include "src/fusion.h"
+#include "src/graph.h"
+#include "src/kernels.h"
 #include "src/loss.h"
 #include "src/mlp.h"
 #include "src/optimizer.h"
@@ -39,7 +43,11 @@ void export_points_for_decision_boundary(LayerList* mlp, float* dataset_points,
     float* x_coords = linspace(min_x-1, max_x+1, n_x_steps);
     float* y_coords = linspace(min_y-1.5, max_y+1, n_y_steps);
     int n_points = n_x_steps * n_y_steps;
-    float points[n_points*2];
+    float* points = (float*)malloc((size_t)n_points * 2 * sizeof(float));
+    if (!points) {
+        fprintf(stderr, "Memory allocation failed when allocating the linspace points.\n");
+        exit(EXIT_FAILURE);
+    }
     int point = 0;
     for (int y=0; y < n_y_steps; y++) {
         for (int x=0; x < n_x_steps; x++) {
@@ -49,12 +57,21 @@ void export_points_for_decision_boundary(LayerList* mlp, float* dataset_points,
     }
     
     int input_shape[2] = {n_points, 2};
-    Tensor* input = create_tensor(points, input_shape, 2, 0);
-    Tensor* output = forward_layers(input, mlp);
+    Tensor* input = create_tensor_from_buffer(points, input_shape, 2);
+    // Only the predictions are needed, so no graph is built
+    Tensor* output = forward_layers_inference(input, mlp);
+    // the mlp outputs logits, export probabilities
+    kernels.sigmoid(output->data, output->data, output->size);
 
     export_2d_points_to_txt("linspace_points.txt", points, n_points);
     export_2d_points_to_txt("dataset_points.txt", dataset_points, n_dataset_points);
     export_1d_array_to_txt("linspace_labels.txt", output->data, n_points);
+
+    free_tensor(input);
+    free_tensor(output);
+    free(x_coords);
+    free(y_coords);
+    free(points);
 }
 
 int main() {
@@ -62,65 +79,99 @@ int main() {
     srand(random_seed);
 
     int n_samples = 100;
-    int input_shape[] = {n_samples, 2};
-    int label_shape[] = {n_samples, 1};
     Dataset* moons = create_moons(n_samples / 2, n_samples / 2, 0.1);
 
     int layer_sizes[] = {16, 16, 1};
-    LayerList* mlp = create_mlp(2, layer_sizes, 3);
+    // No output sigmoid, the loss takes the logits
+    LayerList* mlp = create_mlp_flat(2, layer_sizes, 3, NULL);
 
     int n_steps = 100;
     // init lr doesnt matter here as im manually changing it in the training loop
     float init_lr = 1.0;
     SGD* optim = init_sgd(init_lr); 
-
-    Tensor* input = create_tensor(moons->x, input_shape, 2, 0);
-    Tensor* y_true = create_tensor(moons->y, label_shape, 2, 0);
+    ParamList* params = mlp_parameters(mlp);
+
+    // Snapshots of the weights are written to disk by a background thread while training goes on
+    int checkpoint_every = 25;
+    CheckpointWriter* checkpoints = create_checkpoint_writer(mlp, "moons_mlp.ckpt");
+
+    // Shuffled mini-batches are gathered by a background thread while each step runs.
+    // The step is built on tensors of the first batch's size, and every batch is fed in
+    // by pointing them at its buffers, so dropping the short last batch keeps the shapes fixed.
+    int batch_size = 50;
+    DataLoader* loader = create_data_loader(moons, batch_size, 1, 1);
+    Batch* batch = data_loader_next(loader);
+    int input_shape[2] = {batch_size, moons->num_features};
+    int label_shape[2] = {batch_size, 1};
+    Tensor* input = create_tensor_from_buffer(batch->inputs->data, input_shape, 2);
+    Tensor* y_true = create_tensor_from_buffer(batch->labels->data, label_shape, 2);
 
     float alpha_data[1] = {1e-4};
     int alpha_shape[1] = {1};
     Tensor* alpha = create_tensor(alpha_data, alpha_shape, 1, 0);
+
+    // Intermediate tensors of the step come from the arena, the weights stay on the heap
+    Arena* step_arena = create_arena(1 << 20);
+    set_tensor_arena(step_arena);
+
+    // Build the step once, the shapes never change so every step replays it in place.
+    // The elementwise ops are recorded lazily and fused when the graph is captured.
+    set_lazy_mode(1);
+    Tensor* output = forward_layers(input, mlp);
+    Tensor* loss = binary_cross_entropy_with_logits(output, y_true);
+
+    Tensor* reg_loss; // L2 Regularization
+    for (int layer=0; layer < mlp->num_layers; layer++) {
+        Tensor* weights = mlp->layers[layer]->weights;
+        Tensor* biases = mlp->layers[layer]->biases;
+        Tensor* w_sqr = mul(weights, weights);
+        Tensor* b_sqr = mul(biases, biases);
+        Tensor* w_sum = reduce_sum(w_sqr);
+        Tensor* b_sum = reduce_sum(b_sqr);
+        reg_loss = add(w_sum, b_sum);
+    }
+
+    reg_loss = mul(alpha, reg_loss);
+    loss = add(loss, reg_loss);
+    Graph* step = capture_graph(loss);
+    set_lazy_mode(0);
+    set_tensor_arena(NULL);
     
     // TRAINING LOOP
     for (int i=0; i < n_steps; i++) {
-        Tensor* output = forward_layers(input, mlp);
-        Tensor* loss = binary_cross_entropy(output, y_true);
-        
-        Tensor* reg_loss; // L2 Regularization
-        for (int layer=0; layer < mlp->num_layers; layer++) {
-            Tensor* weights = mlp->layers[layer]->weights;
-            Tensor* biases = mlp->layers[layer]->biases;
-            Tensor* w_sqr = mul(weights, weights);
-            Tensor* b_sqr = mul(biases, biases);
-            Tensor* w_sum = reduce_sum(w_sqr);
-            Tensor* b_sum = reduce_sum(b_sqr);
-            reg_loss = add(w_sum, b_sum);
-        }
-
-        reg_loss = mul(alpha, reg_loss);
-        loss = add(loss, reg_loss);
-
-        Topo* topo = backward(loss);
+        if (i > 0) batch = data_loader_next(loader);
+        input->data = batch->inputs->data;
+        y_true->data = batch->labels->data;
+        graph_forward(step);
+        zero_grad(params);
+        graph_backward(step);
 
         float accuracy = 0;
-        for (int j = 0; j < y_true->size; j++) {
-            accuracy += (output->data[j] >= 0.5) == (y_true->data[j] == 1);
+        for (long long j = 0; j < y_true->size; j++) {
+            accuracy += (output->data[j] >= 0) == (y_true->data[j] == 1);
         }
         accuracy /= y_true->size;
 
         // very small decay, this example works well with high lr
         float lr = init_lr - (init_lr-0.6)*i/n_steps;
-        optim->update(topo, lr);
+        optim->update(params, lr);
+        if ((i+1) % checkpoint_every == 0) checkpoint_mlp(checkpoints, i+1);
         printf("Step: %d;   Loss: %.8f   Accuracy: %.3f%%   LR: %f\n", i+1, loss->data[0], accuracy*100, lr);
-
-        free_graph_from_topo(topo); // free intermediate tensors
     }
     
     export_points_for_decision_boundary(mlp, moons->x, moons->length);
 
-    free_dataset(moons);
+    // the graph refers to the weights and inputs so it goes first
+    free_checkpoint_writer(checkpoints); // waits for the last checkpoint to be written
+    free_graph(step);
+    free_arena(step_arena); // frees the tensors of the captured step
     free_layer_list(mlp);
     free_tensor(input);
     free_tensor(y_true);
+    free_data_loader(loader);
+    free_dataset(moons);
+    free_tensor(alpha);
+    free(optim);
+    free_param_list(params);
     return 0;
 }
\ No newline at end of file